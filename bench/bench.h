@@ -0,0 +1,87 @@
+/*====================================================================*/
+/* Set-up shared by the benchmarks in this directory. listfiles.c is  */
+/* built in with its main() renamed, so they time the program's own   */
+/* routines. Each benchmark is one file, built from the top directory */
+/* of the repository, e.g.:                                           */
+/*                                                                    */
+/*   gcc -O2 -pthread -o item_bench bench/item_bench.c                */
+/*====================================================================*/
+
+#define main listfilesMain
+#include "../listfiles.c"
+#undef main
+
+#include <time.h>
+
+#define BENCH_SEED 1		//Same names on every run
+#define BENCH_ITEMS 1000000	//Items listed when not given
+#define BENCH_DIR "/var/tmp/listfiles_bench_dir"	//Generated directory
+
+//BENCH FUNCTIONS
+double  benchNow(void);
+void    benchName(char *out, unsigned n);
+int     benchList(LISTDATA * list, unsigned count);
+double  benchBest(double best, double time);
+int     benchDir(const char *path, unsigned count);
+
+// benchNow: monotonic time in ms.
+double benchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* benchName: name no. n of the generated listings. Call srand() */
+/* with BENCH_SEED first to get the same names every time. */
+void benchName(char *out, unsigned n) {
+  sprintf(out, "file_%u_%x.txt", n, (unsigned)rand());
+}
+
+/* benchList: add "count" generated files to a list, formatted as */
+/* listFiles() does. Returns -1 if out of memory. */
+int benchList(LISTDATA * list, unsigned count) {
+  char    name[64], temp[MAX_ITEM_LENGTH + 1];
+  unsigned i;
+  srand(BENCH_SEED);
+  for(i = 0; i < count; i++) {
+    benchName(name, i);
+    formatItem(temp, name, FILEITEM);
+    if(additem(list, temp, name, FILEITEM) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// benchBest: the best of the times so far (best < 0: none yet).
+double benchBest(double best, double time) {
+  return (best < 0 || time < best) ? time : best;
+}
+
+/* benchDir: create directory path with count empty files, unless it */
+/* is there already. Returns -1 on failure. */
+int benchDir(const char *path, unsigned count) {
+  char    name[16];
+  unsigned i;
+  int     dirFd, fd;
+  double  start;
+  if(mkdir(path, 0755) != 0)
+    return (errno == EEXIST) ? 0 : -1;
+  printf("making %s with %u files... ", path, count);
+  fflush(stdout);
+  start = benchNow();
+  dirFd = open(path, O_RDONLY | O_DIRECTORY);
+  if(dirFd < 0)
+    return -1;
+  for(i = 0; i < count; i++) {
+    sprintf(name, "f%07u", i);
+    fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+      close(dirFd);
+      return -1;
+    }
+    close(fd);
+  }
+  close(dirFd);
+  printf("%.1f s\n", (benchNow() - start) / 1e3);
+  return 0;
+}
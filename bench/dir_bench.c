@@ -0,0 +1,150 @@
+/*====================================================================*/
+/* dir_bench: listFiles() with its getdents64() DIRREADER against the */
+/* opendir()/readdir() loop it replaced, on a generated directory.    */
+/* The directory is made on the first run (empty files f0000000...)   */
+/* and kept for the next ones; remove it with rm -rf when done. Each  */
+/* way is timed building the list and reading the entries only. The   */
+/* cache is warm: the generation or the first run fills it.           */
+/*                                                                    */
+/*   gcc -O2 -pthread -o dir_bench bench/dir_bench.c                  */
+/*   ./dir_bench [directory] [entries] [runs]                         */
+/*====================================================================*/
+
+#include "bench.h"
+
+typedef struct _dirtimes {
+  double  list;			// ms, list built, best of the runs
+  double  read;			// ms, entries read only
+  unsigned count;		// Items or entries
+} DIRTIMES;
+
+//DIR BENCH FUNCTIONS
+int     readdirList(LISTDATA * list, const char *path);
+unsigned readdirCount(const char *path);
+unsigned readerCount(int dirFd);
+
+/* readdirList: the list as listFiles() built it before DIRREADER: */
+/* readdir() entries, files kept in a store and added at the end. */
+/* Entries of unknown type are left out; there are none here. */
+int readdirList(LISTDATA * list, const char *path) {
+  DIR    *d;
+  struct dirent *dir;
+  char    temp[MAX_ITEM_LENGTH + 1];
+  ITEMSTORE files;
+  unsigned fileCount = 0, i;
+
+  addParents(list);
+  d = opendir(path);
+  if(d == NULL)
+    return -1;
+  initStore(&files);
+  while((dir = readdir(d)) != NULL) {
+    if(dir->d_type == DT_DIR) {
+      if(strcmp(dir->d_name, CURRENTDIR) == 0
+	 || strcmp(dir->d_name, CHANGEDIR) == 0)
+	continue;
+      formatItem(temp, dir->d_name, DIRECTORY);
+      additem(list, temp, dir->d_name, DIRECTORY);
+    } else if(dir->d_type == DT_REG) {
+      formatItem(temp, dir->d_name, FILEITEM);
+      storeAppend(&files, fileCount++, temp, dir->d_name, FILEITEM);
+    }
+  }
+  closedir(d);
+  for(i = 0; i < fileCount; i++)
+    additem(list, files.blob + files.itemOffset[i],
+	    files.blob + files.pathOffset[i], FILEITEM);
+  freeStore(&files);
+  return 0;
+}
+
+// readdirCount: no. of entries in path, through readdir().
+unsigned readdirCount(const char *path) {
+  DIR    *d = opendir(path);
+  unsigned count = 0;
+  if(d == NULL)
+    return 0;
+  while(readdir(d) != NULL)
+    count++;
+  closedir(d);
+  return count;
+}
+
+// readerCount: no. of entries in dirFd, through DIRREADER.
+unsigned readerCount(int dirFd) {
+  DIRREADER reader;
+  const char *name;
+  unsigned char type;
+  unsigned count = 0;
+  if(openReaderAt(&reader, dirFd, CURRENTDIR) != 0)
+    return 0;
+  while(nextEntry(&reader, &name, &type))
+    count++;
+  closeReader(&reader);
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  DIRTIMES oldTimes = { -1, -1, 0 }, newTimes = { -1, -1, 0 };
+  LISTDATA list;
+  ARENA   arena;
+  const char *path = (argc > 1) ? argv[1] : BENCH_DIR;
+  unsigned count = (argc > 2) ? (unsigned)atoi(argv[2]) : BENCH_ITEMS;
+  unsigned runs = (argc > 3) ? (unsigned)atoi(argv[3]) : 3, run;
+  double  start;
+  int     dirFd;
+
+  if(count == 0 || runs == 0) {
+    fprintf(stderr, "usage: %s [directory] [entries] [runs]\n", argv[0]);
+    return 1;
+  }
+  if(benchDir(path, count) != 0
+     || (dirFd = open(path, O_RDONLY | O_DIRECTORY)) < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  //The two ways take turns, so neither gets a warmer cache.
+  for(run = 0; run < runs; run++) {
+    initList(&list);
+    initArena(&arena, ARENA_SLAB_SIZE);
+    list.arena = &arena;
+    start = benchNow();
+    readdirList(&list, path);
+    oldTimes.list = benchBest(oldTimes.list, benchNow() - start);
+    oldTimes.count = list.length;
+    deleteList(&list);
+    freeArena(&arena);
+
+    initList(&list);
+    initArena(&arena, ARENA_SLAB_SIZE);
+    list.arena = &arena;
+    start = benchNow();
+    listFiles(&list, dirFd);
+    newTimes.list = benchBest(newTimes.list, benchNow() - start);
+    newTimes.count = list.length;
+    deleteList(&list);
+    freeArena(&arena);
+
+    start = benchNow();
+    readdirCount(path);
+    oldTimes.read = benchBest(oldTimes.read, benchNow() - start);
+    start = benchNow();
+    readerCount(dirFd);
+    newTimes.read = benchBest(newTimes.read, benchNow() - start);
+  }
+  close(dirFd);
+
+  printf("%s, %u items, best of %u runs, ms\n", path, newTimes.count,
+	 runs);
+  printf("%-18s %9s %9s\n", "reader", "list", "read only");
+  printf("%-18s %9.1f %9.1f\n", "opendir/readdir", oldTimes.list,
+	 oldTimes.read);
+  printf("%-18s %9.1f %9.1f\n", USE_GETDENTS ? "getdents64" : "DIRREADER",
+	 newTimes.list, newTimes.read);
+  if(oldTimes.count != newTimes.count) {
+    fprintf(stderr, "readdir listed %u items\n", oldTimes.count);
+    return 1;
+  }
+  return 0;
+}
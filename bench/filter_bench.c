@@ -0,0 +1,140 @@
+/*====================================================================*/
+/* filter_bench: the filter on the thread pool, inline and with 1..N  */
+/* workers, over generated names. The text is typed one key at a      */
+/* time and each search is waited for, as Enter does; "first" is when */
+/* the first hits of a key were merged, which is when the UI shows    */
+/* them. Workers only help where there are cores to run them.         */
+/*                                                                    */
+/*   gcc -O2 -pthread -o filter_bench bench/filter_bench.c            */
+/*   ./filter_bench [items] [workers] [text]                          */
+/*====================================================================*/
+
+#include "bench.h"
+
+typedef struct _keytimes {
+  double  mean;			// ms per key, search complete
+  double  first;		// ms per key until the first hits
+  unsigned hits;		// Items matching the whole text
+} KEYTIMES;
+
+//FILTER BENCH FUNCTIONS
+int     typeKeys(FILTER * filter, LISTDATA * list, const char *text,
+		 int mode, KEYTIMES * times);
+
+/* typeKeys: type text into an empty filter, one key at a time, each */
+/* search waited for as filterWait() does. Returns -1 if out of memory. */
+int typeKeys(FILTER * filter, LISTDATA * list, const char *text, int mode,
+	     KEYTIMES * times) {
+  struct pollfd pfd;
+  double  start, total = 0, first = 0, shown;
+  unsigned i;
+  clearFilter(filter);
+  filter->mode = mode;
+  for(i = 0; text[i] != '\0'; i++) {
+    start = benchNow();
+    shown = -1;
+    if(filterAdd(filter, list, text[i]) < 0)
+      return -1;
+    while(filter->job != NULL) {
+      if(filter->pool != NULL
+	 && __atomic_load_n(&filter->job->finished, __ATOMIC_ACQUIRE) <
+	 filter->job->chunks) {
+	pfd.fd = filter->pool->notify[0];
+	pfd.events = POLLIN;
+	poll(&pfd, 1, -1);	//Until a task finishes
+      }
+      filterPump(filter);
+      if(shown < 0 && (filter->job == NULL || filter->job->hits > 0))
+	shown = benchNow() - start;
+    }
+    total = total + benchNow() - start;
+    first = first + ((shown < 0) ? benchNow() - start : shown);
+  }
+  times->mean = total / i;
+  times->first = first / i;
+  times->hits = (filter->typed == i) ? filter->count[filter->length] : 0;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  LISTDATA list;
+  ARENA   arena;
+  FILTER  filter;
+  POOL    pool;
+  KEYTIMES substring, fuzzy;
+  unsigned count = (argc > 1) ? (unsigned)atoi(argv[1]) : BENCH_ITEMS;
+  long    cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned workers = (argc > 2) ? (unsigned)atoi(argv[2]) :
+      (cores > 4) ? (unsigned)cores : 4;
+  const char *text = (argc > 3) ? argv[3] : "file_12";
+  unsigned threads, hits = 0;
+  double  inline1 = 0;
+
+  if(count == 0 || text[0] == '\0' || strlen(text) > MAX_FILTER) {
+    fprintf(stderr, "usage: %s [items] [workers] [text, 1..%d "
+	    "characters]\n", argv[0], MAX_FILTER);
+    return 1;
+  }
+  if(workers > MAX_THREADS)
+    workers = MAX_THREADS;
+
+  initList(&list);
+  initArena(&arena, ARENA_SLAB_SIZE);
+  list.arena = &arena;
+  initFilter(&filter);
+  if(benchList(&list, count) != 0
+     || packNames(&filter.names, &list) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  printf("%u names, text \"%s\", %ld cores, ms per key\n", count, text,
+	 cores);
+  printf("%-8s %10s %10s %10s %10s\n", "workers", "key mean", "first",
+	 "speed-up", "fuzzy mean");
+  //A first pass, not timed, so the inline run does not pay the
+  //filter's first allocations and page faults.
+  if(typeKeys(&filter, &list, text, FILTER_FUZZY, &fuzzy) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  //0: every chunk inline, as with USE_THREADS 0.
+  for(threads = 0; threads <= workers; threads++) {
+    filter.pool = NULL;
+    if(threads > 0) {
+      if(initPool(&pool, threads) != 0) {
+	fprintf(stderr, "no pool with %u workers\n", threads);
+	return 1;
+      }
+      filter.pool = &pool;
+    }
+    if(typeKeys(&filter, &list, text, FILTER_SUBSTRING, &substring) != 0
+       || typeKeys(&filter, &list, text, FILTER_FUZZY, &fuzzy) != 0) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    if(threads == 0) {
+      inline1 = substring.mean;
+      hits = substring.hits;
+      printf("%-8s", "inline");
+    } else
+      printf("%-8u", threads);
+    printf(" %10.1f %10.1f %9.2fx %10.1f\n", substring.mean,
+	   substring.first, inline1 / substring.mean, fuzzy.mean);
+    if(substring.hits != hits) {
+      fprintf(stderr, "%u workers: %u hits, %u inline\n", threads,
+	      substring.hits, hits);
+      return 1;
+    }
+    if(threads > 0) {
+      clearFilter(&filter);
+      freePool(&pool);
+    }
+  }
+  printf("%u names match\n", hits);
+  filter.pool = NULL;
+  freeFilter(&filter);
+  deleteList(&list);
+  freeArena(&arena);
+  return 0;
+}
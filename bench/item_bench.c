@@ -0,0 +1,121 @@
+/*====================================================================*/
+/* item_bench: the packed ITEMSTORE against the LISTCHOICE linked     */
+/* list, items malloc()'ed one by one or bump-allocated from an       */
+/* ARENA. Each backend is timed building a list of generated files,   */
+/* walking it in order, seeking to items at random and freeing it.    */
+/* The list walk follows the next pointers; the store walk goes by    */
+/* item number. Seeks go through listItem(), as the listbox does; the */
+/* linked lists build their item table on the first one.             */
+/*                                                                    */
+/*   gcc -O2 -pthread -o item_bench bench/item_bench.c                */
+/*   ./item_bench [items] [runs]                                      */
+/*====================================================================*/
+
+#include "bench.h"
+
+#define BACKEND_MALLOC 0
+#define BACKEND_ARENA 1
+#define BACKEND_STORE 2
+#define BACKENDS 3
+
+typedef struct _itemtimes {
+  double  build;		// ms, best of the runs
+  double  walk;
+  double  seek;
+  double  free;
+} ITEMTIMES;
+
+const char *backendNames[BACKENDS] = {
+  "LISTCHOICE malloc", "LISTCHOICE arena", "ITEMSTORE"
+};
+
+volatile size_t sink1;		//Keeps the reads from being optimized out
+
+//ITEM BENCH FUNCTIONS
+int     itemRun(int backend, unsigned count, ITEMTIMES * times);
+
+/* itemRun: one run of the four steps on a backend; the times are */
+/* kept if better. Returns -1 if out of memory. */
+int itemRun(int backend, unsigned count, ITEMTIMES * times) {
+  LISTDATA list;
+  ARENA   arena;
+  ITEMSTORE store;
+  LISTCHOICE *aux;
+  size_t  sum = 0;
+  unsigned i, seed = BENCH_SEED;
+  double  start;
+
+  initList(&list);
+  if(backend == BACKEND_ARENA) {
+    initArena(&arena, ARENA_SLAB_SIZE);
+    list.arena = &arena;
+  }
+  if(backend == BACKEND_STORE) {
+    initStore(&store);
+    list.store = &store;
+  }
+
+  start = benchNow();
+  if(benchList(&list, count) != 0)
+    return -1;
+  times->build = benchBest(times->build, benchNow() - start);
+
+  start = benchNow();
+  if(backend == BACKEND_STORE)
+    for(i = 0; i < list.length; i++)
+      sum = sum + strlen(listItem(&list, i)) + listType(&list, i);
+  else
+    for(aux = list.head; aux != NULL; aux = aux->next)
+      sum = sum + strlen(aux->item) + aux->isDirectory;
+  times->walk = benchBest(times->walk, benchNow() - start);
+
+  start = benchNow();
+  for(i = 0; i < count; i++) {
+    seed = seed * 1103515245 + 12345;
+    sum = sum + listItem(&list, seed % count)[0];
+  }
+  times->seek = benchBest(times->seek, benchNow() - start);
+  sink1 = sum;
+
+  start = benchNow();
+  deleteList(&list);
+  if(backend == BACKEND_ARENA)
+    freeArena(&arena);
+  if(backend == BACKEND_STORE)
+    freeStore(&store);
+  times->free = benchBest(times->free, benchNow() - start);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  ITEMTIMES times[BACKENDS];
+  unsigned count = (argc > 1) ? (unsigned)atoi(argv[1]) : BENCH_ITEMS;
+  unsigned runs = (argc > 2) ? (unsigned)atoi(argv[2]) : 3, run;
+  int     backend;
+
+  if(count == 0 || runs == 0) {
+    fprintf(stderr, "usage: %s [items] [runs]\n", argv[0]);
+    return 1;
+  }
+  for(backend = 0; backend < BACKENDS; backend++) {
+    times[backend].build = -1;
+    times[backend].walk = -1;
+    times[backend].seek = -1;
+    times[backend].free = -1;
+  }
+  //Backends take turns, so none gets a warmer heap than the others.
+  for(run = 0; run < runs; run++)
+    for(backend = 0; backend < BACKENDS; backend++)
+      if(itemRun(backend, count, &times[backend]) != 0) {
+	fprintf(stderr, "%s: out of memory\n", backendNames[backend]);
+	return 1;
+      }
+  printf("%u items, best of %u runs, ms\n", count, runs);
+  printf("%-18s %9s %9s %9s %9s\n", "backend", "build", "walk", "seek",
+	 "free");
+  for(backend = 0; backend < BACKENDS; backend++)
+    printf("%-18s %9.1f %9.1f %9.1f %9.1f\n", backendNames[backend],
+	   times[backend].build, times[backend].walk, times[backend].seek,
+	   times[backend].free);
+  return 0;
+}
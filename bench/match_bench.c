@@ -0,0 +1,169 @@
+/*====================================================================*/
+/* match_bench: the filter's matchers against a naive strcasestr()    */
+/* over the same generated names. For each search routine (scalar,    */
+/* SSE2 and AVX2 where the CPU has them) it times one scan of the     */
+/* packed names for the whole text, then typing the text one key at   */
+/* a time through the filter, in substring and in fuzzy mode (scoring */
+/* and ranking included). The filter runs inline here; see            */
+/* filter_bench.c for the thread pool.                                */
+/*                                                                    */
+/*   gcc -O2 -pthread -o match_bench bench/match_bench.c              */
+/*   ./match_bench [items] [text]                                     */
+/*====================================================================*/
+
+#include "bench.h"
+
+#define MATCHERS 3
+
+typedef struct _matcher {
+  const char *name;
+  size_t  (*find) (const char *, size_t, size_t, const char *, unsigned);
+} MATCHER;
+
+typedef struct _typing {
+  double  mean;			// ms per key
+  double  worst;		// ms, slowest key
+  unsigned hits;		// Items matching the whole text
+} TYPING;
+
+volatile size_t sink1;		//Keeps the reads from being optimized out
+
+//MATCH BENCH FUNCTIONS
+unsigned naiveCount(LISTDATA * list, const char *text);
+unsigned scanCount(NAMEBLOB * names, const char *text);
+int     typeText(FILTER * filter, LISTDATA * list, const char *text,
+		 int mode, TYPING * typing);
+
+// naiveCount: no. of names text is in, strcasestr() on each.
+unsigned naiveCount(LISTDATA * list, const char *text) {
+  unsigned i, count = 0;
+  for(i = 0; i < list->length; i++)
+    if(strcasestr(listPath(list, i), text) != NULL)
+      count++;
+  return count;
+}
+
+/* scanCount: no. of names text is in, one pass of findText over the */
+/* packed names that skips to the next name after each hit (as level */
+/* 1 of the filter does). text is in lower case. */
+unsigned scanCount(NAMEBLOB * names, const char *text) {
+  size_t  pos = 0, end = names->offset[names->length];
+  unsigned item = 0, count = 0, len = strlen(text);
+  while((pos = findText(names->blob, pos, end, text, len)) != NO_MATCH) {
+    while(names->offset[item + 1] <= pos)
+      item++;
+    count++;
+    pos = names->offset[item + 1];
+  }
+  return count;
+}
+
+/* typeText: type text into an empty filter, one key at a time, each */
+/* search run to the end. Returns -1 if out of memory. */
+int typeText(FILTER * filter, LISTDATA * list, const char *text, int mode,
+	     TYPING * typing) {
+  double  start, time, total = 0;
+  unsigned i;
+  clearFilter(filter);
+  filter->mode = mode;
+  typing->worst = 0;
+  for(i = 0; text[i] != '\0'; i++) {
+    start = benchNow();
+    if(filterAdd(filter, list, text[i]) < 0)
+      return -1;
+    filterWait(filter);
+    time = benchNow() - start;
+    total = total + time;
+    if(time > typing->worst)
+      typing->worst = time;
+  }
+  typing->mean = total / i;
+  typing->hits = (filter->typed == i) ? filter->count[filter->length] : 0;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  MATCHER matchers[MATCHERS];
+  LISTDATA list;
+  ARENA   arena;
+  FILTER  filter;
+  TYPING  substring, fuzzy;
+  unsigned count = (argc > 1) ? (unsigned)atoi(argv[1]) : BENCH_ITEMS;
+  const char *text = (argc > 2) ? argv[2] : "file_12";
+  char    lower[MAX_FILTER + 1], prefix[MAX_FILTER + 1];
+  unsigned i, used = 0, hits, naive, len;
+  double  start, time;
+
+  if(count == 0 || text[0] == '\0' || strlen(text) > MAX_FILTER) {
+    fprintf(stderr, "usage: %s [items] [text, 1..%d characters]\n",
+	    argv[0], MAX_FILTER);
+    return 1;
+  }
+  len = strlen(text);
+  for(i = 0; i <= len; i++)
+    lower[i] = (char)tolower((unsigned char)text[i]);
+
+  matchers[used].name = "scalar";
+  matchers[used++].find = findScalar;
+#if HAVE_SSE2
+  matchers[used].name = "SSE2";
+  matchers[used++].find = findSSE2;
+#endif
+#if HAVE_AVX2
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    matchers[used].name = "AVX2";
+    matchers[used++].find = findAVX2;
+  }
+#endif
+
+  initList(&list);
+  initArena(&arena, ARENA_SLAB_SIZE);
+  list.arena = &arena;
+  initFilter(&filter);
+  if(benchList(&list, count) != 0
+     || packNames(&filter.names, &list) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  printf("%u names, text \"%s\", ms\n", count, text);
+  printf("%-10s %9s %12s %12s %12s %12s\n", "matcher", "scan",
+	 "key mean", "key worst", "fuzzy mean", "fuzzy worst");
+  start = benchNow();
+  naive = naiveCount(&list, text);
+  time = benchNow() - start;
+  //The naive filter scans every name again for each key.
+  start = benchNow();
+  for(i = 1; i <= len; i++) {
+    memcpy(prefix, text, i);
+    prefix[i] = '\0';
+    sink1 = naiveCount(&list, prefix);
+  }
+  printf("%-10s %9.1f %12.1f %12s %12s %12s\n", "strcasestr", time,
+	 (benchNow() - start) / len, "", "", "");
+
+  for(i = 0; i < used; i++) {
+    findText = matchers[i].find;
+    start = benchNow();
+    hits = scanCount(&filter.names, lower);
+    time = benchNow() - start;
+    if(typeText(&filter, &list, text, FILTER_SUBSTRING, &substring) != 0
+       || typeText(&filter, &list, text, FILTER_FUZZY, &fuzzy) != 0) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    printf("%-10s %9.1f %12.1f %12.1f %12.1f %12.1f\n", matchers[i].name,
+	   time, substring.mean, substring.worst, fuzzy.mean, fuzzy.worst);
+    if(hits != naive || substring.hits != naive) {
+      fprintf(stderr, "%s: %u and %u hits, strcasestr() found %u\n",
+	      matchers[i].name, hits, substring.hits, naive);
+      return 1;
+    }
+  }
+  printf("%u names match, %u in fuzzy mode\n", naive, fuzzy.hits);
+  freeFilter(&filter);
+  deleteList(&list);
+  freeArena(&arena);
+  return 0;
+}
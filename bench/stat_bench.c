@@ -0,0 +1,184 @@
+/*====================================================================*/
+/* stat_bench: statMany() through io_uring (-u) against sequential    */
+/* fstatat() calls, over the names of a directory, as the size and    */
+/* date sorts stat them. "warm" stats the entries with the inode      */
+/* cache filled, "cold" after dropping the caches (sync, then 3 to    */
+/* /proc/sys/vm/drop_caches), which needs root; without it the cold   */
+/* runs are left out. The directory is the one dir_bench.c uses, made */
+/* here too if it is missing.                                         */
+/*                                                                    */
+/*   gcc -O2 -pthread -o stat_bench bench/stat_bench.c                */
+/*   ./stat_bench [directory] [warm entries] [cold entries] [runs]    */
+/*====================================================================*/
+
+#include "bench.h"
+
+#define BENCH_COLD 200000	//Entries stat'ed cold when not given
+#define STAT_WAYS 3
+
+typedef struct _stattimes {
+  double  warm;			// ms, best of the runs
+  double  cold;
+  unsigned stated;		// Entries stat'ed
+} STATTIMES;
+
+const char *statWays[STAT_WAYS] = {
+  "fstatat", "statMany", "statMany io_uring"
+};
+
+//STAT BENCH FUNCTIONS
+unsigned readNames(int dirFd, char **names, unsigned max);
+int     dropCaches(void);
+unsigned statWay(int way, int dirFd, const char **names, unsigned count,
+		 STATINFO * info);
+
+/* readNames: up to max names of the entries in dirFd, "." and ".." */
+/* left out. Returns how many there are; free each one. */
+unsigned readNames(int dirFd, char **names, unsigned max) {
+  DIRREADER reader;
+  const char *name;
+  unsigned char type;
+  unsigned count = 0;
+  if(openReaderAt(&reader, dirFd, CURRENTDIR) != 0)
+    return 0;
+  while(count < max && nextEntry(&reader, &name, &type)) {
+    if(strcmp(name, CURRENTDIR) == 0 || strcmp(name, CHANGEDIR) == 0)
+      continue;
+    names[count] = strdup(name);
+    if(names[count] == NULL)
+      break;
+    count++;
+  }
+  closeReader(&reader);
+  return count;
+}
+
+/* dropCaches: write dirty pages out and drop the page, dentry and */
+/* inode caches. Returns -1 if not allowed. */
+int dropCaches(void) {
+  int     fd;
+  sync();
+  fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if(fd < 0)
+    return -1;
+  if(write(fd, "3", 1) != 1) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+/* statWay: stat count names one of the three ways. Returns the no. */
+/* of entries stat'ed. */
+unsigned statWay(int way, int dirFd, const char **names, unsigned count,
+		 STATINFO * info) {
+  struct stat st;
+  URING   ring;
+  unsigned i, stated = 0;
+  if(way == 0) {
+    for(i = 0; i < count; i++)
+      if(fstatat(dirFd, names[i], &st, 0) == 0) {
+	info[i].size = st.st_size;
+	stated++;
+      }
+    return stated;
+  }
+  if(way == 1)
+    return statMany(NULL, dirFd, names, count, info);
+  uringOpen(&ring, URING_ENTRIES);
+  stated = statMany(&ring, dirFd, names, count, info);
+  uringClose(&ring);
+  return stated;
+}
+
+int main(int argc, char *argv[]) {
+  STATTIMES times[STAT_WAYS];
+  URING   ring;
+  STATINFO *info;
+  char  **names;
+  const char *path = (argc > 1) ? argv[1] : BENCH_DIR;
+  unsigned warm = (argc > 2) ? (unsigned)atoi(argv[2]) : BENCH_ITEMS;
+  unsigned cold = (argc > 3) ? (unsigned)atoi(argv[3]) : BENCH_COLD;
+  unsigned runs = (argc > 4) ? (unsigned)atoi(argv[4]) : 3, run, count, i;
+  int     dirFd, way, dropped = 1;
+  double  start;
+
+  if(warm == 0 || runs == 0) {
+    fprintf(stderr, "usage: %s [directory] [warm entries] "
+	    "[cold entries, 0: none] [runs]\n", argv[0]);
+    return 1;
+  }
+  if(benchDir(path, (warm > cold) ? warm : cold) != 0
+     || (dirFd = open(path, O_RDONLY | O_DIRECTORY)) < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  count = (warm > cold) ? warm : cold;
+  names = (char **)malloc(count * sizeof(char *));
+  info = (STATINFO *) malloc(count * sizeof(STATINFO));
+  if(names == NULL || info == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  count = readNames(dirFd, names, count);
+  if(count == 0) {
+    fprintf(stderr, "%s: no entries\n", path);
+    return 1;
+  }
+  if(warm > count)
+    warm = count;
+  if(cold > count)
+    cold = count;
+  if(uringOpen(&ring, URING_ENTRIES) != 0)
+    printf("no io_uring here: statMany() falls back to fstatat()\n");
+  uringClose(&ring);
+
+  for(way = 0; way < STAT_WAYS; way++) {
+    times[way].warm = -1;
+    times[way].cold = -1;
+  }
+  //The ways take turns; the cold ones drop the caches before each.
+  statWay(0, dirFd, (const char **)names, warm, info);	//Warm up
+  for(run = 0; run < runs; run++)
+    for(way = 0; way < STAT_WAYS; way++) {
+      start = benchNow();
+      times[way].stated = statWay(way, dirFd, (const char **)names, warm,
+				  info);
+      times[way].warm = benchBest(times[way].warm, benchNow() - start);
+      if(times[way].stated != times[0].stated) {
+	fprintf(stderr, "%s stat'ed %u entries, fstatat %u\n",
+		statWays[way], times[way].stated, times[0].stated);
+	return 1;
+      }
+    }
+  for(run = 0; run < runs && cold > 0 && dropped; run++)
+    for(way = 0; way < STAT_WAYS && dropped; way++) {
+      if(dropCaches() != 0) {
+	dropped = 0;
+	break;
+      }
+      start = benchNow();
+      statWay(way, dirFd, (const char **)names, cold, info);
+      times[way].cold = benchBest(times[way].cold, benchNow() - start);
+    }
+  close(dirFd);
+
+  printf("%s, best of %u runs, ms\n", path, runs);
+  printf("%-18s %12s %12s\n", "way", "warm", "cold");
+  printf("%-18s %12u %12u\n", "entries", warm, dropped ? cold : 0);
+  for(way = 0; way < STAT_WAYS; way++) {
+    printf("%-18s %12.1f", statWays[way], times[way].warm);
+    if(dropped && cold > 0)
+      printf(" %12.1f\n", times[way].cold);
+    else
+      printf(" %12s\n", "-");
+  }
+  if(!dropped)
+    printf("cold: cannot drop the caches (needs root)\n");
+  for(i = 0; i < count; i++)
+    free(names[i]);
+  free(names);
+  free(info);
+  return 0;
+}
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 /*====================================================================*/
@@ -40,11 +41,21 @@
 #define K_ESCAPE 27
 #define K_UP_ARROW 'A'		// K_ESCAPE + 'A' -> UP_ARROW
 #define K_DOWN_ARROW 'B'	// K_ESCAPE + 'B' -> DOWN_ARROW
+#define TERM_BUFFER 64		//Bytes read from the keyboard at once
 
 /*====================================================================*/
 /* TYPEDEF STRUCTS DEFINITIONS */
 /*====================================================================*/
 
+typedef struct _termsession {
+  struct termios saved;		// Settings restored on exit
+  int     active;		// Terminal settings changed
+  int     open;			// getch() reads through the buffer
+  char    buffer[TERM_BUFFER];	// Keys read ahead
+  int     bufferUsed;
+  int     bufferPos;
+} TERMSESSION;
+
 typedef struct _listchoice {
   unsigned index;		// Item number
   char   *item;			// Item string
@@ -52,6 +63,16 @@ typedef struct _listchoice {
   struct _listchoice *back;	// Pointer to previous item
 } LISTCHOICE;
 
+typedef struct _listdata {
+  LISTCHOICE *head;		// First item of the list
+  LISTCHOICE *tail;		// Last item of the list
+  unsigned length;		// No. of items in the list
+  unsigned generation;		// Bumped on every add/remove
+  LISTCHOICE **table;		// Item number -> item (random access)
+  unsigned tableSize;		// Slots allocated in table
+  unsigned tableGeneration;	// Generation table was built for
+} LISTDATA;
+
 typedef struct _scrolldata {
   unsigned scrollActive;	//To know whether scroll is active or not.
   unsigned scrollLimit;		//Last index for scroll.
@@ -69,6 +90,7 @@ typedef struct _scrolldata {
   char   *item;
   unsigned itemIndex;
   LISTCHOICE *head;		//store head of the list
+  LISTDATA *list;		//List being displayed
 } SCROLLDATA;
 
 /*====================================================================*/
@@ -76,7 +98,8 @@ typedef struct _scrolldata {
 /*====================================================================*/
 
 static struct termios old, new;
-LISTCHOICE *listBox1 = NULL;	//Head pointer.
+TERMSESSION term1;		//Keyboard session.
+LISTDATA listBox1 = { NULL, NULL, 0, 0, NULL, 0, 0 };	//Head/tail pointers.
 
 /*====================================================================*/
 /* PROTOTYPES OF FUNCTIONS                                            */
@@ -88,15 +111,24 @@ void    outputcolor(int foreground, int background);
 void    initTermios(int echo);
 void    resetTermios(void);
 char    getch();
+int     openTerm(void);
+void    closeTerm(void);
+void    restoreTerm(void);
+void    termSignal(int sig);
 
 //DYNAMIC LINKED LIST FUNCTIONS
-void    deleteList(LISTCHOICE ** head);
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp);
+void    initList(LISTDATA * list);
+void    deleteList(LISTDATA * list);
+void    addend(LISTDATA * list, LISTCHOICE * newp);
+void    addfront(LISTDATA * list, LISTCHOICE * newp);
+void    addlist(LISTDATA * list, LISTDATA * items);
+void    delelement(LISTDATA * list, LISTCHOICE * oldp);
+LISTCHOICE *itemAt(LISTDATA * list, unsigned indexAt);
 LISTCHOICE *newelement(char *text);
 
 //LISTBOX FUNCTIONS
-void    addItems(LISTCHOICE ** listBox1);
-char    listBox(LISTCHOICE * selector, unsigned whereX, unsigned whereY,
+void    addItems(LISTDATA * listBox1);
+char    listBox(LISTDATA * list, unsigned whereX, unsigned whereY,
 		SCROLLDATA * scrollData, unsigned bColor0,
 		unsigned fColor0, unsigned bColor1, unsigned fColor1,
 		unsigned displayLimit);
@@ -105,7 +137,7 @@ void    loadlist(LISTCHOICE * head, SCROLLDATA * scrollData,
 
 void    gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
 		  unsigned indexAt);
-int     query_length(LISTCHOICE ** head);
+unsigned query_length(LISTDATA * list);
 int     move_selector(LISTCHOICE ** head, SCROLLDATA * scrollData);
 char    selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData);
 void    displayItem(LISTCHOICE * aux, SCROLLDATA * scrollData, int select);
@@ -147,10 +179,74 @@ void resetTermios(void) {
 /* Read 1 character - no echo */
 char getch() {
   char    ch;
-  initTermios(0);
-  ch = getchar();
-  resetTermios();
-  return ch;
+  fflush(stdout);		//Show what was drawn before waiting
+  if(!term1.open) {
+    initTermios(0);
+    ch = getchar();
+    resetTermios();
+    return ch;
+  }
+  if(term1.bufferPos == term1.bufferUsed) {
+    //Buffer empty: one read() for whatever keys are waiting.
+    term1.bufferPos = 0;
+    term1.bufferUsed = read(STDIN_FILENO, term1.buffer, TERM_BUFFER);
+    if(term1.bufferUsed <= 0) {
+      term1.bufferUsed = 0;
+      return EOF;
+    }
+  }
+  return term1.buffer[term1.bufferPos++];
+}
+
+/* ------------------------------ */
+/* Terminal session routines      */
+/* ------------------------------ */
+/* The terminal is switched to non-canonical, no-echo mode once by     */
+/* openTerm() and restored by closeTerm(), at exit or on a fatal signal. */
+/* getch() then only costs a read() when its buffer is empty.          */
+
+void restoreTerm(void) {
+//Put the terminal settings back if the session changed them.
+  if(term1.active) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &term1.saved);
+    term1.active = 0;
+  }
+}
+
+void termSignal(int sig) {
+//Fatal signal: restore the terminal, then die the default way.
+  restoreTerm();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+int openTerm(void) {
+  struct termios raw;
+  term1.bufferUsed = 0;
+  term1.bufferPos = 0;
+  term1.open = 1;
+  if(tcgetattr(STDIN_FILENO, &term1.saved) != 0)
+    return -1;			//Not a terminal: reads still go through the buffer.
+  raw = term1.saved;
+  raw.c_lflag &= ~(ICANON | ECHO);	/* disable buffered i/o and echo */
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if(tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+    return -1;
+  term1.active = 1;
+  atexit(restoreTerm);
+  signal(SIGINT, termSignal);
+  signal(SIGTERM, termSignal);
+  signal(SIGHUP, termSignal);
+  signal(SIGQUIT, termSignal);
+  signal(SIGSEGV, termSignal);
+  signal(SIGABRT, termSignal);
+  return 0;
+}
+
+void closeTerm(void) {
+  restoreTerm();
+  term1.open = 0;
 }
 
 /* --------------------- */
@@ -168,35 +264,139 @@ LISTCHOICE *newelement(char *text) {
   return newp;
 }
 
-// deleleteList: remove list from memory
-void deleteList(LISTCHOICE ** head) {
-  LISTCHOICE *aux=*head;
+// initList: set up an empty list
+void initList(LISTDATA * list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation = 0;
+  list->table = NULL;
+  list->tableSize = 0;
+  list->tableGeneration = 0;
+}
+
+// deleteList: remove list from memory, leaving it empty
+void deleteList(LISTDATA * list) {
+  LISTCHOICE *aux = list->head;
   LISTCHOICE *next = NULL;
   while(aux != NULL) {
     next = aux->next;
-    //aux = aux->next;
     free(aux->item);
     free(aux);			//remove item
-    aux=next;
+    aux = next;
   }
-  *head = NULL;
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation++;
+  free(list->table);
+  list->table = NULL;
+  list->tableSize = 0;
 }
 
 /* addend: add new LISTCHOICE to the end of a list  */
-/* usage example: listBox1 = (addend(listBox1, newelement("Item")); */
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp) {
-  LISTCHOICE *p2;
-  if(head == NULL) {
+/* usage example: addend(&listBox1, newelement("Item")); */
+/* The tail is kept in LISTDATA so no walk is needed. O(1) */
+void addend(LISTDATA * list, LISTCHOICE * newp) {
+  newp->next = NULL;
+  newp->back = list->tail;
+  if(list->tail == NULL) {
     newp->index = 0;
-    newp->back = NULL;
-    return newp;
+    list->head = newp;
+  } else {
+    list->tail->next = newp;
+    newp->index = list->tail->index + 1;
   }
-// now find the end of list
-  for(p2 = head; p2->next != NULL; p2 = p2->next) ;
-  p2->next = newp;
-  newp->back = p2;
-  newp->index = newp->back->index + 1;
-  return head;
+  list->tail = newp;
+  list->length++;
+  list->generation++;
+}
+
+/* addfront: add new LISTCHOICE to the beginning of a list */
+/* Item numbers of the items behind it are shifted by one. O(n) */
+void addfront(LISTDATA * list, LISTCHOICE * newp) {
+  LISTCHOICE *aux;
+  newp->back = NULL;
+  newp->next = list->head;
+  newp->index = 0;
+  if(list->head == NULL)
+    list->tail = newp;
+  else
+    list->head->back = newp;
+  list->head = newp;
+  list->length++;
+  list->generation++;
+  for(aux = newp->next; aux != NULL; aux = aux->next)
+    aux->index = aux->back->index + 1;
+}
+
+/* addlist: move all the items of a second list to the end of a list */
+/* Only the moved items are renumbered. "items" is left empty. O(k) */
+void addlist(LISTDATA * list, LISTDATA * items) {
+  LISTCHOICE *aux;
+  unsigned index;
+  if(items->head == NULL)
+    return;
+  index = (list->tail == NULL) ? 0 : list->tail->index + 1;
+  for(aux = items->head; aux != NULL; aux = aux->next)
+    aux->index = index++;
+  items->head->back = list->tail;
+  if(list->tail == NULL)
+    list->head = items->head;
+  else
+    list->tail->next = items->head;
+  list->tail = items->tail;
+  list->length = list->length + items->length;
+  list->generation++;
+  items->head = NULL;
+  items->tail = NULL;
+  items->length = 0;
+  items->generation++;
+}
+
+/* delelement: unlink an item from a list and free it */
+/* Item numbers of the items behind it are shifted back by one. O(n) */
+void delelement(LISTDATA * list, LISTCHOICE * oldp) {
+  LISTCHOICE *aux;
+  if(oldp->back == NULL)
+    list->head = oldp->next;
+  else
+    oldp->back->next = oldp->next;
+  if(oldp->next == NULL)
+    list->tail = oldp->back;
+  else
+    oldp->next->back = oldp->back;
+  for(aux = oldp->next; aux != NULL; aux = aux->next)
+    aux->index--;
+  list->length--;
+  list->generation++;
+  free(oldp->item);
+  free(oldp);
+}
+
+/* itemAt: return the item with a given item number */
+/* The table is rebuilt in one pass whenever the list has changed */
+/* since the last lookup; afterwards every lookup is O(1). */
+LISTCHOICE *itemAt(LISTDATA * list, unsigned indexAt) {
+  LISTCHOICE *aux;
+  LISTCHOICE **table;
+  unsigned counter = 0;
+  if(indexAt >= list->length)
+    return NULL;
+  if(list->table == NULL || list->tableGeneration != list->generation) {
+    if(list->tableSize < list->length) {
+      table = (LISTCHOICE **) realloc(list->table,
+				     list->length * sizeof(LISTCHOICE *));
+      if(table == NULL)
+	return NULL;
+      list->table = table;
+      list->tableSize = list->length;
+    }
+    for(aux = list->head; aux != NULL; aux = aux->next)
+      list->table[counter++] = aux;
+    list->tableGeneration = list->generation;
+  }
+  return list->table[indexAt];
 }
 
 /* ---------------- */
@@ -208,18 +408,8 @@ void gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
 //Go to a specific location on the list.
 {
   LISTCHOICE *aux2;
-  unsigned counter = 0;
-  //*aux = listBox1;
-  aux2 = *aux;
-  //Make sure we are at the beginning//rewind position
-  while (aux2->index != 0){
-     if (aux2 == NULL) break;
-     aux2 = aux2->back;
-  }
-  while(counter != indexAt) {
-    aux2 = aux2->next;
-    counter++;
-  }
+  //Random access through the list's item table.
+  aux2 = itemAt(scrollData->list, indexAt);
   //Highlight current item
 
   displayItem(aux2, scrollData, SELECT_ITEM);
@@ -251,20 +441,9 @@ in scrollData.
   scrollData->selector = wherey;	//restore value
 }
 
-int query_length(LISTCHOICE ** head) {
-//Return no. items in a list.
-  {
-    LISTCHOICE *aux;
-
-    unsigned itemCount = 0;
-    aux = *head;
-    while(aux->next != NULL) {
-      aux = aux->next;
-      itemCount++;
-    }
-    return itemCount;
-  }
-
+unsigned query_length(LISTDATA * list) {
+//Return no. items in a list. Kept up to date by the list routines.
+  return list->length;
 }
 
 void displayItem(LISTCHOICE * aux, SCROLLDATA * scrollData, int select)
@@ -483,7 +662,7 @@ char selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData) {
   return ch;
 }
 
-char listBox(LISTCHOICE * head,
+char listBox(LISTDATA * list,
 	     unsigned whereX, unsigned whereY,
 	     SCROLLDATA * scrollData, unsigned bColor0,
 	     unsigned fColor0, unsigned bColor1, unsigned fColor1,
@@ -497,7 +676,7 @@ char listBox(LISTCHOICE * head,
   LISTCHOICE *aux = NULL;
 
   // Query size of the list
-  list_length = query_length(&head) + 1;
+  list_length = query_length(list);
 
   //Save calculations for SCROLL and store DATA
   scrollData->displayLimit = displayLimit;
@@ -508,6 +687,7 @@ char listBox(LISTCHOICE * head,
 
   scrollData->scrollLimit = scrollLimit;
   scrollData->listLength = list_length;
+  scrollData->list = list;
   scrollData->wherex = whereX;
   scrollData->wherey = whereY;
   scrollData->selector = whereY;
@@ -524,7 +704,7 @@ char listBox(LISTCHOICE * head,
     //Scroll is possible  
 
     scrollData->scrollActive = SCROLL_ACTIVE;
-    aux = head;
+    aux = list->head;
 
     currentListIndex = 0;	//We listBox1 the scroll at the top index.
     scrollData->currentListIndex = currentListIndex;
@@ -546,24 +726,24 @@ char listBox(LISTCHOICE * head,
     scrollData->scrollActive = SCROLL_INACTIVE;
     scrollData->currentListIndex = 0;
     scrollData->displayLimit = list_length;	//Default to list_length
-    loadlist(head, scrollData, 0);
-    ch = selectorMenu(head, scrollData);
+    loadlist(list->head, scrollData, 0);
+    ch = selectorMenu(list->head, scrollData);
   }
   return ch;
 }
 
-void addItems(LISTCHOICE ** listBox1) {
+void addItems(LISTDATA * listBox1) {
 //Load items into the list.  
-  if(*listBox1 != NULL)
+  if(listBox1->head != NULL)
     deleteList(listBox1);
-  *listBox1 = addend(*listBox1, newelement("Option 1"));
-  *listBox1 = addend(*listBox1, newelement("Option 2"));
-  *listBox1 = addend(*listBox1, newelement("Option 3"));
-  *listBox1 = addend(*listBox1, newelement("Option 4"));
-  *listBox1 = addend(*listBox1, newelement("Option 5"));
-  *listBox1 = addend(*listBox1, newelement("Option 6"));
-  *listBox1 = addend(*listBox1, newelement("Option 7"));
-  *listBox1 = addend(*listBox1, newelement("Option 8"));
+  addend(listBox1, newelement("Option 1"));
+  addend(listBox1, newelement("Option 2"));
+  addend(listBox1, newelement("Option 3"));
+  addend(listBox1, newelement("Option 4"));
+  addend(listBox1, newelement("Option 5"));
+  addend(listBox1, newelement("Option 6"));
+  addend(listBox1, newelement("Option 7"));
+  addend(listBox1, newelement("Option 8"));
 }
 
 /* ---------------- */
@@ -577,7 +757,7 @@ void addItems(LISTCHOICE ** listBox1) {
   
   Usage:
    
-  listBox(headpointer, whereX, whereY, scrollData, backColor0, foreColor0,
+  listBox(list, whereX, whereY, scrollData, backColor0, foreColor0,
 backcolor1, forecolor1, displayLimit); */
 
 /*========================================================================*/
@@ -587,9 +767,10 @@ int main() {
   char    ch;
 
   system("clear");
+  openTerm();
   addItems(&listBox1);
 
-  ch = listBox(listBox1, 10, 8, &scrollData, B_BLACK, F_WHITE, B_BLUE,
+  ch = listBox(&listBox1, 10, 8, &scrollData, B_BLACK, F_WHITE, B_BLUE,
 	       FH_WHITE, 3);
 
   //Item selected.
@@ -602,5 +783,6 @@ int main() {
   deleteList(&listBox1);
   outputcolor(F_WHITE, B_BLACK);
   printf("\n");
+  closeTerm();
   return 0;
 }
@@ -50,6 +50,13 @@ typedef struct _listchoice {
   struct _listchoice *back;	// Pointer to previous item
 } LISTCHOICE;
 
+typedef struct _listdata {
+  LISTCHOICE *head;		// First item of the list
+  LISTCHOICE *tail;		// Last item of the list
+  unsigned length;		// No. of items in the list
+  unsigned generation;		// Bumped on every add/remove
+} LISTDATA;
+
 typedef struct _scrolldata {
   unsigned scrollActive;	//To know whether scroll is active or not.
   unsigned scrollLimit;		//Last index for scroll.
@@ -74,7 +81,7 @@ typedef struct _scrolldata {
 /*====================================================================*/
 
 
-LISTCHOICE *listBox1 = NULL;	//Head pointer.
+LISTDATA listBox1 = { NULL, NULL, 0, 0 };	//Head/tail pointers.
 
 /*====================================================================*/
 /* PROTOTYPES OF FUNCTIONS                                            */
@@ -86,13 +93,16 @@ void    outputcolor(int foreground, int background);
 TCHAR    getch();
 
 //DYNAMIC LINKED LIST FUNCTIONS
-void    deleteList(LISTCHOICE ** head);
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp);
+void    initList(LISTDATA * list);
+void    deleteList(LISTDATA * list);
+void    addend(LISTDATA * list, LISTCHOICE * newp);
+void    addfront(LISTDATA * list, LISTCHOICE * newp);
+void    addlist(LISTDATA * list, LISTDATA * items);
 LISTCHOICE *newelement(char *text);
 
 //LISTBOX FUNCTIONS
-void    addItems(LISTCHOICE ** listBox1);
-char    listBox(LISTCHOICE * selector, unsigned whereX, unsigned whereY,
+void    addItems(LISTDATA * listBox1);
+char    listBox(LISTDATA * list, unsigned whereX, unsigned whereY,
 		SCROLLDATA * scrollData, unsigned bColor0,
 		unsigned fColor0, unsigned bColor1, unsigned fColor1,
 		unsigned displayLimit);
@@ -101,7 +111,7 @@ void    loadlist(LISTCHOICE * head, SCROLLDATA * scrollData,
 
 void    gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
 		  unsigned indexAt);
-int     query_length(LISTCHOICE ** head);
+unsigned query_length(LISTDATA * list);
 int     move_selector(LISTCHOICE ** head, SCROLLDATA * scrollData);
 char    selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData);
 void    displayItem(LISTCHOICE * aux, SCROLLDATA * scrollData, int select);
@@ -173,34 +183,88 @@ LISTCHOICE *newelement(char *text) {
   return newp;
 }
 
-// deleleteList: remove list from memory
-void deleteList(LISTCHOICE ** head) {
-  LISTCHOICE *p, *aux;
-  aux = *head;
-  while(aux->next != NULL) {
-    p = aux;
-    aux = aux->next;
-    free(p->item);
-    free(p);			//remove item
+// initList: set up an empty list
+void initList(LISTDATA * list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation = 0;
+}
+
+// deleteList: remove list from memory, leaving it empty
+void deleteList(LISTDATA * list) {
+  LISTCHOICE *aux = list->head;
+  LISTCHOICE *next = NULL;
+  while(aux != NULL) {
+    next = aux->next;
+    free(aux->item);
+    free(aux);			//remove item
+    aux = next;
   }
-  *head = NULL;
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation++;
 }
 
 /* addend: add new LISTCHOICE to the end of a list  */
-/* usage example: listBox1 = (addend(listBox1, newelement("Item")); */
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp) {
-  LISTCHOICE *p2;
-  if(head == NULL) {
+/* usage example: addend(&listBox1, newelement("Item")); */
+/* The tail is kept in LISTDATA so no walk is needed. O(1) */
+void addend(LISTDATA * list, LISTCHOICE * newp) {
+  newp->next = NULL;
+  newp->back = list->tail;
+  if(list->tail == NULL) {
     newp->index = 0;
-    newp->back = NULL;
-    return newp;
+    list->head = newp;
+  } else {
+    list->tail->next = newp;
+    newp->index = list->tail->index + 1;
   }
-// now find the end of list
-  for(p2 = head; p2->next != NULL; p2 = p2->next) ;
-  p2->next = newp;
-  newp->back = p2;
-  newp->index = newp->back->index + 1;
-  return head;
+  list->tail = newp;
+  list->length++;
+  list->generation++;
+}
+
+/* addfront: add new LISTCHOICE to the beginning of a list */
+/* Item numbers of the items behind it are shifted by one. O(n) */
+void addfront(LISTDATA * list, LISTCHOICE * newp) {
+  LISTCHOICE *aux;
+  newp->back = NULL;
+  newp->next = list->head;
+  newp->index = 0;
+  if(list->head == NULL)
+    list->tail = newp;
+  else
+    list->head->back = newp;
+  list->head = newp;
+  list->length++;
+  list->generation++;
+  for(aux = newp->next; aux != NULL; aux = aux->next)
+    aux->index = aux->back->index + 1;
+}
+
+/* addlist: move all the items of a second list to the end of a list */
+/* Only the moved items are renumbered. "items" is left empty. O(k) */
+void addlist(LISTDATA * list, LISTDATA * items) {
+  LISTCHOICE *aux;
+  unsigned index;
+  if(items->head == NULL)
+    return;
+  index = (list->tail == NULL) ? 0 : list->tail->index + 1;
+  for(aux = items->head; aux != NULL; aux = aux->next)
+    aux->index = index++;
+  items->head->back = list->tail;
+  if(list->tail == NULL)
+    list->head = items->head;
+  else
+    list->tail->next = items->head;
+  list->tail = items->tail;
+  list->length = list->length + items->length;
+  list->generation++;
+  items->generation++;
+  items->head = NULL;
+  items->tail = NULL;
+  items->length = 0;
 }
 
 /* ---------------- */
@@ -213,7 +277,7 @@ void gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
 {
   LISTCHOICE *aux2;
   unsigned counter = 0;
-  *aux = listBox1;
+  *aux = listBox1.head;
   aux2 = *aux;
   while(counter != indexAt) {
     aux2 = aux2->next;
@@ -250,20 +314,9 @@ in scrollData.
   } while(counter != scrollData->displayLimit);
 }
 
-int query_length(LISTCHOICE ** head) {
-//Return no. items in a list.
-  {
-    LISTCHOICE *aux;
-
-    unsigned itemCount = 0;
-    aux = *head;
-    while(aux->next != NULL) {
-      aux = aux->next;
-      itemCount++;
-    }
-    return itemCount;
-  }
-
+unsigned query_length(LISTDATA * list) {
+//Return no. items in a list. Kept up to date by the list routines.
+  return list->length;
 }
 
 void displayItem(LISTCHOICE * aux, SCROLLDATA * scrollData, int select)
@@ -456,7 +509,7 @@ char selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData) {
   return ch;
 }
 
-char listBox(LISTCHOICE * head,
+char listBox(LISTDATA * list,
 	     unsigned whereX, unsigned whereY, SCROLLDATA * scrollData,
 	     unsigned bColor0, unsigned fColor0, unsigned bColor1,
 	     unsigned fColor1, unsigned displayLimit) {
@@ -469,7 +522,7 @@ char listBox(LISTCHOICE * head,
   LISTCHOICE *aux;
 
   // Query size of the list
-  list_length = query_length(&head) + 1;
+  list_length = query_length(list);
 
   //Save calculations for SCROLL and store DATA
   scrollData->displayLimit = displayLimit;
@@ -496,7 +549,7 @@ char listBox(LISTCHOICE * head,
     //Scroll is possible
 
     scrollData->scrollActive = SCROLL_ACTIVE;
-    aux = head;
+    aux = list->head;
 
     currentListIndex = 0;	//We listBox1 the scroll at the top index.
     scrollData->currentListIndex = currentListIndex;
@@ -518,24 +571,24 @@ char listBox(LISTCHOICE * head,
     scrollData->scrollActive = SCROLL_INACTIVE;
     scrollData->currentListIndex = 0;
     scrollData->displayLimit = list_length;	//Default to list_length
-    loadlist(head, scrollData, 0);
-    ch = selectorMenu(head, scrollData);
+    loadlist(list->head, scrollData, 0);
+    ch = selectorMenu(list->head, scrollData);
   }
   return ch;
 }
 
-void addItems(LISTCHOICE ** listBox1) {
+void addItems(LISTDATA * listBox1) {
 //Load items into the list.
-  if(*listBox1 != NULL)
+  if(listBox1->head != NULL)
     deleteList(listBox1);
-  *listBox1 = addend(*listBox1, newelement("Option 1"));
-  *listBox1 = addend(*listBox1, newelement("Option 2"));
-  *listBox1 = addend(*listBox1, newelement("Option 3"));
-  *listBox1 = addend(*listBox1, newelement("Option 4"));
-  *listBox1 = addend(*listBox1, newelement("Option 5"));
-  *listBox1 = addend(*listBox1, newelement("Option 6"));
-  *listBox1 = addend(*listBox1, newelement("Option 7"));
-  *listBox1 = addend(*listBox1, newelement("Option 8"));
+  addend(listBox1, newelement("Option 1"));
+  addend(listBox1, newelement("Option 2"));
+  addend(listBox1, newelement("Option 3"));
+  addend(listBox1, newelement("Option 4"));
+  addend(listBox1, newelement("Option 5"));
+  addend(listBox1, newelement("Option 6"));
+  addend(listBox1, newelement("Option 7"));
+  addend(listBox1, newelement("Option 8"));
 }
 
 int main() {
@@ -554,12 +607,12 @@ int main() {
      ____________________
 
      Usage:
-     listBox(headpointer, whereX, whereY, scrollData, backColor0, foreColor0,
+     listBox(list, whereX, whereY, scrollData, backColor0, foreColor0,
      backcolor1, forecolor1, displayLimit);
    */
    /*=======================================================================*/
 
-  ch = listBox(listBox1, 10, 8, &scrollData, B_BLACK, F_WHITE, B_BLUE,
+  ch = listBox(&listBox1, 10, 8, &scrollData, B_BLACK, F_WHITE, B_BLUE,
 	       FH_WHITE, 3);
 
   //Item selected.
@@ -9,13 +9,49 @@
 /*====================================================================*/
 /* COMPILER DIRECTIVES AND INCLUDES */
 /*====================================================================*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		//statx()
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <termios.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <sched.h>
+#include <locale.h>
+#include <pwd.h>
+#include <time.h>
+#include <errno.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#endif
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2 1		//Compiled in, used if the CPU has it
+#else
+#define HAVE_AVX2 0
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
 /*====================================================================*/
 /* CONSTANTS */
 /*====================================================================*/
@@ -23,6 +59,10 @@
 #define SCROLL_ACTIVE 1
 #define SCROLL_INACTIVE 0
 #define CONTINUE_SCROLL -1
+#define FILTER_CHANGED -2	//Typed text changed the items on view
+#define FILTER_GROWN -3		//More results were added to the view
+#define HISTORY_BACK -4		//Left: previous directory visited
+#define HISTORY_FORWARD -5	//Right: next one, after going back
 #define DOWN_SCROLL 1
 #define UP_SCROLL 0
 #define SELECT_ITEM 1
@@ -38,32 +78,589 @@
 #define F_WHITE 37
 #define F_BLUE 34
 #define FH_WHITE 97
+//Text attributes (bits), combined with the colors in one SGR sequence.
+#define ATTR_NONE 0
+#define ATTR_BOLD 1
+#define ATTR_UNDERLINE 2
 #define FILL_CHAR ' '
+//Frame buffer
+#define SCREEN_COLS 80		//Used when the terminal size is unknown
+#define SCREEN_ROWS 25
+#define SCREEN_OUT_SIZE 16384	//First allocation of the frame bytes
+#define SCREEN_TEXT_SIZE 2048	//Longest outputf() text
+#define SCREEN_GAP 3		//Unchanged cells resent instead of moving
+//Scroll the list rows with a terminal scroll region (DECSTBM + SU/SD).
+//Set to 0 for terminals without it: every step is then repainted.
+#ifndef USE_SCROLL_REGION
+#define USE_SCROLL_REGION 1
+#endif
 //Keys used.
 #define K_ENTER 10
 #define K_ESCAPE 27
+#define K_BACKSPACE 127
+#define K_CTRL_H 8		//Backspace on some terminals
+#define K_TAB 9			//Switches the filter mode
+#define K_SORT (KEY_F1 + 1)	//F2: next sort mode
 #define K_UP_ARROW 'A'		// K_ESCAPE + 'A' -> UP_ARROW
 #define K_DOWN_ARROW 'B'	// K_ESCAPE + 'B' -> DOWN_ARROW
+#define TERM_BUFFER 64		//Bytes read from the keyboard at once
+#define ESC_TIMEOUT 25		//ms to wait for the rest of a sequence
+#define TERM_WAKE -2		//fillTerm(): woken by wakeFd, not a key
+#define WAKE_FDS 4		//Pipes that wake readKey(): filter, scan, sort, meta
+//Decoded keys. Plain characters are returned as they are.
+#define KEY_NONE 256		//Unknown sequence, ignored
+#define KEY_PARTIAL 257		//Incomplete sequence (decoder only)
+#define KEY_ESCAPE 258		//Esc on its own
+#define KEY_UP 259
+#define KEY_DOWN 260
+#define KEY_LEFT 261
+#define KEY_RIGHT 262
+#define KEY_PGUP 263
+#define KEY_PGDN 264
+#define KEY_HOME 265
+#define KEY_END 266
+#define KEY_INSERT 267
+#define KEY_DELETE 268
+#define KEY_F1 269		//KEY_F1 + n -> F(n+1), up to F12
+#define KEY_WAKE 281		//Not a key: background results are ready
 //Directories
 #define CURRENTDIR "."
 #define CHANGEDIR ".."
 #define MAX_ITEM_LENGTH 15
 #define DIRECTORY 1
 #define FILEITEM 0
-#define MAX 1024
+#define STAT_BATCH 64		//DT_UNKNOWN entries stat'ed together
+#define DIRENT_BUFFER 262144	//Bytes of entries read by one getdents64()
+#define SCAN_FIRST 4096		//Entries in the first batch of a scan
+#define SCAN_BATCH 65536	//Entries in a batch at most
+#define SCAN_STEP 256		//Entries read between checks
+#define SCAN_INTERVAL 50	//ms before a batch goes out anyway
+#define WALK_DEPTH 32		//Levels a recursive scan goes down at most
+#define WALK_ENTRIES 10000000	//Entries a scan lists at most
+#define SEEN_MIN 1024		//First allocation of the directories read
+#define CACHE_BYTES (32u << 20)	//Memory kept for listings (default)
+#define HISTORY_DEPTH 32	//Directories kept in the history (an fd each)
+#define HISTORY_BYTES (64u << 20)	//Memory kept for their listings (default)
+#define CACHE_EVENTS 4096	//Bytes of inotify events read at once
+#define CACHE_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_ONLYDIR)	//Changes to a listing
+#define DIRID_HASH(dev, ino) ((unsigned)(((ino) ^ ((dev) << 16)) * \
+					 2654435761u))
+#define MAX_FILTER 32		//Longest type-ahead text
+#define FILTER_SUBSTRING 0	//Items containing the text
+#define FILTER_FUZZY 1		//Items with the characters in order, ranked
+#define NO_MATCH ((size_t)-1)
+#define VIEW_SAME 0		//filterPump() results
+#define VIEW_GROWN 1
+#define VIEW_CHANGED 2
+//Thread pool
+#define MAX_THREADS 16		//Workers at most
+#define POOL_TASKS 1024		//Task ring of each worker
+#define CHUNK_ITEMS 16384	//Items searched per task
+#define MAX_CHUNKS POOL_TASKS	//Tasks per filter pass at most
+//Fuzzy scores
+#define SCORE_MATCH 16		//Per character matched
+#define SCORE_WORD 8		//Character starts a word
+#define SCORE_CONSECUTIVE 4	//Character follows the previous one
+#define SCORE_GAP_START 3	//First character skipped
+#define SCORE_GAP 1		//Further characters skipped
+//Characters a word starts after
+#define WORD_BREAK(c) ((c) == ' ' || (c) == '_' || (c) == '-' || \
+		       (c) == '.' || (c) == '[' || (c) == ']')
+//Arena
+#define ARENA_SLAB_SIZE 65536	//Bytes per slab
+#define ARENA_ALIGN sizeof(void *)
+//Sort modes
+#define SORT_NONE 0		//Directory order
+#define SORT_NAME 1		//Name, byte order, case folded
+#define SORT_NATURAL 2		//Name, digits as numbers ("f9" < "f10")
+#define SORT_LOCALE 3		//Name, collated by the locale (strxfrm)
+#define SORT_SIZE 4		//Biggest first
+#define SORT_MTIME 5		//Newest first
+#define SORT_EXTENSION 6	//Extension, then name
+#define SORT_MODES 7
+#define SORT_TOP 256		//Items put in order before the merges
+#define SORT_INSERT 16		//Runs sorted by insertion
+#define SORTKEY_FOLD 1		//Keys worked out for a chunk
+#define SORTKEY_XFRM 2
+#define SORTKEY_STAT 4
+//Item store
+#define META_NONE 0		//Entry metadata: not asked for
+#define META_PENDING 1		//Asked for, not back yet
+#define META_READY 2
+#define META_FAILED 3		//Entry could not be stat'ed
+#define META_PREFETCH 32	//Rows asked for beyond those on view
+#define OWNER_LENGTH 8		//Owner name shown at most
+#define COLUMNS_WIDTH 40	//" size perms mtime owner" after the name
+#define URING_ENTRIES 256	//statx() requests sent to the kernel at once
+#define STATINFO_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_SIZE | \
+		       STATX_MTIME)	//Fields statMany() asks for
+#define STORE_MIN_ITEMS 256	//First allocation of the store arrays
+#define STORE_MIN_BLOB 8192	//First allocation of the string blob
+//List backend: 0 -> linked list (LISTCHOICE), 1 -> packed item store.
+#ifndef USE_ITEMSTORE
+#define USE_ITEMSTORE 0
+#endif
+//Filter mode when the program starts (Tab switches it).
+#ifndef FILTER_MODE
+#define FILTER_MODE FILTER_SUBSTRING
+#endif
+//Sort mode when the program starts (F2 switches it).
+#ifndef SORT_MODE
+#define SORT_MODE SORT_NONE
+#endif
+//Filter on worker threads, one per core. 0: on the UI thread.
+#ifndef USE_THREADS
+#define USE_THREADS 1
+#endif
+#if defined(STATX_BASIC_STATS)
+#define USE_STATX 1		//Only the fields shown are asked for
+#else
+#define USE_STATX 0
+#endif
+
+#ifndef USE_URING
+#if USE_STATX && defined(IORING_OFF_SQES) && defined(SYS_io_uring_setup)
+#define USE_URING 1		//Batched statx() through io_uring
+#else
+#define USE_URING 0
+#endif
+#endif
+
+#ifndef USE_GETDENTS
+#if defined(__linux__) && defined(SYS_getdents64)
+#define USE_GETDENTS 1		//Bulk directory reads
+#else
+#define USE_GETDENTS 0
+#endif
+#endif
+
+//Search the names with SSE2/AVX2 when the CPU has them. 0: scalar only.
+#ifndef USE_SIMD
+#define USE_SIMD 1
+#endif
 
 /*====================================================================*/
 /* TYPEDEF STRUCTS DEFINITIONS */
 /*====================================================================*/
+typedef struct _termsession {
+  struct termios saved;		// Settings restored on exit
+  int     active;		// Terminal settings changed
+  int     open;			// getch() reads through the buffer
+  char    buffer[TERM_BUFFER];	// Keys read ahead
+  int     bufferUsed;
+  int     bufferPos;
+  int     wakeFd[WAKE_FDS];	// Data here makes readKey() return KEY_WAKE
+} TERMSESSION;
+
+typedef struct _keyseq {
+  const char *seq;		// Escape sequence sent by the terminal
+  int     key;			// KEY_* code
+} KEYSEQ;
+
+typedef struct _entrymeta {
+  long long size;		// Bytes
+  long long mtime;		// Last modified, seconds since the epoch
+  unsigned mode;		// Type and permissions
+  unsigned epoch;		// Request it is waiting for (META_PENDING)
+  unsigned char state;		// META_NONE/PENDING/READY/FAILED
+  char    owner[OWNER_LENGTH + 1];	// User name (or uid)
+} ENTRYMETA;
+
 typedef struct _listchoice {
   unsigned index;		// Item number
   char   *item;			// Item string
   char   *path;			// Item path
   unsigned isDirectory;		// Kind of item
+  ENTRYMETA *meta;		// Columns shown with -l (NULL: none yet)
   struct _listchoice *next;	// Pointer to next item
   struct _listchoice *back;	// Pointer to previous item
 } LISTCHOICE;
 
+typedef struct _cell {
+  char    ch;			// Character displayed
+  unsigned char fore;		// Foreground color
+  unsigned char back;		// Background color
+  unsigned char attr;		// ATTR_BOLD | ATTR_UNDERLINE
+} CELL;
+
+typedef struct _screen {
+  CELL   *cells;		// Off-screen buffer, rows*cols
+  CELL   *shown;		// What the terminal displays, rows*cols
+  int    *dirtyFrom;		// First column touched per row
+  int    *dirtyTo;		// Last column touched per row (-1: none)
+  int     cols;
+  int     rows;
+  int     cursorX;		// 1-based, like gotoxy()
+  int     cursorY;
+  int     fore;			// Current colors
+  int     back;
+  int     attr;			// Current attributes
+  int     termX;		// Terminal cursor (-1: unknown)
+  int     termY;
+  int     termFore;		// Terminal colors (-1: unknown)
+  int     termBack;
+  int     termAttr;		// Terminal attributes (-1: unknown)
+  char   *out;			// Escape sequences of the frame
+  size_t  outSize;
+  size_t  outUsed;
+  unsigned long frames;		// Frames flushed
+  unsigned long cellsChanged;	// Cells sent in the last frame
+  unsigned long bytesWritten;	// Bytes sent in the last frame
+} SCREEN;
+
+typedef struct _slab {
+  struct _slab *next;		// Next slab in the arena
+  size_t  size;			// Bytes available in data
+  size_t  used;			// Bytes handed out so far
+  char    data[];		// Storage
+} SLAB;
+
+typedef struct _arena {
+  SLAB   *first;		// First slab
+  SLAB   *current;		// Slab being filled
+  size_t  slabSize;		// Default size of a new slab
+  size_t  bytesUsed;		// Bytes handed out since last reset
+  size_t  bytesWasted;		// Alignment padding + unused slab tails
+  size_t  bytesReserved;	// Bytes malloc'd for slabs
+} ARENA;
+
+typedef struct _itemstore {
+  size_t *itemOffset;		// Item number -> item string in blob
+  size_t *pathOffset;		// Item number -> path string in blob
+  unsigned char *type;		// Item number -> DIRECTORY/FILEITEM
+  char   *blob;			// Packed item and path strings
+  size_t  blobSize;		// Bytes allocated for blob
+  size_t  blobUsed;		// Bytes filled in blob
+  unsigned capacity;		// Slots allocated in the arrays
+  unsigned *metaSlot;		// Item number -> metas[n - 1] (0: none yet)
+  ENTRYMETA *metas;		// Columns of the items shown with -l
+  unsigned metaCount;		// Slots filled in metas
+  unsigned metaSize;		// Slots allocated in metas
+} ITEMSTORE;
+
+typedef struct _statbatch {
+  char    name[STAT_BATCH][NAME_MAX + 1];	// Entries to stat
+  unsigned count;
+} STATBATCH;
+
+typedef struct _linuxdirent {
+  unsigned long long d_ino;	// As returned by getdents64()
+  long long d_off;
+  unsigned short d_reclen;	// Bytes to the next entry
+  unsigned char d_type;
+  char    d_name[];
+} LINUXDIRENT;
+
+typedef struct _dirreader {
+  int     fd;			// Directory being read
+  char   *buffer;		// Entries of the last getdents64()
+  int     used;			// Bytes filled in buffer
+  int     pos;			// Next entry in buffer
+  DIR    *dir;			// readdir() when there is no buffer
+} DIRREADER;
+
+typedef struct _dirid {
+  dev_t   dev;			// Directory already read (ino 0: free)
+  ino_t   ino;
+} DIRID;
+
+struct _pool;
+
+typedef struct _scan {
+  pthread_t thread;
+  pthread_mutex_t lock;		// Guards ready, readyCount and done
+  DIRREADER reader;		// Directory being read
+  ITEMSTORE ready;		// Entries published, not merged yet
+  unsigned readyCount;		// No. of entries in ready
+  ITEMSTORE taken;		// Entries being merged (UI thread)
+  int     done;			// Whole directory published
+  int     cancelled;		// Stop reading (atomic)
+  int     running;		// Thread started and not joined
+  int     notify[2];		// Pipe: a byte when entries are ready
+  unsigned entries;		// Entries published
+  unsigned maxEntries;		// Entries published at most
+  struct _pool *pool;		// Recursive: tasks read the tree (NULL: no)
+  int     top;			// Recursive: directory at the top
+  unsigned maxDepth;		// Recursive: levels read below the top
+  unsigned pending;		// Recursive: directories to read (atomic)
+  DIRID  *seen;			// Recursive: directories read (hash set)
+  unsigned seenSize;		// Slots allocated in seen
+  unsigned seenCount;		// Slots used in seen
+} SCAN;
+
+typedef struct _walkdir {
+  SCAN   *scan;			// Scan the directory is read for
+  unsigned depth;		// Levels below the top
+  struct _walkdir *next;	// Directories left to a task
+  char    path[];		// Relative to the top ("": the top)
+} WALKDIR;
+
+typedef struct _dirnav {
+  int     fd;			// Directory listed; entries are opened from it
+  char   *path;			// Its path, only for display
+  size_t  pathLen;
+  size_t  pathSize;		// Bytes allocated for path
+} DIRNAV;
+
+typedef struct _cachedir {
+  dev_t   dev;			// Directory listed
+  ino_t   ino;
+  int     wd;			// inotify watch on it
+  ITEMSTORE items;		// The listing
+  unsigned length;		// No. of items in the listing
+  size_t  bytes;		// Memory it takes
+  struct _cachedir *prev;	// More recently used
+  struct _cachedir *next;	// Less recently used
+} CACHEDIR;
+
+typedef struct _dircache {
+  CACHEDIR *head;		// Most recently used
+  CACHEDIR *tail;		// Least recently used
+  unsigned count;		// No. of listings kept
+  size_t  bytes;		// Memory they take
+  size_t  maxBytes;		// Memory they may take (0: no cache)
+  unsigned hits;		// Listings found in the cache
+  unsigned misses;		// Listings read from disk
+  int     watchFd;		// inotify instance (-1: no cache)
+  dev_t   keyDev;		// Directory being read, saved by cacheSave()
+  ino_t   keyIno;
+  int     keyWd;
+  int     keyValid;		// Unchanged since its watch was put on
+} DIRCACHE;
+
+typedef struct _listdata {
+  LISTCHOICE *head;		// First item of the list
+  LISTCHOICE *tail;		// Last item of the list
+  unsigned length;		// No. of items in the list
+  unsigned generation;		// Bumped on every add/remove
+  LISTCHOICE **table;		// Item number -> item (random access)
+  unsigned tableSize;		// Slots allocated in table
+  unsigned tableGeneration;	// Generation table was built for
+  ARENA  *arena;		// Storage for items (NULL: malloc)
+  ITEMSTORE *store;		// Packed backend (NULL: linked list)
+} LISTDATA;
+
+typedef struct _histdir {
+  DIRNAV  nav;			// Directory visited (own fd and path)
+  dev_t   dev;
+  ino_t   ino;
+  struct timespec mtime;	// Directory as it was when listed
+  struct timespec ctime;
+  int     kept;			// list holds its listing
+  LISTDATA list;		// The listing, moved out of listBox1
+  ARENA   arena;		// Storage of list
+  ITEMSTORE store;
+  int     shown;		// SORT_* order list is in
+  size_t  bytes;		// Memory list takes
+  unsigned itemIndex;		// Item selected when we left
+  unsigned currentListIndex;	// First item on view then
+  char   *selected;		// Path of that item (NULL: none)
+} HISTDIR;
+
+typedef struct _history {
+  HISTDIR dirs[HISTORY_DEPTH];	// Oldest first
+  unsigned count;		// Directories in dirs
+  unsigned current;		// The one listed
+  size_t  bytes;		// Memory the listings kept take
+  size_t  maxBytes;		// Memory they may take (0: places only)
+} HISTORY;
+
+typedef struct _hit {
+  unsigned item;		// Item number
+  unsigned where;		// Match start (fuzzy: end) in the name
+  int     score;		// Fuzzy rank, higher first
+} HIT;
+
+typedef struct _nameblob {
+  char   *blob;			// Lower-case names, '\0' after each
+  size_t  blobSize;		// Bytes allocated for blob
+  size_t *offset;		// Item number -> name in blob
+  unsigned capacity;		// Slots allocated in offset
+  unsigned length;		// No. of names packed
+  LISTDATA *list;		// List packed
+  unsigned generation;		// Generation of the list packed
+} NAMEBLOB;
+
+struct _filterjob;
+struct _pool;
+
+typedef struct _filter {
+  char    text[MAX_FILTER + 1];	// Text typed so far (lower case)
+  unsigned length;		// No. of levels complete
+  unsigned typed;		// No. of characters typed
+  int     mode;			// FILTER_SUBSTRING or FILTER_FUZZY
+  HIT    *hits[MAX_FILTER + 1];	// Level n: items matching text[0..n)
+  unsigned count[MAX_FILTER + 1];	// No. of matches at each level
+  unsigned capacity[MAX_FILTER + 1];	// Slots allocated at each level
+  NAMEBLOB names;		// Packed names searched
+  struct _filterjob *job;	// Level being built (NULL: none)
+  struct _pool *pool;		// Workers (NULL: search inline)
+} FILTER;
+
+typedef struct _filterjob {
+  FILTER *filter;		// Filter the level is for
+  unsigned level;		// Level being built
+  unsigned from;		// Items (level 1) or hits scanned
+  unsigned chunkSize;		// Items or hits per task
+  unsigned chunks;		// No. of tasks
+  HIT   **out;			// Hits found by each task
+  unsigned *outCount;		// No. of hits found by each task
+  int    *done;			// Task finished (set by the worker)
+  unsigned finished;		// No. of tasks finished (atomic)
+  int     cancelled;		// Skip tasks not started (atomic)
+  int     failed;		// A task ran out of memory
+  unsigned merged;		// Tasks copied into the level, in order
+  unsigned hits;		// Hits copied into the level
+} FILTERJOB;
+
+typedef struct _sortkey {
+  const char *name;		// Path of the item
+  const char *fold;		// Path in lower case
+  const char *xfrm;		// strxfrm() of the path
+  long long size;		// Bytes (-1: unknown)
+  long long mtime;		// Last change, ns (-1: unknown)
+  unsigned ext;			// Extension in fold (at the '\0': none)
+  unsigned char group;		// 0: "." and "..", 1: directory, 2: file
+} SORTKEY;
+
+typedef struct _sortrank {
+  unsigned long long prefix;	// Sorts like the key's first 8 bytes
+  unsigned group;		// As in SORTKEY
+} SORTRANK;
+
+struct _sorter;
+
+typedef struct _sortjob {
+  struct _sorter *sort;		// Sorter the job is for
+  int     mode;			// Order being built
+  unsigned length;		// No. of items
+  unsigned chunks;		// No. of tasks per phase
+  unsigned width;		// Runs merged (0: phase 0, sorting chunks)
+  unsigned *ids;		// Sorted runs of item numbers
+  unsigned *tmp;		// Merge output, swapped with ids
+  SORTRANK *rank;		// Item number -> what most comparisons need
+  unsigned finished;		// No. of tasks of the phase finished (atomic)
+  int     cancelled;		// Skip tasks not started (atomic)
+  int     failed;		// A task ran out of memory
+} SORTJOB;
+
+typedef struct _statinfo {
+  long long size;		// Bytes
+  long long mtime;		// Last change, ns since the epoch
+  unsigned mode;		// Type and permissions
+  unsigned uid;			// Owner
+  int     ok;			// Entry was stat'ed
+} STATINFO;
+
+typedef struct _uring {
+  int     fd;			// io_uring instance (-1: none)
+  unsigned entries;		// Requests sent at once at most
+  unsigned *sqHead;		// Submission ring, shared with the kernel
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;		// Completion ring, shared with the kernel
+  unsigned *cqTail;
+  unsigned *cqMask;
+  void   *sqes;			// Requests
+  void   *cqes;			// Results
+  void   *sqRing;		// Mappings (cqRing == sqRing: only one)
+  size_t  sqRingSize;
+  void   *cqRing;
+  size_t  cqRingSize;
+  size_t  sqesSize;
+  void   *stx;			// struct statx of each request sent
+} URING;
+
+typedef struct _sorter {
+  int     mode;			// SORT_* order wanted
+  int     shown;		// SORT_* order the list is in
+  LISTDATA *list;		// List keyed
+  unsigned generation;		// Generation of the list in that order
+  unsigned length;		// No. of items keyed
+  unsigned *current;		// Position -> item number as first listed
+  SORTKEY *keys;		// Item number -> keys
+  unsigned chunkSize;		// Items per task
+  unsigned chunks;		// No. of chunks
+  char  **fold;			// Chunk -> lower case paths
+  char  **xfrm;			// Chunk -> strxfrm() keys
+  unsigned char *keyed;		// Chunk -> SORTKEY_* worked out
+  SORTJOB *job;			// Sort on the way (NULL: none)
+  struct _pool *pool;		// Workers (NULL: sort inline)
+  int     uring;		// Stat keys through io_uring (-u)
+  URING   rings[MAX_THREADS + 1];	// Kept for the tasks (fd -1: none yet)
+  int     ringBusy[MAX_THREADS + 1];	// Ring in use by a task
+  pthread_mutex_t ringLock;	// Guards uring, rings and ringBusy
+  int     dirFd;		// Directory the names are relative to
+  int     notify[2];		// Pipe: a byte when a phase is finished
+} SORTER;
+
+typedef struct _task {
+  void    (*run) (void *data, unsigned n);	// Work to do
+  void   *data;			// Passed to run with n
+  unsigned n;
+} TASK;
+
+typedef struct _worker {
+  pthread_t thread;
+  pthread_mutex_t lock;		// Guards the task ring
+  TASK    tasks[POOL_TASKS];	// Ring of tasks, oldest at head
+  unsigned head;
+  unsigned used;
+  struct _pool *pool;
+} WORKER;
+
+typedef struct _pool {
+  WORKER  workers[MAX_THREADS];
+  unsigned count;		// No. of workers running
+  pthread_mutex_t lock;		// Guards queued and stop
+  pthread_cond_t wake;		// Signalled when tasks are queued
+  unsigned queued;		// Tasks not claimed yet
+  int     stop;
+  int     notify[2];		// Pipe: a byte per task finished
+  unsigned next;		// Worker the next task goes to (atomic)
+} POOL;
+
+typedef struct _metareq {
+  unsigned item;		// Item number when asked for
+  size_t  name;			// Path, offset in the batch's names
+  unsigned epoch;		// Queue epoch when asked for
+  int     ok;			// Results below are valid
+  long long size;
+  long long mtime;
+  unsigned mode;
+  char    owner[OWNER_LENGTH + 1];
+} METAREQ;
+
+typedef struct _metabatch {
+  METAREQ *req;			// Requests (and results)
+  unsigned count;
+  unsigned size;		// Slots allocated in req
+  char   *names;		// Packed paths of the requests
+  size_t  used;
+  size_t  namesSize;
+} METABATCH;
+
+typedef struct _metaqueue {
+  pthread_t thread;		// Helper thread running statx()
+  pthread_mutex_t lock;		// Guards todo, done and epoch
+  pthread_cond_t wake;		// Signalled when todo gets requests
+  METABATCH todo;		// Asked for, not taken yet
+  METABATCH work;		// Being stat'ed (helper thread only)
+  METABATCH done;		// Stat'ed, not taken by the UI yet
+  METABATCH taken;		// Being filled in (UI only)
+  int     stop;			// Set to end the helper thread
+  int     running;		// Helper thread started
+  unsigned epoch;		// Bumped when requests out go stale
+  int     notify[2];		// Pipe: a byte when done gets results
+  int     dirFd;		// Directory the names are relative to (dup)
+  URING   ring;			// statx() batches (helper thread only)
+  const char **names;		// Paths of the batch being stat'ed
+  STATINFO *info;		// Its results
+  unsigned infoSize;		// Slots allocated in names and info
+} METAQUEUE;
+
 typedef struct _scrolldata {
   unsigned scrollActive;	//To know whether scroll is active or not.
   unsigned scrollLimit;		//Last index for scroll.
@@ -82,6 +679,11 @@ typedef struct _scrolldata {
   char   *item;
   char   *path;
   unsigned itemIndex;
+  LISTDATA *list;		//List being displayed
+  FILTER *filter;		//Type-ahead filter (NULL: none)
+  SCAN   *scan;			//Background scan of the list (NULL: none)
+  SORTER *sort;			//Order of the list (NULL: as listed)
+  METAQUEUE *meta;		//Metadata columns (NULL: names only)
 } SCROLLDATA;
 
 /*====================================================================*/
@@ -89,7 +691,24 @@ typedef struct _scrolldata {
 /*====================================================================*/
 
 static struct termios old, new;
-LISTCHOICE *listBox1 = NULL;	//Head pointer.
+TERMSESSION term1;		//Keyboard session.
+SCREEN  screen1;		//Frame buffer.
+LISTDATA listBox1 = { NULL, NULL, 0, 0, NULL, 0, 0, NULL, NULL };	//Head/tail pointers.
+ARENA   listArena;		//Storage for listBox1 items.
+ITEMSTORE listStore;		//Packed backend for listBox1.
+FILTER  filter1;		//Type-ahead filter of the listbox.
+POOL    pool1;			//Worker threads of the filter.
+SCAN    scan1;			//Background reader of listBox1.
+POOL    walkPool1;		//Worker threads of a recursive scan.
+DIRCACHE cache1;		//Listings of directories visited.
+SORTER  sort1;			//Order of listBox1.
+METAQUEUE meta1;		//Columns of listBox1 (-l).
+HISTORY history1;		//Directories visited, back and forward.
+const char *sortNames[SORT_MODES] = { "none", "name", "natural", "locale",
+  "size", "mtime", "ext"
+};				//-s argument of each SORT_* mode
+size_t  (*findText) (const char *blob, size_t from, size_t to,
+		     const char *pat, unsigned len) = NULL;	//Best search routine
 
 /*====================================================================*/
 /* PROTOTYPES OF FUNCTIONS                                            */
@@ -100,37 +719,260 @@ void    gotoxy(int x, int y);
 void    clear();
 void    cleanLine(int line, int backcolor, int forecolor);
 void    outputcolor(int foreground, int background);
+void    outputattr(int attr);
 void    initTermios(int echo);
 void    resetTermios(void);
 char    getch();
+int     openTerm(void);
+void    closeTerm(void);
+void    restoreTerm(void);
+void    termSignal(int sig);
 void    draw_window(int x1, int y1, int x2, int y2, int backcolor);
 
+//KEY DECODER FUNCTIONS
+int     fillTerm(int timeout);
+int     decodeKey(const char *bytes, int len, int *used);
+int     readKey(void);
+unsigned repeatKey(int key);
+
+//FRAME BUFFER FUNCTIONS
+int     initScreen(SCREEN * screen);
+void    freeScreen(SCREEN * screen);
+void    outputbytes(SCREEN * screen, const char *bytes, size_t len);
+void    outputchar(char ch);
+void    outputf(const char *format, ...);
+int     sgrSequence(char *seq, int fore, int back, int attr,
+		    int oldFore, int oldBack, int oldAttr);
+void    setStyle(SCREEN * screen, int fore, int back, int attr);
+int     samecell(CELL * a, CELL * b);
+void    moveCursor(SCREEN * screen, int x, int y);
+void    outputcell(SCREEN * screen, CELL * cell);
+void    scrollScreen(int top, int bottom, int lines);
+void    flushScreen(void);
+
+//ARENA FUNCTIONS
+void    initArena(ARENA * arena, size_t slabSize);
+void   *arenaAlloc(ARENA * arena, size_t size);
+void    arenaReset(ARENA * arena);
+void    freeArena(ARENA * arena);
+
 //DYNAMIC LINKED LIST FUNCTIONS
-void    deleteList(LISTCHOICE ** head);
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp);
+void    initList(LISTDATA * list);
+void    deleteList(LISTDATA * list);
+void    addend(LISTDATA * list, LISTCHOICE * newp);
+void    addfront(LISTDATA * list, LISTCHOICE * newp);
+void    addlist(LISTDATA * list, LISTDATA * items);
+void    delelement(LISTDATA * list, LISTCHOICE * oldp);
+LISTCHOICE *itemAt(LISTDATA * list, unsigned indexAt);
 LISTCHOICE *newelement(char *text, char *itemPath, unsigned itemType);
+LISTCHOICE *newitem(LISTDATA * list, char *text, char *itemPath,
+		    unsigned itemType);
+
+//ITEM STORE AND ACCESSOR FUNCTIONS
+void    initStore(ITEMSTORE * store);
+int     storeAppend(ITEMSTORE * store, unsigned count, char *text,
+		    char *itemPath, unsigned itemType);
+void    freeStore(ITEMSTORE * store);
+int     additem(LISTDATA * list, char *text, char *itemPath,
+		unsigned itemType);
+char   *listItem(LISTDATA * list, unsigned indexAt);
+char   *listPath(LISTDATA * list, unsigned indexAt);
+unsigned listType(LISTDATA * list, unsigned indexAt);
+int     listOrder(LISTDATA * list, const unsigned *order);
+size_t  listBytes(LISTDATA * list);
+ENTRYMETA *listMeta(LISTDATA * list, unsigned indexAt, int create);
+
+//THREAD POOL FUNCTIONS
+int     initPool(POOL * pool, unsigned threads);
+void    freePool(POOL * pool);
+int     poolSubmit(POOL * pool, void (*run) (void *, unsigned),
+		   void *data, unsigned n);
+int     popTask(WORKER * worker, TASK * task);
+void   *poolWorker(void *arg);
+
+//MATCHER FUNCTIONS
+size_t  findScalar(const char *blob, size_t from, size_t to,
+		   const char *pat, unsigned len);
+#if HAVE_SSE2
+size_t  findSSE2(const char *blob, size_t from, size_t to,
+		 const char *pat, unsigned len);
+#endif
+#if HAVE_AVX2
+size_t  findAVX2(const char *blob, size_t from, size_t to,
+		 const char *pat, unsigned len);
+#endif
+void    initMatcher(void);
+void    initNames(NAMEBLOB * names);
+void    freeNames(NAMEBLOB * names);
+int     packNames(NAMEBLOB * names, LISTDATA * list);
+int     fuzzyScore(const char *name, const char *text, unsigned len,
+		   unsigned end);
+int     rankHits(HIT * hits, unsigned count);
+
+//FILTER FUNCTIONS
+void    initFilter(FILTER * filter);
+void    clearFilter(FILTER * filter);
+void    freeFilter(FILTER * filter);
+unsigned matchRange(FILTER * filter, unsigned level, unsigned a,
+		   unsigned b, HIT * out);
+void    filterChunk(FILTERJOB * job, unsigned chunk);
+void    filterTask(void *data, unsigned chunk);
+void    freeJob(FILTERJOB * job);
+void    filterCancel(FILTER * filter);
+int     filterStart(FILTER * filter, LISTDATA * list);
+int     filterFinish(FILTER * filter);
+int     filterPump(FILTER * filter);
+int     filterWait(FILTER * filter);
+int     filterAdd(FILTER * filter, LISTDATA * list, char ch);
+void    filterBack(FILTER * filter);
+int     filterMode(FILTER * filter, LISTDATA * list);
+int     filterRestart(FILTER * filter, LISTDATA * list);
+unsigned viewLength(SCROLLDATA * scrollData);
+unsigned viewItem(SCROLLDATA * scrollData, unsigned aux);
+unsigned viewFind(SCROLLDATA * scrollData, unsigned item);
+
+//BATCHED STAT FUNCTIONS
+int     uringOpen(URING * ring, unsigned entries);
+void    uringClose(URING * ring);
+#if USE_STATX
+void    statxInfo(STATINFO * info, const struct statx *stx);
+#endif
+int     statOne(int dirFd, const char *name, STATINFO * info);
+unsigned statMany(URING * ring, int dirFd, const char **names,
+		  unsigned count, STATINFO * info);
+
+//SORT FUNCTIONS
+void    initSorter(SORTER * sort);
+void    freeKeys(SORTER * sort);
+void    freeSorter(SORTER * sort);
+int     sortTake(SORTER * sort, LISTDATA * list);
+URING  *sortRing(SORTER * sort);
+void    sortRingDone(SORTER * sort, URING * ring);
+int     sortKeyChunk(SORTER * sort, unsigned chunk, int mode);
+int     naturalCompare(const char *a, const char *b);
+unsigned long long sortPrefix(const char *text, const char *then,
+			      int natural);
+void    sortRank(SORTJOB * job, unsigned from, unsigned to);
+int     sortCompare(SORTJOB * job, unsigned a, unsigned b);
+void    mergeIds(SORTJOB * job, const unsigned *a, unsigned lenA,
+		 const unsigned *b, unsigned lenB, unsigned *out);
+void    sortRun(SORTJOB * job, unsigned *ids, unsigned *tmp, unsigned n);
+unsigned sortSplit(SORTJOB * job, const unsigned *a, unsigned lenA,
+		   const unsigned *b, unsigned lenB, unsigned k);
+void    sortChunk(SORTJOB * job, unsigned chunk);
+void    sortTask(void *data, unsigned chunk);
+void    freeSortJob(SORTJOB * job);
+void    sortCancel(SORTER * sort);
+void    sortPhase(SORTER * sort);
+int     sortNext(SORTJOB * job);
+int     sortPublish(SORTER * sort, LISTDATA * list, const unsigned *order);
+void    sortTop(SORTER * sort, LISTDATA * list);
+int     sortStale(SORTER * sort, LISTDATA * list);
+void    sortAdopt(SORTER * sort, LISTDATA * list, int shown);
+int     sortStart(SORTER * sort, LISTDATA * list);
+int     sortPump(SORTER * sort, LISTDATA * list);
+int     sortModeOf(const char *name);
+
+//METADATA FUNCTIONS
+void    initBatch(METABATCH * batch);
+void    freeBatch(METABATCH * batch);
+METAREQ *metaAdd(METABATCH * batch, unsigned item, const char *name,
+		 unsigned epoch);
+void    metaStat(METAREQ * req, STATINFO * info, unsigned *lastUid,
+		 char lastOwner[OWNER_LENGTH + 1]);
+void   *metaThread(void *arg);
+void    initMeta(METAQUEUE * queue, int threaded, int uring);
+void    freeMeta(METAQUEUE * queue);
+void    metaClear(METAQUEUE * queue);
+void    metaDir(METAQUEUE * queue, int dirFd);
+void    metaSet(ENTRYMETA * meta, METAREQ * req);
+void    metaFetch(METAQUEUE * queue, SCROLLDATA * scrollData,
+		  unsigned first);
+unsigned metaPump(METAQUEUE * queue, LISTDATA * list);
+void    formatMeta(char out[COLUMNS_WIDTH + 1], ENTRYMETA * meta);
 
 //LISTBOX FUNCTIONS
-char    listBox(LISTCHOICE * selector, unsigned whereX, unsigned whereY,
+char    listBox(LISTDATA * list, unsigned whereX, unsigned whereY,
 		SCROLLDATA * scrollData, unsigned bColor0,
 		unsigned fColor0, unsigned bColor1, unsigned fColor1,
 		unsigned displayLimit);
-void    loadlist(LISTCHOICE * head, SCROLLDATA * scrollData,
+void    loadlist(LISTDATA * list, SCROLLDATA * scrollData,
 		 unsigned indexAt);
 
-void    gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
+void    gotoIndex(unsigned *aux, SCROLLDATA * scrollData,
 		  unsigned indexAt);
-int     query_length(LISTCHOICE ** head);
-int     move_selector(LISTCHOICE ** head, SCROLLDATA * scrollData);
-char    selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData);
-void    displayItem(LISTCHOICE * aux, SCROLLDATA * scrollData, int select);
+unsigned query_length(LISTDATA * list);
+int     move_selector(unsigned *selector, SCROLLDATA * scrollData,
+		      int rows);
+int     jump_selector(unsigned *selector, SCROLLDATA * scrollData,
+		      unsigned target);
+void    displayMetrics(unsigned aux, SCROLLDATA * scrollData,
+		       unsigned scrollControl);
+char    selectorMenu(unsigned aux, SCROLLDATA * scrollData);
+void    displayItem(unsigned aux, SCROLLDATA * scrollData, int select);
+void    redrawRows(unsigned aux, SCROLLDATA * scrollData);
+int     refilter(SCROLLDATA * scrollData);
+int     filterKey(SCROLLDATA * scrollData, int key);
+void    displayFilter(SCROLLDATA * scrollData, unsigned row);
+void    cleanArea(SCROLLDATA * scrollData, unsigned from, unsigned to);
 
 //LISTFILES FUNCTIONS
-int     listFiles(LISTCHOICE ** listBox1, char *directory);
-int     addSpaces(char temp[MAX_ITEM_LENGTH]);
-void    cleanString(char *string, int max);
-void    changeDir(SCROLLDATA * scrollData, char fullPath[MAX],
-		  char newDir[MAX]);
+int     listFiles(LISTDATA * listBox1, int dirFd);
+int     addSpaces(char temp[MAX_ITEM_LENGTH + 1]);
+void    formatItem(char temp[MAX_ITEM_LENGTH + 1], const char *name,
+		   unsigned itemType);
+int     addEntry(LISTDATA * listBox1, LISTDATA * files, const char *name,
+		 unsigned itemType);
+int     statBatch(LISTDATA * listBox1, LISTDATA * files, int fd,
+		  STATBATCH * batch);
+void    addParents(LISTDATA * listBox1);
+unsigned readEntries(DIRREADER * reader, LISTDATA * dirs, LISTDATA * files,
+		     STATBATCH * batch, unsigned max);
+int     openReaderAt(DIRREADER * reader, int dirFd, const char *name);
+int     nextEntry(DIRREADER * reader, const char **name,
+		  unsigned char *type);
+void    closeReader(DIRREADER * reader);
+void    initScan(SCAN * scan);
+void    freeScan(SCAN * scan);
+void    scanAppend(SCAN * scan, const char *prefix, const char *name,
+		   char *item, unsigned itemType);
+void    scanPublish(SCAN * scan, LISTDATA * dirs, LISTDATA * files,
+		    const char *prefix);
+void   *scanThread(void *arg);
+int     scanStart(SCAN * scan, LISTDATA * list, int dirFd);
+int     scanPump(SCAN * scan, LISTDATA * list);
+int     scanWait(SCAN * scan, LISTDATA * list);
+void    scanCancel(SCAN * scan);
+void    scanStop(SCAN * scan);
+int     scanSeen(SCAN * scan, dev_t dev, ino_t ino);
+WALKDIR *walkNew(SCAN * scan, WALKDIR * parent, const char *name);
+void    walkDir(WALKDIR * dir, LISTDATA * dirs, LISTDATA * files,
+		WALKDIR ** stack);
+void    walkTask(void *data, unsigned n);
+int     walkStart(SCAN * scan, LISTDATA * list, int dirFd);
+int     initNav(DIRNAV * nav);
+void    freeNav(DIRNAV * nav);
+int     navEnter(DIRNAV * nav, const char *name);
+int     changeDir(SCROLLDATA * scrollData, DIRNAV * nav);
+void    initCache(DIRCACHE * cache, size_t maxBytes);
+void    freeCache(DIRCACHE * cache);
+void    cacheDrop(DIRCACHE * cache, CACHEDIR * dir);
+void    cachePoll(DIRCACHE * cache);
+int     cacheLoad(DIRCACHE * cache, LISTDATA * list, int dirFd);
+void    cacheSave(DIRCACHE * cache, LISTDATA * list, int complete);
+void    initHistory(HISTORY * history, size_t maxBytes);
+void    freeHistory(HISTORY * history);
+void    histForget(HISTORY * history, HISTDIR * dir);
+void    histDrop(HISTORY * history, unsigned n);
+void    histTrim(HISTORY * history, int keepCurrent);
+int     histVisit(HISTORY * history, DIRNAV * nav);
+int     histGo(HISTORY * history, DIRNAV * nav, int step);
+void    histLeave(HISTORY * history, SCROLLDATA * scrollData,
+		  LISTDATA * list, SORTER * sort, int complete);
+int     histLoad(HISTORY * history, LISTDATA * list, SORTER * sort,
+		 int dirFd);
+void    histPlace(HISTORY * history, SCROLLDATA * scrollData,
+		  LISTDATA * list);
 
   /*====================================================================*/
 /* CODE */
@@ -140,19 +982,67 @@ void    changeDir(SCROLLDATA * scrollData, char fullPath[MAX],
 /* Terminal manipulation routines */
 /* ------------------------------ */
 void clear() {
-  printf("\033[2J\033[1;1H");
+//Clears the screen with the current colors and homes the cursor.
+  int     i;
+  if(screen1.cells == NULL) {
+    printf("\033[2J\033[1;1H");
+    return;
+  }
+  for(i = 0; i < screen1.cols * screen1.rows; i++) {
+    screen1.cells[i].ch = FILL_CHAR;
+    screen1.cells[i].fore = (unsigned char)screen1.fore;
+    screen1.cells[i].back = (unsigned char)screen1.back;
+    screen1.cells[i].attr = (unsigned char)screen1.attr;
+  }
+  for(i = 0; i < screen1.rows; i++) {
+    screen1.dirtyFrom[i] = 0;
+    screen1.dirtyTo[i] = screen1.cols - 1;
+  }
+  gotoxy(1, 1);
 }
 
 void gotoxy(int x, int y)
 //Sets the cursor at the desired position.
 {
-  printf("%c[%d;%df", 0x1B, y, x);
+  if(screen1.cells == NULL) {
+    printf("%c[%d;%df", 0x1B, y, x);
+    return;
+  }
+  //Terminals treat 0 as 1.
+  screen1.cursorX = (x < 1) ? 1 : x;
+  screen1.cursorY = (y < 1) ? 1 : y;
 }
 
 void outputcolor(int foreground, int background)
 //Changes format foreground and background colors of display.
 {
-  printf("%c[%d;%dm", 0x1b, foreground, background);
+  char    seq[32];
+  if(screen1.cells == NULL) {
+    //No frame buffer: still skip sequences that change nothing.
+    if(sgrSequence(seq, foreground, background, screen1.attr,
+		   screen1.termFore, screen1.termBack, screen1.termAttr) > 0)
+      printf("%s", seq);
+    screen1.termFore = foreground;
+    screen1.termBack = background;
+    screen1.termAttr = screen1.attr;
+  }
+  screen1.fore = foreground;
+  screen1.back = background;
+}
+
+void outputattr(int attr)
+//Changes text attributes (ATTR_BOLD, ATTR_UNDERLINE) of display.
+{
+  char    seq[32];
+  if(screen1.cells == NULL) {
+    if(sgrSequence(seq, screen1.fore, screen1.back, attr,
+		   screen1.termFore, screen1.termBack, screen1.termAttr) > 0)
+      printf("%s", seq);
+    screen1.termFore = screen1.fore;
+    screen1.termBack = screen1.back;
+    screen1.termAttr = attr;
+  }
+  screen1.attr = attr;
 }
 
 /* Initialize new terminal i/o settings */
@@ -172,10 +1062,75 @@ void resetTermios(void) {
 /* Read 1 character - no echo */
 char getch() {
   char    ch;
-  initTermios(0);
-  ch = getchar();
-  resetTermios();
-  return ch;
+  int     count;
+  flushScreen();		//Show the frame before waiting for a key
+  if(!term1.open) {
+    initTermios(0);
+    ch = getchar();
+    resetTermios();
+    return ch;
+  }
+  //Buffer empty: one read() for whatever keys are waiting.
+  while(term1.bufferPos == term1.bufferUsed) {
+    count = fillTerm(-1);
+    if(count != TERM_WAKE && count < 0)
+      return EOF;		//Wake-ups are for readKey() only
+  }
+  return term1.buffer[term1.bufferPos++];
+}
+
+/* ------------------------------ */
+/* Terminal session routines      */
+/* ------------------------------ */
+/* The terminal is switched to non-canonical, no-echo mode once by     */
+/* openTerm() and restored by closeTerm(), at exit or on a fatal signal. */
+/* getch() then only costs a read() when its buffer is empty.          */
+
+void restoreTerm(void) {
+//Put the terminal settings back if the session changed them.
+  if(term1.active) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &term1.saved);
+    term1.active = 0;
+  }
+}
+
+void termSignal(int sig) {
+//Fatal signal: restore the terminal, then die the default way.
+  restoreTerm();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+int openTerm(void) {
+  struct termios raw;
+  int     i;
+  term1.bufferUsed = 0;
+  term1.bufferPos = 0;
+  for(i = 0; i < WAKE_FDS; i++)
+    term1.wakeFd[i] = -1;
+  term1.open = 1;
+  if(tcgetattr(STDIN_FILENO, &term1.saved) != 0)
+    return -1;			//Not a terminal: reads still go through the buffer.
+  raw = term1.saved;
+  raw.c_lflag &= ~(ICANON | ECHO);	/* disable buffered i/o and echo */
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if(tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+    return -1;
+  term1.active = 1;
+  atexit(restoreTerm);
+  signal(SIGINT, termSignal);
+  signal(SIGTERM, termSignal);
+  signal(SIGHUP, termSignal);
+  signal(SIGQUIT, termSignal);
+  signal(SIGSEGV, termSignal);
+  signal(SIGABRT, termSignal);
+  return 0;
+}
+
+void closeTerm(void) {
+  restoreTerm();
+  term1.open = 0;
 }
 
 //draw window area with shadow
@@ -190,7 +1145,7 @@ void draw_window(int x1, int y1, int x2, int y2, int backcolor) {
     for(i = x1; i <= x2; i++) {
       gotoxy(i, j);
       outputcolor(F_WHITE, backcolor);
-      printf("%c", FILL_CHAR);
+      outputchar(FILL_CHAR);
     }
 }
 
@@ -201,539 +1156,4912 @@ void cleanLine(int line, int backcolor, int forecolor) {
     //clean line where path is displayed.
     outputcolor(forecolor, backcolor);
     gotoxy(i, line);
-    printf("%c", FILL_CHAR);	//space
+    outputchar(FILL_CHAR);	//space
   }
 }
 
-/* --------------------- */
-/* Dynamic List routines */
-/* --------------------- */
+/* ------------------------------ */
+/* Frame buffer routines          */
+/* ------------------------------ */
+/* Drawing goes to an off-screen buffer of cells. flushScreen(), which */
+/* getch() calls before every read, compares it with a second buffer  */
+/* holding what the terminal shows and sends only the changed cells,  */
+/* with one write() per frame.                                        */
 
-// create new list element of type LISTCHOICE from the supplied text string
-LISTCHOICE *newelement(char *text, char *itemPath, unsigned itemType) {
-  LISTCHOICE *newp;
-  newp = (LISTCHOICE *) malloc(sizeof(LISTCHOICE));
-  newp->item = (char *)malloc(strlen(text) + 1);
-  newp->path = (char *)malloc(strlen(itemPath) + 1);
-  strcpy(newp->item, text);
-  strcpy(newp->path, itemPath);
-  newp->isDirectory = itemType;
-  newp->next = NULL;
-  newp->back = NULL;
-  return newp;
+int initScreen(SCREEN * screen) {
+  struct winsize w;
+  int     i;
+  screen->cols = SCREEN_COLS;
+  screen->rows = SCREEN_ROWS;
+  screen->fore = F_WHITE;
+  screen->back = B_BLACK;
+  screen->attr = ATTR_NONE;
+  screen->termX = -1;
+  screen->termY = -1;
+  screen->termFore = -1;
+  screen->termBack = -1;
+  screen->termAttr = -1;
+  if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0 && w.ws_col > 0
+     && w.ws_row > 0) {
+    screen->cols = w.ws_col;
+    screen->rows = w.ws_row;
+  }
+  screen->cells =
+      (CELL *) malloc(screen->cols * screen->rows * sizeof(CELL));
+  screen->shown =
+      (CELL *) malloc(screen->cols * screen->rows * sizeof(CELL));
+  screen->dirtyFrom = (int *)malloc(screen->rows * sizeof(int));
+  screen->dirtyTo = (int *)malloc(screen->rows * sizeof(int));
+  screen->outSize = SCREEN_OUT_SIZE;
+  screen->outUsed = 0;
+  screen->out = (char *)malloc(screen->outSize);
+  if(screen->cells == NULL || screen->shown == NULL
+     || screen->dirtyFrom == NULL
+     || screen->dirtyTo == NULL || screen->out == NULL)
+    return -1;
+  screen->cursorX = 1;
+  screen->cursorY = 1;
+  screen->frames = 0;
+  screen->cellsChanged = 0;
+  screen->bytesWritten = 0;
+  for(i = 0; i < screen->cols * screen->rows; i++) {
+    screen->cells[i].ch = FILL_CHAR;
+    screen->cells[i].fore = F_WHITE;
+    screen->cells[i].back = B_BLACK;
+    screen->cells[i].attr = ATTR_NONE;
+    //Nothing is known about the terminal yet: '\0' never matches.
+    screen->shown[i].ch = '\0';
+    screen->shown[i].fore = 0;
+    screen->shown[i].back = 0;
+    screen->shown[i].attr = ATTR_NONE;
+  }
+  for(i = 0; i < screen->rows; i++) {
+    screen->dirtyFrom[i] = screen->cols;
+    screen->dirtyTo[i] = -1;
+  }
+  return 0;
 }
 
-// deleleteList: remove list from memory
-/* Function to delete the entire linked list */
-void deleteList(LISTCHOICE **head) 
-{ 
-   /* deref head_ref to get the real head */
-   LISTCHOICE *current = *head; 
-   LISTCHOICE *next = NULL; 
-  
-   while (current != NULL)  
-   { 
-       next = current->next; 
-       free(current->item);
-       free(current->path);
-       free(current);
-       current = next; 
-   } 
-    
-   /* deref head_ref to affect the real head back 
-      in the caller. */
-   *head = NULL; 
-} 
+void freeScreen(SCREEN * screen) {
+  free(screen->cells);
+  free(screen->shown);
+  free(screen->dirtyFrom);
+  free(screen->dirtyTo);
+  free(screen->out);
+  screen->cells = NULL;
+  screen->shown = NULL;
+  screen->dirtyFrom = NULL;
+  screen->dirtyTo = NULL;
+  screen->out = NULL;
+}
 
-/* addend: add new LISTCHOICE to the end of a list  */
-/* usage example: listBox1 = (addend(listBox1, newelement("Item")); */
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp) {
-  LISTCHOICE *p2;
-  if(head == NULL) {
-    newp->index = 0;
-    newp->back = NULL;
-    return newp;
+void outputbytes(SCREEN * screen, const char *bytes, size_t len) {
+//Append raw bytes to the frame being encoded.
+  char   *ptr;
+  size_t  newSize = screen->outSize;
+  if(screen->outUsed + len > screen->outSize) {
+    while(screen->outUsed + len > newSize)
+      newSize = newSize * 2;
+    ptr = (char *)realloc(screen->out, newSize);
+    if(ptr == NULL)
+      return;
+    screen->out = ptr;
+    screen->outSize = newSize;
   }
-// now find the end of list
-  for(p2 = head; p2->next != NULL; p2 = p2->next) ;
-  p2->next = newp;
-  newp->back = p2;
-  newp->index = newp->back->index + 1;
-  return head;
+  memcpy(screen->out + screen->outUsed, bytes, len);
+  screen->outUsed = screen->outUsed + len;
 }
 
-/* ---------------- */
-/* Listbox routines */
-/* ---------------- */
-
-void gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
-	       unsigned indexAt)
-//Go to a specific location on the list.
-{
-  LISTCHOICE *aux2;
-  unsigned counter = 0;
-  *aux = listBox1;
-  aux2 = *aux;
-  while(counter != indexAt) {
-    aux2 = aux2->next;
-    counter++;
+void outputchar(char ch) {
+//Put a character at the cursor with the current colors.
+  SCREEN *screen = &screen1;
+  int     x = screen->cursorX - 1, y = screen->cursorY - 1;
+  CELL   *cell;
+  if(screen->cells == NULL) {
+    putchar(ch);
+    return;
   }
-  //Highlight current item
-
-  displayItem(aux2, scrollData, SELECT_ITEM);
+  if(ch == '\n') {
+    //New line: go to the beginning of the next row.
+    screen->cursorX = 1;
+    if(screen->cursorY < screen->rows)
+      screen->cursorY++;
+    return;
+  }
+  if(x >= 0 && x < screen->cols && y >= 0 && y < screen->rows) {
+    cell = &screen->cells[y * screen->cols + x];
+    cell->ch = ch;
+    cell->fore = (unsigned char)screen->fore;
+    cell->back = (unsigned char)screen->back;
+    cell->attr = (unsigned char)screen->attr;
+    if(x < screen->dirtyFrom[y])
+      screen->dirtyFrom[y] = x;
+    if(x > screen->dirtyTo[y])
+      screen->dirtyTo[y] = x;
+  }
+  screen->cursorX++;
+}
 
-  //Update pointer
-  *aux = aux2;
+void outputf(const char *format, ...) {
+//printf into the frame buffer.
+  char    text[SCREEN_TEXT_SIZE];
+  va_list args;
+  int     i;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  for(i = 0; text[i] != '\0'; i++)
+    outputchar(text[i]);
 }
 
-void loadlist(LISTCHOICE * head, SCROLLDATA * scrollData, unsigned indexAt) {
+int sgrSequence(char *seq, int fore, int back, int attr,
+		int oldFore, int oldBack, int oldAttr) {
 /*
-Displays the items contained in the list with the properties specified
-in scrollData.
+Writes in seq the shortest SGR sequence taking the terminal from the
+old state to the new one (old values of -1 mean unknown) and returns
+its length; 0 if nothing changes. Changes are combined in one sequence
+and a reset ("0") is used when it beats switching attributes off.
 */
+  char    full[32], diff[32];
+  int     lenFull, lenDiff = 0;
 
-  LISTCHOICE *aux;
-  unsigned wherey, counter = 0;
+  if(fore == oldFore && back == oldBack && attr == oldAttr) {
+    seq[0] = '\0';
+    return 0;
+  }
+  //From scratch: reset, then everything that is set.
+  lenFull = sprintf(full, "\033[0%s%s;%d;%dm",
+		    (attr & ATTR_BOLD) ? ";1" : "",
+		    (attr & ATTR_UNDERLINE) ? ";4" : "", fore, back);
+  if(oldFore >= 0 && oldBack >= 0 && oldAttr >= 0) {
+    //Only the parameters that differ.
+    lenDiff = sprintf(diff, "\033[");
+    if((oldAttr & ATTR_BOLD) != (attr & ATTR_BOLD))
+      lenDiff += sprintf(diff + lenDiff, "%s;",
+			 (attr & ATTR_BOLD) ? "1" : "22");
+    if((oldAttr & ATTR_UNDERLINE) != (attr & ATTR_UNDERLINE))
+      lenDiff += sprintf(diff + lenDiff, "%s;",
+			 (attr & ATTR_UNDERLINE) ? "4" : "24");
+    if(oldFore != fore)
+      lenDiff += sprintf(diff + lenDiff, "%d;", fore);
+    if(oldBack != back)
+      lenDiff += sprintf(diff + lenDiff, "%d;", back);
+    diff[lenDiff - 1] = 'm';	//replace last ';'
+  }
+  if(lenDiff > 0 && lenDiff <= lenFull) {
+    strcpy(seq, diff);
+    return lenDiff;
+  }
+  strcpy(seq, full);
+  return lenFull;
+}
 
-  aux = head;
-  gotoIndex(&aux, scrollData, indexAt);
-  /* Save values */
-  //wherex = scrollData->wherex;
-  wherey = scrollData->wherey;
-  do {
-    displayItem(aux, scrollData, UNSELECT_ITEM);
-    aux = aux->next;
-    counter++;
-    scrollData->selector++;	// wherey++
-  } while(counter != scrollData->displayLimit);
-  scrollData->selector = wherey;	//restore value
+void setStyle(SCREEN * screen, int fore, int back, int attr) {
+//Emit colors/attributes only if the terminal is not in that state already.
+  char    seq[32];
+  int     len;
+  len = sgrSequence(seq, fore, back, attr, screen->termFore,
+		    screen->termBack, screen->termAttr);
+  if(len == 0)
+    return;
+  outputbytes(screen, seq, len);
+  screen->termFore = fore;
+  screen->termBack = back;
+  screen->termAttr = attr;
 }
 
-int query_length(LISTCHOICE ** head) {
-//Return no. items in a list.
-  {
-    LISTCHOICE *aux;
+int samecell(CELL * a, CELL * b) {
+//Whether two cells look the same on screen.
+  return a->ch == b->ch && a->fore == b->fore && a->back == b->back
+      && a->attr == b->attr;
+}
 
-    unsigned itemCount = 0;
-    aux = *head;
-    while(aux->next != NULL) {
-      aux = aux->next;
-      itemCount++;
-    }
-    return itemCount;
+void moveCursor(SCREEN * screen, int x, int y) {
+//Move the terminal cursor with the shortest sequence we know of.
+  char    seq[32];
+  CELL   *shown;
+  int     i, dx;
+  if(screen->termX == x && screen->termY == y)
+    return;
+  if(screen->termY == y && screen->termX > 0 && x > screen->termX) {
+    dx = x - screen->termX;
+    //A few cells in the current colors are cheaper to resend.
+    shown = &screen->shown[(y - 1) * screen->cols + screen->termX - 1];
+    for(i = 0; i < dx && dx <= SCREEN_GAP; i++)
+      if(shown[i].ch == '\0' || shown[i].fore != screen->termFore
+	 || shown[i].back != screen->termBack
+	 || shown[i].attr != screen->termAttr)
+	break;
+    if(dx <= SCREEN_GAP && i == dx) {
+      for(i = 0; i < dx; i++)
+	outputbytes(screen, &shown[i].ch, 1);
+    } else
+      outputbytes(screen, seq, sprintf(seq, "\033[%dC", dx));
+  } else if(screen->termY == y && x == 1) {
+    outputbytes(screen, "\r", 1);
+  } else {
+    outputbytes(screen, seq, sprintf(seq, "\033[%d;%df", y, x));
   }
-
+  screen->termX = x;
+  screen->termY = y;
 }
 
-void displayItem(LISTCHOICE * aux, SCROLLDATA * scrollData, int select)
-//Select or unselect item animation
-{
-  switch (select) {
+void outputcell(SCREEN * screen, CELL * cell) {
+//Emit one cell at the terminal cursor.
+  setStyle(screen, cell->fore, cell->back, cell->attr);
+  outputbytes(screen, &cell->ch, 1);
+  screen->termX++;
+  //Past the last column the terminal's wrap state is not reliable.
+  if(screen->termX > screen->cols)
+    screen->termX = -1;
+}
 
-    case SELECT_ITEM:
-      gotoxy(scrollData->wherex, scrollData->selector);
-      outputcolor(scrollData->foreColor1, scrollData->backColor1);
-      printf("%s\n", aux->item);
-      break;
+void scrollScreen(int top, int bottom, int lines) {
+/*
+Scrolls rows top..bottom (1-based) of the terminal by "lines" rows, up
+if positive and down if negative, using a scroll region. The shown
+buffer is shifted the same way, so the next flush only sends the rows
+that scrolled in and the cells that really changed. Without a frame
+buffer or scroll region support nothing is done and the caller's
+redraw repaints every row.
+*/
+  SCREEN *screen = &screen1;
+  char    seq[48];
+  int     y, n, x;
+  CELL   *shown;
 
-    case UNSELECT_ITEM:
-      gotoxy(scrollData->wherex, scrollData->selector);
-      outputcolor(scrollData->foreColor0, scrollData->backColor0);
-      printf("%s\n", aux->item);
-      break;
+  n = (lines < 0) ? -lines : lines;
+  if(!USE_SCROLL_REGION || screen->cells == NULL || n == 0 || top < 1
+     || bottom > screen->rows || bottom - top + 1 <= n)
+    return;
+  outputbytes(screen, seq,
+	      sprintf(seq, "\033[%d;%dr\033[%d%c\033[r", top, bottom, n,
+		      (lines > 0) ? 'S' : 'T'));
+  //Setting the region homes the cursor.
+  screen->termX = -1;
+  screen->termY = -1;
+  if(lines > 0) {
+    for(y = top - 1; y <= bottom - 1 - n; y++)
+      memcpy(&screen->shown[y * screen->cols],
+	     &screen->shown[(y + n) * screen->cols],
+	     screen->cols * sizeof(CELL));
+  } else {
+    for(y = bottom - 1; y >= top - 1 + n; y--)
+      memcpy(&screen->shown[y * screen->cols],
+	     &screen->shown[(y - n) * screen->cols],
+	     screen->cols * sizeof(CELL));
+  }
+  for(y = top - 1; y <= bottom - 1; y++) {
+    //Rows that scrolled in are blank: force them to be sent.
+    if((lines > 0 && y > bottom - 1 - n) || (lines < 0 && y < top - 1 + n)) {
+      shown = &screen->shown[y * screen->cols];
+      for(x = 0; x < screen->cols; x++)
+	shown[x].ch = '\0';
+    }
+    //Compare the whole region on the next flush.
+    screen->dirtyFrom[y] = 0;
+    screen->dirtyTo[y] = screen->cols - 1;
   }
 }
-int move_selector(LISTCHOICE ** selector, SCROLLDATA * scrollData) {
-/* 
-Creates animation by moving a selector highlighting next item and
-unselecting previous item
-*/
 
-  LISTCHOICE *aux;
-  unsigned scrollControl = 0, continueScroll = 0, circular =
-      CIRCULAR_INACTIVE;
-  //Auxiliary pointer points to selector.
-  aux = *selector;
+void flushScreen(void) {
+//Send the cells that differ from what the terminal shows, with one write().
+  SCREEN *screen = &screen1;
+  int     x, y;
+  ssize_t done;
+  size_t  sent = 0;
+  CELL   *cell, *shown;
 
-  //Circular list animation when not scrolling.
-  if(aux->index == scrollData->listLength - 1
-     && scrollData->scrollActive == SCROLL_INACTIVE
-     && scrollData->scrollDirection == DOWN_SCROLL) {
-    //After last item go back to the top.
-    displayItem(aux, scrollData, UNSELECT_ITEM);
-    scrollData->selector = scrollData->wherey;
-    gotoIndex(&aux, scrollData, 0);
-    *selector = aux;
-    circular = CIRCULAR_ACTIVE;
+  if(screen->cells == NULL) {
+    fflush(stdout);
+    return;
   }
-
-  if(aux->index == 0 && scrollData->scrollActive == SCROLL_INACTIVE
-     && scrollData->scrollDirection == UP_SCROLL) {
-    //Before first item go back to the bottom.
-    displayItem(aux, scrollData, UNSELECT_ITEM);
-    scrollData->selector = scrollData->wherey + scrollData->listLength - 1;
-    gotoIndex(&aux, scrollData, scrollData->listLength - 1);
-    *selector = aux;
-    circular = CIRCULAR_ACTIVE;
-  }
-  //Check if we do the circular list animation.
-  //If active, we skip the code one time.
-
-  if(circular == CIRCULAR_INACTIVE) {
-
-    //Check if we are within boundaries.
-    if((aux->next != NULL && scrollData->scrollDirection == DOWN_SCROLL)
-       || (aux->back != NULL && scrollData->scrollDirection == UP_SCROLL)) {
-
-      //Unselect previous item
-      displayItem(aux, scrollData, UNSELECT_ITEM);
-
-      //Check whether we move UP or Down
-      switch (scrollData->scrollDirection) {
-
-	case UP_SCROLL:
-	  //Calculate new top index if scroll is active 
-	  //otherwise it defaults to 0 (top)
-	  if(scrollData->scrollActive == SCROLL_ACTIVE)
-	    scrollControl = scrollData->currentListIndex;
-	  else
-	    scrollControl = 0;
-
-	  //Move selector
-	  if(aux->back->index >= scrollControl) {
-	    scrollData->selector--;	//whereY--
-	    aux = aux->back;	//Go to previous item
-	  } else {
-	    if(scrollData->scrollActive == SCROLL_ACTIVE)
-	      continueScroll = 1;
-	    else
-	      continueScroll = 0;
-	  }
-	  break;
-
-	case DOWN_SCROLL:
-	  //Calculate bottom index limit if scroll is ACTIVE
-	  //Otherwise it defaults to scrollData->ListLength-1
-
-	  if(scrollData->scrollActive == SCROLL_ACTIVE)
-	    scrollControl =
-		scrollData->currentListIndex + (scrollData->displayLimit -
-						1);
-	  else
-	    scrollControl = scrollData->listLength - 1;
-
-	  //Move selector
-	  if(aux->next->index <= scrollControl) {
-	    aux = aux->next;	//Go to next item
-	    scrollData->selector++;	//whereY++;
-	  } else {
-	    if(scrollData->scrollActive == SCROLL_ACTIVE)
-	      continueScroll = 1;
-	    else
-	      continueScroll = 0;
-	  }
-	  break;
-      }
-
-      //Metrics
-      cleanLine(4, B_BLUE, F_BLUE);
-      outputcolor(F_WHITE, B_BLUE);
-      gotoxy(6, 3);
-      printf("Index:%d/%d|Memory addr:%p", aux->index,
-	     scrollData->listLength - 1, aux);
-      gotoxy(6, 4);
-      printf("Scroll Limit: %d|IsScActive?:%d|Path: %s",
-	     scrollControl, scrollData->scrollActive, aux->path);
-
-      //Highlight new item
-      displayItem(aux, scrollData, SELECT_ITEM);
-
-      //Update selector pointer
-      *selector = aux;
+  //screen->out may already hold scroll sequences for this frame.
+  screen->cellsChanged = 0;
+  for(y = 0; y < screen->rows; y++) {
+    if(screen->dirtyTo[y] < 0)
+      continue;
+    for(x = screen->dirtyFrom[y]; x <= screen->dirtyTo[y]; x++) {
+      cell = &screen->cells[y * screen->cols + x];
+      shown = &screen->shown[y * screen->cols + x];
+      if(samecell(cell, shown))
+	continue;
+      moveCursor(screen, x + 1, y + 1);
+      outputcell(screen, cell);
+      *shown = *cell;
+      screen->cellsChanged++;
     }
+    screen->dirtyFrom[y] = screen->cols;
+    screen->dirtyTo[y] = -1;
+  }
+  //Leave the terminal cursor and colors where the program expects them.
+  setStyle(screen, screen->fore, screen->back, screen->attr);
+  moveCursor(screen, screen->cursorX, screen->cursorY);
+  while(sent < screen->outUsed) {
+    done = write(STDOUT_FILENO, screen->out + sent, screen->outUsed - sent);
+    if(done <= 0)
+      break;
+    sent = sent + done;
   }
-  circular = CIRCULAR_INACTIVE;
-  return continueScroll;
+  screen->bytesWritten = sent;
+  screen->frames++;
+  screen->outUsed = 0;
 }
 
-char selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData) {
-  char    ch=0;
-  unsigned control = 0;
-  unsigned continueScroll=0;
-  unsigned counter = 0;
-
-  //Go to and select expected item at the beginning
+/* ------------------------------ */
+/* Key decoder                    */
+/* ------------------------------ */
+/* Escape sequences are looked up in keyTable. Keys are read into the */
+/* session buffer in batches; a lone Esc is told apart from the start */
+/* of a sequence by waiting at most ESC_TIMEOUT ms for the rest.      */
 
-  gotoIndex(&aux, scrollData, scrollData->currentListIndex);
+static KEYSEQ keyTable[] = {
+  {"\033[A", KEY_UP}, {"\033[B", KEY_DOWN},
+  {"\033[C", KEY_RIGHT}, {"\033[D", KEY_LEFT},
+  {"\033OA", KEY_UP}, {"\033OB", KEY_DOWN},
+  {"\033OC", KEY_RIGHT}, {"\033OD", KEY_LEFT},
+  {"\033[5~", KEY_PGUP}, {"\033[6~", KEY_PGDN},
+  {"\033[H", KEY_HOME}, {"\033[F", KEY_END},
+  {"\033OH", KEY_HOME}, {"\033OF", KEY_END},
+  {"\033[1~", KEY_HOME}, {"\033[4~", KEY_END},
+  {"\033[7~", KEY_HOME}, {"\033[8~", KEY_END},
+  {"\033[2~", KEY_INSERT}, {"\033[3~", KEY_DELETE},
+  {"\033OP", KEY_F1}, {"\033OQ", KEY_F1 + 1},
+  {"\033OR", KEY_F1 + 2}, {"\033OS", KEY_F1 + 3},
+  {"\033[11~", KEY_F1}, {"\033[12~", KEY_F1 + 1},
+  {"\033[13~", KEY_F1 + 2}, {"\033[14~", KEY_F1 + 3},
+  {"\033[15~", KEY_F1 + 4}, {"\033[17~", KEY_F1 + 5},
+  {"\033[18~", KEY_F1 + 6}, {"\033[19~", KEY_F1 + 7},
+  {"\033[20~", KEY_F1 + 8}, {"\033[21~", KEY_F1 + 9},
+  {"\033[23~", KEY_F1 + 10}, {"\033[24~", KEY_F1 + 11},
+  {"\033[[A", KEY_F1}, {"\033[[B", KEY_F1 + 1},	//Linux console
+  {"\033[[C", KEY_F1 + 2}, {"\033[[D", KEY_F1 + 3},
+  {"\033[[E", KEY_F1 + 4},
+  {NULL, KEY_NONE}
+};
 
-  if(scrollData->scrollDirection == DOWN_SCROLL
-     && scrollData->currentListIndex != 0) {
-    //If we are going down we'll select the last item 
-    //to create a better scrolling transition (animation)
-    for(counter = 0; counter < scrollData->displayLimit; counter++) {
-      scrollData->scrollDirection = DOWN_SCROLL;
-      move_selector(&aux, scrollData);
+int fillTerm(int timeout) {
+/*
+Reads whatever keys are waiting into the session buffer. Waits up to
+timeout ms for the first one (-1: forever, 0: don't wait). Returns the
+no. of bytes added, 0 if none arrived in time, -1 at end of input and
+TERM_WAKE if a blocking wait was cut short by data on wakeFd (keys
+waiting are read first).
+*/
+  struct pollfd pfd[1 + WAKE_FDS];
+  int     count, fds = 1, i;
+  if(term1.bufferPos > 0) {
+    //Keep the unread bytes at the start of the buffer.
+    memmove(term1.buffer, term1.buffer + term1.bufferPos,
+	    term1.bufferUsed - term1.bufferPos);
+    term1.bufferUsed = term1.bufferUsed - term1.bufferPos;
+    term1.bufferPos = 0;
+  }
+  if(term1.bufferUsed == TERM_BUFFER)
+    return 0;
+  pfd[0].fd = STDIN_FILENO;
+  pfd[0].events = POLLIN;
+  pfd[0].revents = 0;
+  for(i = 0; timeout < 0 && i < WAKE_FDS; i++)
+    if(term1.wakeFd[i] >= 0) {
+      pfd[fds].fd = term1.wakeFd[i];
+      pfd[fds].events = POLLIN;
+      pfd[fds].revents = 0;
+      fds++;
     }
+  if(poll(pfd, fds, timeout) <= 0)
+    return 0;
+  //Keys go first, so a busy background job can't hold up typing.
+  count = 0;
+  if(pfd[0].revents != 0)
+    count = read(STDIN_FILENO, term1.buffer + term1.bufferUsed,
+		 TERM_BUFFER - term1.bufferUsed);
+  if(count <= 0)
+    for(i = 1; i < fds; i++)
+      if(pfd[i].revents != 0)
+	return TERM_WAKE;	//Results are taken before end of input
+  if(count <= 0)
+    return -1;
+  term1.bufferUsed = term1.bufferUsed + count;
+  return count;
+}
 
-  } else {
-    //Do nothing if we are going up. Selector is always at the top item.
+int decodeKey(const char *bytes, int len, int *used) {
+/*
+Decodes the key at the start of bytes. Returns KEY_PARTIAL if bytes
+could be the beginning of a longer sequence.
+*/
+  int     i, j, partial = 0;
+  if(bytes[0] != K_ESCAPE) {
+    *used = 1;
+    return (unsigned char)bytes[0];
   }
-
-  //It break the loop everytime the boundaries are reached.
-  //to reload a new list to show the scroll animation.
-  while(control != CONTINUE_SCROLL) {
-    ch = getch();
-
-    //if enter key pressed - break loop
-    if(ch == K_ENTER)
-      control = CONTINUE_SCROLL;	//Break the loop
-
-    //Check arrow keys
-    if(ch == K_ESCAPE)		// escape key
-    {
-      getch();			// read key again for arrow key combinations
-      switch (getch()) {
-	case K_UP_ARROW:	// escape key + A => arrow key up
-	  //Move selector up
-	  scrollData->scrollDirection = UP_SCROLL;
-	  continueScroll = move_selector(&aux, scrollData);
-	  //Break the loop if we are scrolling
-	  if(scrollData->scrollActive == SCROLL_ACTIVE
-	     && continueScroll == 1) {
-	    control = CONTINUE_SCROLL;
-	    //Update data
-	    scrollData->currentListIndex =
-		scrollData->currentListIndex - 1;
-	    scrollData->selector = scrollData->wherey;
-	    scrollData->itemIndex = aux->index;
-	    //Return value
-	    ch = control;
-	  }
-	  break;
-	case K_DOWN_ARROW:	// escape key + B => arrow key down
-	  //Move selector down
-	  scrollData->scrollDirection = DOWN_SCROLL;
-	  continueScroll = move_selector(&aux, scrollData);
-	  //Break the loop if we are scrolling
-	  if(scrollData->scrollActive == SCROLL_ACTIVE
-	     && continueScroll == 1) {
-	    control = CONTINUE_SCROLL;
-	    //Update data  
-	    scrollData->currentListIndex =
-		scrollData->currentListIndex + 1;
-	    scrollData->selector = scrollData->wherey;
-	    scrollData->itemIndex = aux->index;
-	    scrollData->scrollDirection = DOWN_SCROLL;
-	  }
-	  //Return value  
-	  ch = control;
-	  break;
-      }
+  for(i = 0; keyTable[i].seq != NULL; i++) {
+    for(j = 0; j < len && keyTable[i].seq[j] != '\0'; j++)
+      if(keyTable[i].seq[j] != bytes[j])
+	break;
+    if(keyTable[i].seq[j] == '\0') {
+      *used = j;
+      return keyTable[i].key;
     }
+    if(j == len)
+      partial = 1;
   }
-  if(ch == K_ENTER)		// enter key
-  {
-    //Pass data of last item selected.
-    scrollData->item = aux->item;
-    scrollData->itemIndex = aux->index;
-    scrollData->path = aux->path;
-    scrollData->isDirectory = aux->isDirectory;
+  if(partial || len == 1)
+    return KEY_PARTIAL;
+  //Unknown CSI/SS3 sequence: skip all of it.
+  if(bytes[1] == '[') {
+    for(j = 2; j < len; j++)
+      if(bytes[j] >= 0x40 && bytes[j] <= 0x7e) {
+	*used = j + 1;
+	return KEY_NONE;
+      }
+    return KEY_PARTIAL;
   }
-  return ch;
+  if(bytes[1] == 'O') {
+    if(len < 3)
+      return KEY_PARTIAL;
+    *used = 3;
+    return KEY_NONE;
+  }
+  *used = 1;
+  return KEY_ESCAPE;
 }
 
-char listBox(LISTCHOICE * head,
-	     unsigned whereX, unsigned whereY,
-	     SCROLLDATA * scrollData, unsigned bColor0,
-	     unsigned fColor0, unsigned bColor1, unsigned fColor1,
-	     unsigned displayLimit) {
-
-  unsigned list_length = 0;
-  //unsigned currentIndex = 0;
-  int     scrollLimit = 0;
-  unsigned currentListIndex = 0;
-  char    ch=0;
-  LISTCHOICE *aux=NULL;
-
-  // Query size of the list
-  list_length = query_length(&head) + 1;
-
-  //Save calculations for SCROLL and store DATA
-  scrollData->displayLimit = displayLimit;
-  scrollLimit = list_length - scrollData->displayLimit;	//Careful with negative integers
-
-  if(scrollLimit < 0)
-    scrollData->displayLimit = list_length;	//Failsafe for overboard values
-
-  scrollData->scrollLimit = scrollLimit;
-  scrollData->listLength = list_length;
-  scrollData->wherex = whereX;
-  scrollData->wherey = whereY;
-  scrollData->selector = whereY;
-  scrollData->backColor0 = bColor0;
-  scrollData->backColor1 = bColor1;
-  scrollData->foreColor0 = fColor0;
-  scrollData->foreColor1 = fColor1;
+int readKey(void) {
+//Returns the next key: a character, a KEY_* code or EOF.
+  int     key, used = 0, count;
+  if(term1.bufferPos == term1.bufferUsed) {
+    flushScreen();		//Show the frame before waiting for a key
+    count = fillTerm(-1);
+    if(count == TERM_WAKE)
+      return KEY_WAKE;
+    if(count < 0)
+      return EOF;
+  }
+  for(;;) {
+    key = decodeKey(term1.buffer + term1.bufferPos,
+		    term1.bufferUsed - term1.bufferPos, &used);
+    if(key != KEY_PARTIAL)
+      break;
+    count = fillTerm(ESC_TIMEOUT);
+    if(count < 0) {
+      //Input ended inside a sequence: drop what there is of it.
+      used = term1.bufferUsed - term1.bufferPos;
+      key = KEY_NONE;
+      break;
+    }
+    if(count == 0) {
+      //Nothing followed: it was the Esc key itself.
+      used = 1;
+      key = KEY_ESCAPE;
+      break;
+    }
+  }
+  term1.bufferPos = term1.bufferPos + used;
+  return key;
+}
 
-  //Check whether we have to activate scroll or not 
-  //and if we are within bounds. [1,list_length)
+unsigned repeatKey(int key) {
+/*
+Consumes the copies of key that are already waiting (auto-repeat) and
+returns how many there were. Never blocks.
+*/
+  unsigned count = 0;
+  int     next, used = 0;
+  for(;;) {
+    if(term1.bufferPos == term1.bufferUsed && fillTerm(0) <= 0)
+      break;
+    next = decodeKey(term1.buffer + term1.bufferPos,
+		     term1.bufferUsed - term1.bufferPos, &used);
+    if(next == KEY_PARTIAL && fillTerm(0) > 0)
+      continue;			//Rest of the sequence was still queued
+    if(next != key)
+      break;
+    term1.bufferPos = term1.bufferPos + used;
+    count++;
+  }
+  return count;
+}
 
-  if(list_length > scrollData->displayLimit && scrollLimit > 0
-     && displayLimit > 0) {
-    //Scroll is possible  
+/* --------------- */
+/* Arena routines  */
+/* --------------- */
 
-    scrollData->scrollActive = SCROLL_ACTIVE;
-    aux = head;
+// initArena: set up an empty arena. Slabs are allocated on demand.
+void initArena(ARENA * arena, size_t slabSize) {
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->slabSize = slabSize;
+  arena->bytesUsed = 0;
+  arena->bytesWasted = 0;
+  arena->bytesReserved = 0;
+}
 
-    currentListIndex = 0;	//We listBox1 the scroll at the top index.
-    scrollData->currentListIndex = currentListIndex;
+/* arenaAlloc: bump-allocate size bytes from the arena. */
+/* Slabs are chained and reused after arenaReset(). Returns NULL if out of memory. */
+void   *arenaAlloc(ARENA * arena, size_t size) {
+  SLAB   *slab = arena->current;
+  SLAB   *next = NULL;
+  size_t  pad = 0, need;
+  void   *ptr;
 
-    //Scroll loop animation. Finish with ENTER.
-    do {
-      currentListIndex = scrollData->currentListIndex;
-      loadlist(aux, scrollData, currentListIndex);
-      gotoIndex(&aux, scrollData, currentListIndex);
-      ch = selectorMenu(aux, scrollData);
-    } while(ch != K_ENTER);
+  //Keep every block aligned for pointers.
+  if(slab != NULL && slab->used % ARENA_ALIGN != 0)
+    pad = ARENA_ALIGN - slab->used % ARENA_ALIGN;
 
-  } else {
-    //Scroll is not possible.
-    //Display all the elements and create selector.
-    scrollData->scrollActive = SCROLL_INACTIVE;
-    scrollData->currentListIndex = 0;
-    scrollData->displayLimit = list_length;	//Default to list_length
-    loadlist(head, scrollData, 0);
-    ch = selectorMenu(head, scrollData);
+  if(slab == NULL || slab->used + pad + size > slab->size) {
+    //Current slab is full. Count its tail as wasted and move on.
+    if(slab != NULL)
+      arena->bytesWasted = arena->bytesWasted + (slab->size - slab->used);
+    //Reuse the next slab if it is big enough, otherwise chain a new one.
+    next = (slab == NULL) ? arena->first : slab->next;
+    if(next != NULL && next->size >= size) {
+      slab = next;
+    } else {
+      need = (size > arena->slabSize) ? size : arena->slabSize;
+      next = (SLAB *) malloc(sizeof(SLAB) + need);
+      if(next == NULL)
+	return NULL;
+      next->size = need;
+      if(slab == NULL) {
+	next->next = arena->first;
+	arena->first = next;
+      } else {
+	next->next = slab->next;
+	slab->next = next;
+      }
+      arena->bytesReserved = arena->bytesReserved + need;
+      slab = next;
+    }
+    slab->used = 0;
+    arena->current = slab;
+    pad = 0;
   }
-  return ch;
+  arena->bytesWasted = arena->bytesWasted + pad;
+  arena->bytesUsed = arena->bytesUsed + size;
+  ptr = slab->data + slab->used + pad;
+  slab->used = slab->used + pad + size;
+  return ptr;
 }
 
-/* ---------------- */
-/* List files       */
-/* ---------------- */
-
-int addSpaces(char temp[MAX_ITEM_LENGTH]) {
-  int     i;
-  for(i = strlen(temp); i < MAX_ITEM_LENGTH; i++) {
-    strcat(temp, " ");
-  }
-  return 0;
+/* arenaReset: drop everything allocated from the arena in O(1). */
+/* Slabs are kept for the next list and rewound as they are reached. */
+void arenaReset(ARENA * arena) {
+  arena->current = NULL;
+  arena->bytesUsed = 0;
+  arena->bytesWasted = 0;
 }
 
-void cleanString(char *string, int max) {
-  int     i;
-  for(i = 0; i < max; i++) {
-    string[i] = ' ';
+// freeArena: give all slabs back to the system.
+void freeArena(ARENA * arena) {
+  SLAB   *slab = arena->first;
+  SLAB   *next = NULL;
+  while(slab != NULL) {
+    next = slab->next;
+    free(slab);
+    slab = next;
   }
+  initArena(arena, arena->slabSize);
 }
-int listFiles(LISTCHOICE ** listBox1, char *directory) {
-  DIR    *d=NULL;
-  struct dirent *dir=NULL;
+
+/* --------------------- */
+/* Dynamic List routines */
+/* --------------------- */
+
+// create new list element of type LISTCHOICE from the supplied text string
+LISTCHOICE *newelement(char *text, char *itemPath, unsigned itemType) {
+  LISTCHOICE *newp;
+  newp = (LISTCHOICE *) malloc(sizeof(LISTCHOICE));
+  newp->item = (char *)malloc(strlen(text) + 1);
+  newp->path = (char *)malloc(strlen(itemPath) + 1);
+  strcpy(newp->item, text);
+  strcpy(newp->path, itemPath);
+  newp->isDirectory = itemType;
+  newp->meta = NULL;
+  newp->next = NULL;
+  newp->back = NULL;
+  return newp;
+}
+
+// create new list element for a given list. Lists with an arena get
+// the element and both strings bump-allocated from it.
+LISTCHOICE *newitem(LISTDATA * list, char *text, char *itemPath,
+		    unsigned itemType) {
+  LISTCHOICE *newp;
+  size_t  lenText, lenPath;
+  if(list->arena == NULL)
+    return newelement(text, itemPath, itemType);
+  lenText = strlen(text) + 1;
+  lenPath = strlen(itemPath) + 1;
+  newp = (LISTCHOICE *) arenaAlloc(list->arena, sizeof(LISTCHOICE));
+  if(newp == NULL)
+    return NULL;
+  newp->item = (char *)arenaAlloc(list->arena, lenText + lenPath);
+  if(newp->item == NULL)
+    return NULL;
+  newp->path = newp->item + lenText;
+  memcpy(newp->item, text, lenText);
+  memcpy(newp->path, itemPath, lenPath);
+  newp->isDirectory = itemType;
+  newp->meta = NULL;
+  newp->next = NULL;
+  newp->back = NULL;
+  return newp;
+}
+
+// initList: set up an empty list
+void initList(LISTDATA * list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation = 0;
+  list->table = NULL;
+  list->tableSize = 0;
+  list->tableGeneration = 0;
+  list->arena = NULL;
+  list->store = NULL;
+}
+
+// deleteList: remove list from memory, leaving it empty
+void deleteList(LISTDATA * list) {
+  LISTCHOICE *aux = list->head;
+  LISTCHOICE *next = NULL;
+  //Store and arena lists are dropped in one go
+  if(list->store != NULL) {
+    list->store->blobUsed = 0;
+    list->store->metaCount = 0;
+    aux = NULL;
+  } else if(list->arena != NULL) {
+    arenaReset(list->arena);
+    aux = NULL;
+  }
+  while(aux != NULL) {
+    next = aux->next;
+    free(aux->item);
+    free(aux->path);
+    free(aux->meta);
+    free(aux);			//remove item
+    aux = next;
+  }
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation++;
+  free(list->table);
+  list->table = NULL;
+  list->tableSize = 0;
+}
+
+/* addend: add new LISTCHOICE to the end of a list  */
+/* usage example: addend(&listBox1, newelement("Item", ...)); */
+/* The tail is kept in LISTDATA so no walk is needed. O(1) */
+/* An index table that is up to date is kept so: lists that grow  */
+/* while on display (background scans) would otherwise rebuild it */
+/* for every batch. */
+void addend(LISTDATA * list, LISTCHOICE * newp) {
+  LISTCHOICE **table;
+  if(list->table != NULL && list->tableGeneration == list->generation) {
+    if(list->length == list->tableSize) {
+      table = (LISTCHOICE **) realloc(list->table, 2 * list->tableSize *
+				     sizeof(LISTCHOICE *));
+      if(table != NULL) {
+	list->table = table;
+	list->tableSize = 2 * list->tableSize;
+      }
+    }
+    if(list->length < list->tableSize) {
+      list->table[list->length] = newp;
+      list->tableGeneration++;	//Matches the generation below
+    }
+  }
+  newp->next = NULL;
+  newp->back = list->tail;
+  if(list->tail == NULL) {
+    newp->index = 0;
+    list->head = newp;
+  } else {
+    list->tail->next = newp;
+    newp->index = list->tail->index + 1;
+  }
+  list->tail = newp;
+  list->length++;
+  list->generation++;
+}
+
+/* addfront: add new LISTCHOICE to the beginning of a list */
+/* Item numbers of the items behind it are shifted by one. O(n) */
+void addfront(LISTDATA * list, LISTCHOICE * newp) {
+  LISTCHOICE *aux;
+  newp->back = NULL;
+  newp->next = list->head;
+  newp->index = 0;
+  if(list->head == NULL)
+    list->tail = newp;
+  else
+    list->head->back = newp;
+  list->head = newp;
+  list->length++;
+  list->generation++;
+  for(aux = newp->next; aux != NULL; aux = aux->next)
+    aux->index = aux->back->index + 1;
+}
+
+/* addlist: move all the items of a second list to the end of a list */
+/* Only the moved items are renumbered. "items" is left empty. O(k) */
+void addlist(LISTDATA * list, LISTDATA * items) {
+  LISTCHOICE *aux;
+  unsigned index;
+  if(items->head == NULL)
+    return;
+  index = (list->tail == NULL) ? 0 : list->tail->index + 1;
+  for(aux = items->head; aux != NULL; aux = aux->next)
+    aux->index = index++;
+  items->head->back = list->tail;
+  if(list->tail == NULL)
+    list->head = items->head;
+  else
+    list->tail->next = items->head;
+  list->tail = items->tail;
+  list->length = list->length + items->length;
+  list->generation++;
+  items->head = NULL;
+  items->tail = NULL;
+  items->length = 0;
+  items->generation++;
+}
+
+/* delelement: unlink an item from a list and free it */
+/* Item numbers of the items behind it are shifted back by one. O(n) */
+void delelement(LISTDATA * list, LISTCHOICE * oldp) {
+  LISTCHOICE *aux;
+  if(oldp->back == NULL)
+    list->head = oldp->next;
+  else
+    oldp->back->next = oldp->next;
+  if(oldp->next == NULL)
+    list->tail = oldp->back;
+  else
+    oldp->next->back = oldp->back;
+  for(aux = oldp->next; aux != NULL; aux = aux->next)
+    aux->index--;
+  list->length--;
+  list->generation++;
+  //Arena items stay allocated until the arena is reset.
+  if(list->arena == NULL) {
+    free(oldp->item);
+    free(oldp->path);
+    free(oldp->meta);
+    free(oldp);
+  }
+}
+
+/* itemAt: return the item with a given item number */
+/* The table is rebuilt in one pass whenever the list has changed */
+/* since the last lookup; afterwards every lookup is O(1). */
+LISTCHOICE *itemAt(LISTDATA * list, unsigned indexAt) {
+  LISTCHOICE *aux;
+  LISTCHOICE **table;
+  unsigned counter = 0;
+  if(indexAt >= list->length)
+    return NULL;
+  if(list->table == NULL || list->tableGeneration != list->generation) {
+    if(list->tableSize < list->length) {
+      table = (LISTCHOICE **) realloc(list->table,
+				     list->length * sizeof(LISTCHOICE *));
+      if(table == NULL)
+	return NULL;
+      list->table = table;
+      list->tableSize = list->length;
+    }
+    for(aux = list->head; aux != NULL; aux = aux->next)
+      list->table[counter++] = aux;
+    list->tableGeneration = list->generation;
+  }
+  return list->table[indexAt];
+}
+
+/* ---------------------- */
+/* Packed item store      */
+/* ---------------------- */
+
+// initStore: set up an empty item store. Arrays grow on demand.
+void initStore(ITEMSTORE * store) {
+  store->itemOffset = NULL;
+  store->pathOffset = NULL;
+  store->type = NULL;
+  store->blob = NULL;
+  store->blobSize = 0;
+  store->blobUsed = 0;
+  store->capacity = 0;
+  store->metaSlot = NULL;
+  store->metas = NULL;
+  store->metaCount = 0;
+  store->metaSize = 0;
+}
+
+/* storeAppend: copy an item into slot "count" of the store. */
+/* Arrays and blob double in size when full. Returns -1 if out of memory. */
+int storeAppend(ITEMSTORE * store, unsigned count, char *text,
+		char *itemPath, unsigned itemType) {
+  size_t  lenText = strlen(text) + 1;
+  size_t  lenPath = strlen(itemPath) + 1;
+  size_t  newSize;
+  unsigned newCapacity;
+  void   *ptr;
+
+  if(count == store->capacity) {
+    newCapacity = (store->capacity == 0) ? STORE_MIN_ITEMS :
+	store->capacity * 2;
+    ptr = realloc(store->itemOffset, newCapacity * sizeof(size_t));
+    if(ptr == NULL)
+      return -1;
+    store->itemOffset = (size_t *) ptr;
+    ptr = realloc(store->pathOffset, newCapacity * sizeof(size_t));
+    if(ptr == NULL)
+      return -1;
+    store->pathOffset = (size_t *) ptr;
+    ptr = realloc(store->type, newCapacity);
+    if(ptr == NULL)
+      return -1;
+    store->type = (unsigned char *)ptr;
+    ptr = realloc(store->metaSlot, newCapacity * sizeof(unsigned));
+    if(ptr == NULL)
+      return -1;
+    store->metaSlot = (unsigned *)ptr;
+    store->capacity = newCapacity;
+  }
+  if(store->blobUsed + lenText + lenPath > store->blobSize) {
+    newSize = (store->blobSize == 0) ? STORE_MIN_BLOB : store->blobSize;
+    while(store->blobUsed + lenText + lenPath > newSize)
+      newSize = newSize * 2;
+    ptr = realloc(store->blob, newSize);
+    if(ptr == NULL)
+      return -1;
+    store->blob = (char *)ptr;
+    store->blobSize = newSize;
+  }
+  store->itemOffset[count] = store->blobUsed;
+  memcpy(store->blob + store->blobUsed, text, lenText);
+  store->blobUsed = store->blobUsed + lenText;
+  store->pathOffset[count] = store->blobUsed;
+  memcpy(store->blob + store->blobUsed, itemPath, lenPath);
+  store->blobUsed = store->blobUsed + lenPath;
+  store->type[count] = (unsigned char)itemType;
+  store->metaSlot[count] = 0;
+  return 0;
+}
+
+// freeStore: give the store's arrays back to the system.
+void freeStore(ITEMSTORE * store) {
+  free(store->itemOffset);
+  free(store->pathOffset);
+  free(store->type);
+  free(store->blob);
+  free(store->metaSlot);
+  free(store->metas);
+  initStore(store);
+}
+
+/* ---------------------- */
+/* Item accessors         */
+/* ---------------------- */
+/* The listbox reaches items by number only, through these routines, */
+/* so it runs unchanged on a linked list or on a packed item store. */
+
+// additem: add an item to the end of a list, whatever its backend.
+int additem(LISTDATA * list, char *text, char *itemPath, unsigned itemType) {
+  LISTCHOICE *newp;
+  if(list->store != NULL) {
+    if(storeAppend(list->store, list->length, text, itemPath, itemType) != 0)
+      return -1;
+    list->length++;
+    list->generation++;
+    return 0;
+  }
+  newp = newitem(list, text, itemPath, itemType);
+  if(newp == NULL)
+    return -1;
+  addend(list, newp);
+  return 0;
+}
+
+char   *listItem(LISTDATA * list, unsigned indexAt) {
+//Item string of item number indexAt.
+  if(list->store != NULL)
+    return list->store->blob + list->store->itemOffset[indexAt];
+  return itemAt(list, indexAt)->item;
+}
+
+char   *listPath(LISTDATA * list, unsigned indexAt) {
+//Path string of item number indexAt.
+  if(list->store != NULL)
+    return list->store->blob + list->store->pathOffset[indexAt];
+  return itemAt(list, indexAt)->path;
+}
+
+unsigned listType(LISTDATA * list, unsigned indexAt) {
+//Kind of item (DIRECTORY/FILEITEM) of item number indexAt.
+  if(list->store != NULL)
+    return list->store->type[indexAt];
+  return itemAt(list, indexAt)->isDirectory;
+}
+
+/* listOrder: put the items in a new order, item n becoming the item  */
+/* that was number order[n]. Strings stay where they are; links, item */
+/* numbers and the table (or the store arrays) are rebuilt. O(n) */
+/* Returns -1 if out of memory, leaving the list as it was. */
+int listOrder(LISTDATA * list, const unsigned *order) {
+  LISTCHOICE **table, *aux;
+  ITEMSTORE *store = list->store;
+  size_t *itemOffset, *pathOffset;
+  unsigned char *type;
+  unsigned *metaSlot;
+  unsigned n = list->length, i;
+
+  if(n == 0)
+    return 0;
+  if(store != NULL) {
+    itemOffset = (size_t *) malloc(n * sizeof(size_t));
+    pathOffset = (size_t *) malloc(n * sizeof(size_t));
+    type = (unsigned char *)malloc(n);
+    metaSlot = (unsigned *)malloc(n * sizeof(unsigned));
+    if(itemOffset == NULL || pathOffset == NULL || type == NULL
+       || metaSlot == NULL) {
+      free(itemOffset);
+      free(pathOffset);
+      free(type);
+      free(metaSlot);
+      return -1;
+    }
+    for(i = 0; i < n; i++) {
+      itemOffset[i] = store->itemOffset[order[i]];
+      pathOffset[i] = store->pathOffset[order[i]];
+      type[i] = store->type[order[i]];
+      metaSlot[i] = store->metaSlot[order[i]];
+    }
+    free(store->itemOffset);
+    free(store->pathOffset);
+    free(store->type);
+    free(store->metaSlot);
+    store->itemOffset = itemOffset;
+    store->pathOffset = pathOffset;
+    store->type = type;
+    store->metaSlot = metaSlot;
+    store->capacity = n;
+    list->generation++;
+    return 0;
+  }
+  table = (LISTCHOICE **) malloc(n * sizeof(LISTCHOICE *));
+  if(table == NULL || itemAt(list, 0) == NULL) {
+    free(table);
+    return -1;
+  }
+  for(i = 0; i < n; i++)
+    table[i] = list->table[order[i]];
+  for(i = 0; i < n; i++) {
+    aux = table[i];
+    aux->index = i;
+    aux->back = (i == 0) ? NULL : table[i - 1];
+    aux->next = (i + 1 == n) ? NULL : table[i + 1];
+  }
+  list->head = table[0];
+  list->tail = table[n - 1];
+  free(list->table);
+  list->table = table;
+  list->tableSize = n;
+  list->generation++;
+  list->tableGeneration = list->generation;
+  return 0;
+}
+
+/* listMeta: metadata kept for item number indexAt. With "create" an */
+/* empty one (META_NONE) is set up if there is none yet; else NULL.  */
+/* Store entries share one array: the pointer is only good until the */
+/* next call. Returns NULL if out of memory. */
+ENTRYMETA *listMeta(LISTDATA * list, unsigned indexAt, int create) {
+  ITEMSTORE *store = list->store;
+  LISTCHOICE *aux;
+  ENTRYMETA *meta;
+  unsigned newSize;
+  void   *ptr;
+
+  if(store != NULL) {
+    if(store->metaSlot[indexAt] != 0)
+      return &store->metas[store->metaSlot[indexAt] - 1];
+    if(!create)
+      return NULL;
+    if(store->metaCount == store->metaSize) {
+      newSize = (store->metaSize == 0) ? STORE_MIN_ITEMS :
+	  store->metaSize * 2;
+      ptr = realloc(store->metas, newSize * sizeof(ENTRYMETA));
+      if(ptr == NULL)
+	return NULL;
+      store->metas = (ENTRYMETA *) ptr;
+      store->metaSize = newSize;
+    }
+    meta = &store->metas[store->metaCount++];
+    store->metaSlot[indexAt] = store->metaCount;
+  } else {
+    aux = itemAt(list, indexAt);
+    if(aux->meta != NULL || !create)
+      return aux->meta;
+    meta = (list->arena != NULL) ?
+	(ENTRYMETA *) arenaAlloc(list->arena, sizeof(ENTRYMETA)) :
+	(ENTRYMETA *) malloc(sizeof(ENTRYMETA));
+    if(meta == NULL)
+      return NULL;
+    aux->meta = meta;
+  }
+  meta->state = META_NONE;
+  meta->epoch = 0;
+  return meta;
+}
+
+/* listBytes: memory the list takes, for the caches that keep lists. */
+/* malloc'd items are guessed at. */
+size_t listBytes(LISTDATA * list) {
+  ITEMSTORE *store = list->store;
+  size_t  bytes = sizeof(LISTDATA) + list->tableSize * sizeof(LISTCHOICE *);
+
+  if(store != NULL)
+    return bytes + store->blobSize + store->metaSize * sizeof(ENTRYMETA) +
+	store->capacity * (2 * sizeof(size_t) + 1 + sizeof(unsigned));
+  if(list->arena != NULL)
+    return bytes + list->arena->bytesReserved;
+  return bytes + list->length * (sizeof(LISTCHOICE) +
+				 2 * (MAX_ITEM_LENGTH + 1));
+}
+
+/* ---------------------- */
+/* Thread pool routines   */
+/* ---------------------- */
+/* Filter passes are split into tasks run by a pool of worker threads. */
+/* Each worker has its own ring of tasks and takes the oldest first;  */
+/* a worker with nothing left steals the oldest task of another, so    */
+/* the first chunks of a list finish first and results stream in in   */
+/* list order. Every finished filter task writes a byte to the notify */
+/* pipe, which wakes readKey() on the UI thread. Recursive scans use  */
+/* a second pool the same way, one directory per task.                 */
+
+/* initPool: start up to "threads" workers. */
+/* Returns -1 if no worker could be started. */
+int initPool(POOL * pool, unsigned threads) {
+  unsigned i;
+  pool->count = 0;
+  pool->queued = 0;
+  pool->stop = 0;
+  pool->next = 0;
+  if(threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  if(pipe(pool->notify) != 0)
+    return -1;
+  fcntl(pool->notify[0], F_SETFL, O_NONBLOCK);
+  fcntl(pool->notify[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  for(i = 0; i < threads; i++) {
+    pool->workers[i].head = 0;
+    pool->workers[i].used = 0;
+    pool->workers[i].pool = pool;
+    pthread_mutex_init(&pool->workers[i].lock, NULL);
+  }
+  //Workers look at every ring, so all are set up before any starts.
+  for(i = 0; i < threads; i++) {
+    if(pthread_create(&pool->workers[i].thread, NULL, poolWorker,
+		      &pool->workers[i]) != 0)
+      break;
+    pool->count++;
+  }
+  if(pool->count == 0) {
+    freePool(pool);
+    return -1;
+  }
+  return 0;
+}
+
+// freePool: stop the workers and wait for them.
+void freePool(POOL * pool) {
+  unsigned i;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for(i = 0; i < pool->count; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+  pool->count = 0;
+  close(pool->notify[0]);
+  close(pool->notify[1]);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/* poolSubmit: queue run(data, n), spreading tasks over the workers in */
+/* turn. Tasks may submit tasks. Returns -1 if the ring is full. */
+int poolSubmit(POOL * pool, void (*run) (void *, unsigned), void *data,
+	       unsigned n) {
+  WORKER *worker;
+  TASK   *task;
+  worker = &pool->workers[__atomic_fetch_add(&pool->next, 1,
+					     __ATOMIC_RELAXED) % pool->count];
+  pthread_mutex_lock(&worker->lock);
+  if(worker->used == POOL_TASKS) {
+    pthread_mutex_unlock(&worker->lock);
+    return -1;
+  }
+  task = &worker->tasks[(worker->head + worker->used) % POOL_TASKS];
+  task->run = run;
+  task->data = data;
+  task->n = n;
+  worker->used++;
+  pthread_mutex_unlock(&worker->lock);
+  pthread_mutex_lock(&pool->lock);
+  pool->queued++;
+  pthread_cond_signal(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+// popTask: take the oldest task of a worker. Returns 0 if it has none.
+int popTask(WORKER * worker, TASK * task) {
+  int     found = 0;
+  pthread_mutex_lock(&worker->lock);
+  if(worker->used > 0) {
+    *task = worker->tasks[worker->head];
+    worker->head = (worker->head + 1) % POOL_TASKS;
+    worker->used--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return found;
+}
+
+void   *poolWorker(void *arg) {
+//Worker thread: claim a task, find it (own ring first), run it.
+  WORKER *self = (WORKER *) arg;
+  POOL   *pool = self->pool;
+  TASK    task;
+  unsigned i;
+
+  for(;;) {
+    pthread_mutex_lock(&pool->lock);
+    while(pool->queued == 0 && !pool->stop)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    if(pool->stop) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pool->queued--;		//Claimed: some ring is sure to hold it
+    pthread_mutex_unlock(&pool->lock);
+    while(!popTask(self, &task)) {
+      for(i = 0; i < pool->count; i++)
+	if(popTask(&pool->workers[i], &task))
+	  break;		//Stolen
+      if(i < pool->count)
+	break;
+    }
+    task.run(task.data, task.n);
+  }
+  return NULL;
+}
+
+/* ---------------------- */
+/* Matcher routines       */
+/* ---------------------- */
+/* The names of a list are packed once, in lower case, into one blob  */
+/* with a '\0' after each name. A substring is searched for in the    */
+/* blob 16 (SSE2) or 32 (AVX2) positions at a time: a position is a   */
+/* candidate when both the first and the last character of the text  */
+/* are in place, and only candidates are compared in full. The '\0'   */
+/* separators keep a match inside one name. The widest routine the    */
+/* CPU supports is picked at run time.                                */
+
+// findScalar: first position >= from where pat[0..len) starts in
+// blob[from..to), or NO_MATCH.
+size_t findScalar(const char *blob, size_t from, size_t to,
+		  const char *pat, unsigned len) {
+  const char *at;
+  while(from + len <= to) {
+    at = (const char *)memchr(blob + from, pat[0], to - from - len + 1);
+    if(at == NULL)
+      break;
+    from = at - blob;
+    if(memcmp(at + 1, pat + 1, len - 1) == 0)
+      return from;
+    from++;
+  }
+  return NO_MATCH;
+}
+
+#if HAVE_SSE2
+size_t findSSE2(const char *blob, size_t from, size_t to,
+		const char *pat, unsigned len) {
+  __m128i first = _mm_set1_epi8(pat[0]);
+  __m128i last = _mm_set1_epi8(pat[len - 1]);
+  __m128i a, b;
+  unsigned mask, bit;
+  //Both loads stay inside blob[from..to).
+  while(from + len - 1 + 16 <= to) {
+    a = _mm_loadu_si128((const __m128i *)(blob + from));
+    b = _mm_loadu_si128((const __m128i *)(blob + from + len - 1));
+    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+					   _mm_cmpeq_epi8(b, last)));
+    while(mask != 0) {
+      bit = __builtin_ctz(mask);
+      if(memcmp(blob + from + bit, pat, len) == 0)
+	return from + bit;
+      mask = mask & (mask - 1);
+    }
+    from = from + 16;
+  }
+  return findScalar(blob, from, to, pat, len);
+}
+#endif
+
+#if HAVE_AVX2
+__attribute__ ((target("avx2")))
+size_t findAVX2(const char *blob, size_t from, size_t to,
+		const char *pat, unsigned len) {
+  __m256i first = _mm256_set1_epi8(pat[0]);
+  __m256i last = _mm256_set1_epi8(pat[len - 1]);
+  __m256i a, b;
+  unsigned mask, bit;
+  while(from + len - 1 + 32 <= to) {
+    a = _mm256_loadu_si256((const __m256i *)(blob + from));
+    b = _mm256_loadu_si256((const __m256i *)(blob + from + len - 1));
+    mask = (unsigned)_mm256_movemask_epi8(
+	_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+			 _mm256_cmpeq_epi8(b, last)));
+    while(mask != 0) {
+      bit = __builtin_ctz(mask);
+      if(memcmp(blob + from + bit, pat, len) == 0)
+	return from + bit;
+      mask = mask & (mask - 1);
+    }
+    from = from + 32;
+  }
+  return findScalar(blob, from, to, pat, len);
+}
+#endif
+
+// initMatcher: pick the widest search routine this CPU runs.
+void initMatcher(void) {
+  findText = findScalar;
+  if(!USE_SIMD)
+    return;
+#if HAVE_SSE2
+  findText = findSSE2;
+#endif
+#if HAVE_AVX2
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    findText = findAVX2;
+#endif
+}
+
+// initNames: set up an empty name blob.
+void initNames(NAMEBLOB * names) {
+  names->blob = NULL;
+  names->blobSize = 0;
+  names->offset = NULL;
+  names->capacity = 0;
+  names->length = 0;
+  names->list = NULL;
+  names->generation = 0;
+}
+
+// freeNames: give the blob back to the system.
+void freeNames(NAMEBLOB * names) {
+  free(names->blob);
+  free(names->offset);
+  initNames(names);
+}
+
+/* packNames: pack the names of list, unless they already are. */
+/* offset[n] is where name n starts; offset[length] is the end. */
+/* Returns -1 if out of memory. */
+int packNames(NAMEBLOB * names, LISTDATA * list) {
+  size_t  used = 0, len, newSize;
+  unsigned i;
+  char   *name, *out;
+  void   *ptr;
+
+  if(names->list == list && names->generation == list->generation
+     && names->length == list->length && names->offset != NULL)
+    return 0;
+  if(names->capacity < list->length + 1) {
+    ptr = realloc(names->offset, (list->length + 1) * sizeof(size_t));
+    if(ptr == NULL)
+      return -1;
+    names->offset = (size_t *) ptr;
+    names->capacity = list->length + 1;
+  }
+  names->length = 0;
+  for(i = 0; i < list->length; i++) {
+    name = listPath(list, i);
+    len = strlen(name) + 1;
+    if(used + len > names->blobSize) {
+      newSize = (names->blobSize == 0) ? STORE_MIN_BLOB : names->blobSize;
+      while(used + len > newSize)
+	newSize = newSize * 2;
+      ptr = realloc(names->blob, newSize);
+      if(ptr == NULL)
+	return -1;
+      names->blob = (char *)ptr;
+      names->blobSize = newSize;
+    }
+    names->offset[i] = used;
+    out = names->blob + used;
+    while(*name != '\0')
+      *out++ = (char)tolower((unsigned char)*name++);
+    *out = '\0';
+    used = used + len;
+  }
+  names->offset[list->length] = used;
+  names->length = list->length;
+  names->list = list;
+  names->generation = list->generation;
+  return 0;
+}
+
+/* fuzzyScore: fzf-style score of the match of text[0..len) in name, */
+/* whose first match ends at "end". The tightest match ending there   */
+/* is found by walking back; it then earns points per character, more */
+/* at the start of a word or right after the previous character, and  */
+/* loses some for every gap.                                          */
+int fuzzyScore(const char *name, const char *text, unsigned len,
+	       unsigned end) {
+  int     score = 0, i, start, gap = 0, prevMatch = 0;
+  unsigned k;
+
+  //Walk back from the end to the latest start.
+  k = len;
+  for(i = (int)end; i >= 0 && k > 0; i--)
+    if(name[i] == text[k - 1])
+      k--;
+  start = i + 1;
+
+  k = 0;
+  for(i = start; i <= (int)end && k < len; i++) {
+    if(name[i] == text[k]) {
+      score = score + SCORE_MATCH;
+      if(i == 0 || WORD_BREAK(name[i - 1]))
+	score = score + SCORE_WORD;
+      if(prevMatch)
+	score = score + SCORE_CONSECUTIVE;
+      gap = 0;
+      prevMatch = 1;
+      k++;
+    } else {
+      score = score - (gap == 0 ? SCORE_GAP_START : SCORE_GAP);
+      gap++;
+      prevMatch = 0;
+    }
+  }
+  return score;
+}
+
+/* rankHits: order hits by score, best first. Scores span a small */
+/* range, so this is a counting sort; it is stable, and ties keep the */
+/* order of the level before (list order at level 1). */
+/* Returns -1 if out of memory. */
+int rankHits(HIT * hits, unsigned count) {
+  int     low = hits[0].score, high = hits[0].score;
+  unsigned i, *slot, total = 0, n;
+  HIT    *sorted;
+
+  for(i = 1; i < count; i++) {
+    if(hits[i].score < low)
+      low = hits[i].score;
+    if(hits[i].score > high)
+      high = hits[i].score;
+  }
+  if(low == high)
+    return 0;
+  slot = (unsigned *)calloc(high - low + 1, sizeof(unsigned));
+  sorted = (HIT *) malloc(count * sizeof(HIT));
+  if(slot == NULL || sorted == NULL) {
+    free(slot);
+    free(sorted);
+    return -1;
+  }
+  for(i = 0; i < count; i++)
+    slot[high - hits[i].score]++;
+  for(i = 0; i <= (unsigned)(high - low); i++) {
+    n = slot[i];
+    slot[i] = total;
+    total = total + n;
+  }
+  for(i = 0; i < count; i++)
+    sorted[slot[high - hits[i].score]++] = hits[i];
+  memcpy(hits, sorted, count * sizeof(HIT));
+  free(slot);
+  free(sorted);
+  return 0;
+}
+
+/* ---------------------- */
+/* Filter routines        */
+/* ---------------------- */
+/* Typing narrows the list. Level n holds the items whose name matches */
+/* the first n characters typed; every match of level n+1 is a match   */
+/* of level n, so a keystroke only rescans the previous level and      */
+/* Backspace just drops back one level. Each hit keeps where its match */
+/* is, so one more character is mostly a single comparison per item.   */
+/* Level 1 comes from one SIMD pass over the packed names. In fuzzy    */
+/* mode the characters only have to appear in order, and every level   */
+/* is ranked by score.                                                 */
+/* A level is built by a job split into chunks for the thread pool.    */
+/* The UI merges finished chunks in order (filterPump), so the view   */
+/* grows while the rest is still being searched, and characters typed */
+/* meanwhile wait for their turn in text[length + 1..typed).           */
+
+// initFilter: set up an empty filter. Levels are allocated on demand.
+void initFilter(FILTER * filter) {
+  unsigned i;
+  filter->length = 0;
+  filter->typed = 0;
+  filter->text[0] = '\0';
+  filter->mode = FILTER_MODE;
+  filter->job = NULL;
+  filter->pool = NULL;
+  for(i = 0; i <= MAX_FILTER; i++) {
+    filter->hits[i] = NULL;
+    filter->count[i] = 0;
+    filter->capacity[i] = 0;
+  }
+  initNames(&filter->names);
+  if(findText == NULL)
+    initMatcher();
+}
+
+// clearFilter: forget the text typed. Level memory is kept for reuse.
+void clearFilter(FILTER * filter) {
+  filterCancel(filter);
+  filter->length = 0;
+  filter->typed = 0;
+  filter->text[0] = '\0';
+}
+
+// freeFilter: give the level arrays back to the system.
+void freeFilter(FILTER * filter) {
+  unsigned i;
+  filterCancel(filter);
+  for(i = 0; i <= MAX_FILTER; i++)
+    free(filter->hits[i]);
+  freeNames(&filter->names);
+  initFilter(filter);
+}
+
+/* matchRange: build hits a..b-1 of level "level" into out: items a..b-1 */
+/* for level 1, hits a..b-1 of the level before otherwise. Only reads  */
+/* the filter, so chunks can run on several threads at once. */
+/* Returns the no. of hits. */
+unsigned matchRange(FILTER * filter, unsigned level, unsigned a,
+		    unsigned b, HIT * out) {
+  NAMEBLOB *names = &filter->names;
+  HIT    *prev = filter->hits[level - 1];
+  unsigned count = 0, i, item;
+  size_t  pos, start, end;
+  const char *at;
+  char    ch = filter->text[level - 1];
+
+  if(level == 1) {
+    //One pass over the blob; after a hit, skip to the next name.
+    pos = names->offset[a];
+    item = a;
+    while((pos = findText(names->blob, pos, names->offset[b],
+			  filter->text, 1)) != NO_MATCH) {
+      while(names->offset[item + 1] <= pos)
+	item++;
+      out[count].item = item;
+      out[count].where = pos - names->offset[item];
+      out[count++].score = 0;
+      pos = names->offset[item + 1];
+    }
+    return count;
+  }
+  for(i = a; i < b; i++) {
+    item = prev[i].item;
+    start = names->offset[item];
+    end = names->offset[item + 1] - 1;	//The '\0' after the name
+    if(filter->mode == FILTER_FUZZY) {
+      //The new character has to come after the previous ones.
+      at = (const char *)memchr(names->blob + start + prev[i].where + 1,
+				ch, end - (start + prev[i].where + 1));
+      pos = (at == NULL) ? NO_MATCH : (size_t)(at - names->blob);
+    } else if(names->blob[start + prev[i].where + level - 1] == ch) {
+      //Usually the old match just goes on with the new character.
+      pos = start + prev[i].where;
+    } else
+      pos = findText(names->blob, start + prev[i].where + 1, end,
+		     filter->text, level);
+    if(pos != NO_MATCH) {
+      out[count].item = item;
+      out[count].where = pos - start;
+      out[count++].score = 0;
+    }
+  }
+  return count;
+}
+
+// filterChunk: run one chunk of a job (on a worker or inline).
+void filterChunk(FILTERJOB * job, unsigned chunk) {
+  FILTER *filter = job->filter;
+  unsigned a = chunk * job->chunkSize;
+  unsigned b = (a + job->chunkSize < job->from) ? a + job->chunkSize :
+      job->from;
+  unsigned i, count;
+  HIT    *out;
+
+  out = (HIT *) malloc((b - a) * sizeof(HIT));
+  if(out == NULL) {
+    job->failed = 1;
+    return;
+  }
+  count = matchRange(filter, job->level, a, b, out);
+  if(filter->mode == FILTER_FUZZY)
+    for(i = 0; i < count; i++)
+      out[i].score =
+	  fuzzyScore(filter->names.blob +
+		     filter->names.offset[out[i].item], filter->text,
+		     job->level, out[i].where);
+  job->out[chunk] = out;
+  job->outCount[chunk] = count;
+}
+
+// filterTask: pool task running one chunk of a job.
+void filterTask(void *data, unsigned chunk) {
+  FILTERJOB *job = (FILTERJOB *) data;
+  POOL   *pool = job->filter->pool;	//Job may be gone once finished
+  char    byte = 0;
+  if(!__atomic_load_n(&job->cancelled, __ATOMIC_ACQUIRE))
+    filterChunk(job, chunk);
+  __atomic_store_n(&job->done[chunk], 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&job->finished, 1, __ATOMIC_ACQ_REL);
+  if(write(pool->notify[1], &byte, 1) < 0) {
+    //Pipe full: the UI has wake-ups pending already.
+  }
+}
+
+// freeJob: give a finished job back to the system.
+void freeJob(FILTERJOB * job) {
+  unsigned i;
+  for(i = 0; i < job->chunks; i++)
+    free(job->out[i]);
+  free(job->out);
+  free(job->outCount);
+  free(job->done);
+  free(job);
+}
+
+/* filterCancel: stop the level being built. Tasks not started are */
+/* skipped; the ones running are chunk-sized, so this waits very little. */
+void filterCancel(FILTER * filter) {
+  FILTERJOB *job = filter->job;
+  char    drain[64];
+  if(job == NULL)
+    return;
+  __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELEASE);
+  while(__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE) < job->chunks)
+    sched_yield();
+  freeJob(job);
+  filter->job = NULL;
+  if(filter->pool != NULL)
+    while(read(filter->pool->notify[0], drain, sizeof(drain)) > 0);
+}
+
+/* filterStart: start building level length+1 from text[length]. */
+/* Without a pool the chunks run here and the level is finished at */
+/* once. Returns -1 if out of memory. */
+int filterStart(FILTER * filter, LISTDATA * list) {
+  FILTERJOB *job;
+  unsigned level = filter->length + 1, i;
+  void   *ptr;
+
+  if(filter->job != NULL || filter->length == filter->typed)
+    return 0;
+  if(packNames(&filter->names, list) != 0)
+    return -1;
+  job = (FILTERJOB *) calloc(1, sizeof(FILTERJOB));
+  if(job == NULL)
+    return -1;
+  job->filter = filter;
+  job->level = level;
+  job->from = (level == 1) ? filter->names.length : filter->count[level - 1];
+  job->chunkSize = CHUNK_ITEMS;
+  if(job->from / job->chunkSize >= MAX_CHUNKS)
+    job->chunkSize = job->from / MAX_CHUNKS + 1;
+  job->chunks = (job->from + job->chunkSize - 1) / job->chunkSize;
+  job->out = (HIT **) calloc(job->chunks + 1, sizeof(HIT *));
+  job->outCount = (unsigned *)calloc(job->chunks + 1, sizeof(unsigned));
+  job->done = (int *)calloc(job->chunks + 1, sizeof(int));
+  if(job->out == NULL || job->outCount == NULL || job->done == NULL) {
+    freeJob(job);
+    return -1;
+  }
+  if(filter->capacity[level] < job->from) {
+    ptr = realloc(filter->hits[level], job->from * sizeof(HIT));
+    if(ptr == NULL) {
+      freeJob(job);
+      return -1;
+    }
+    filter->hits[level] = (HIT *) ptr;
+    filter->capacity[level] = job->from;
+  }
+  filter->job = job;
+  if(filter->pool == NULL) {
+    for(i = 0; i < job->chunks; i++) {
+      filterChunk(job, i);
+      job->done[i] = 1;
+    }
+    job->finished = job->chunks;
+    filterPump(filter);
+  } else
+    for(i = 0; i < job->chunks; i++)
+      if(poolSubmit(filter->pool, filterTask, job, i) != 0)
+	filterTask(job, i);	//Rings full: searched here, counted the same
+  return 0;
+}
+
+/* filterFinish: the level being built is complete. With no hits its */
+/* character is dropped; otherwise the level is ranked (fuzzy) and    */
+/* takes over. The next character waiting, if any, is started. */
+int filterFinish(FILTER * filter) {
+  FILTERJOB *job = filter->job;
+  unsigned level = job->level;
+  unsigned hits = job->hits;
+  int     failed = job->failed;
+
+  freeJob(job);
+  filter->job = NULL;
+  if(hits == 0 || failed) {
+    //Drop the character; the ones typed after it move up.
+    memmove(filter->text + level - 1, filter->text + level,
+	    filter->typed - level + 1);
+    filter->typed--;
+  } else {
+    if(filter->mode == FILTER_FUZZY
+       && rankHits(filter->hits[level], hits) != 0)
+      return -1;
+    filter->count[level] = hits;
+    filter->length = level;
+  }
+  return 0;
+}
+
+/* filterPump: copy the chunks finished, in order, into the level being */
+/* built. Returns VIEW_GROWN if hits were added to the end of the view, */
+/* VIEW_CHANGED if the view has to be set up again and VIEW_SAME. */
+int filterPump(FILTER * filter) {
+  FILTERJOB *job = filter->job;
+  char    drain[64];
+  int     view = VIEW_SAME, shown;
+  LISTDATA *list;
+
+  if(filter->pool != NULL)
+    while(read(filter->pool->notify[0], drain, sizeof(drain)) > 0);
+  if(job == NULL)
+    return VIEW_SAME;
+  shown = (job->hits > 0);
+  while(job->merged < job->chunks
+	&& __atomic_load_n(&job->done[job->merged], __ATOMIC_ACQUIRE)) {
+    if(job->outCount[job->merged] > 0) {
+      memcpy(filter->hits[job->level] + job->hits, job->out[job->merged],
+	     job->outCount[job->merged] * sizeof(HIT));
+      job->hits = job->hits + job->outCount[job->merged];
+      view = VIEW_GROWN;
+    }
+    free(job->out[job->merged]);
+    job->out[job->merged] = NULL;
+    job->merged++;
+  }
+  //The view switches to the new level with its first hits.
+  if(view == VIEW_GROWN && !shown)
+    view = VIEW_CHANGED;
+  //The job is let go once no task touches it any more.
+  if(job->merged == job->chunks
+     && __atomic_load_n(&job->finished, __ATOMIC_ACQUIRE) == job->chunks) {
+    //Fuzzy levels are reordered once they are complete.
+    if(filter->mode == FILTER_FUZZY || job->hits == 0)
+      view = VIEW_CHANGED;
+    list = filter->names.list;
+    filterFinish(filter);
+    filterStart(filter, list);
+  }
+  return view;
+}
+
+/* filterWait: let the search finish, characters queued included. */
+/* Returns VIEW_CHANGED if the view changed on the way, else VIEW_GROWN */
+/* or VIEW_SAME. */
+int filterWait(FILTER * filter) {
+  struct pollfd pfd;
+  int     view, result = VIEW_SAME;
+  while(filter->job != NULL) {
+    if(__atomic_load_n(&filter->job->finished, __ATOMIC_ACQUIRE) <
+       filter->job->chunks) {
+      pfd.fd = filter->pool->notify[0];
+      pfd.events = POLLIN;
+      poll(&pfd, 1, -1);	//Until a task finishes
+    }
+    view = filterPump(filter);
+    if(view > result)
+      result = view;
+  }
+  return result;
+}
+
+/* filterAdd: refine the filter with one more character. The search  */
+/* runs in the background; characters typed meanwhile are queued.    */
+/* Returns 1 if the character was dropped at once (nothing matches or */
+/* the text is full), 0 otherwise and -1 if out of memory. */
+int filterAdd(FILTER * filter, LISTDATA * list, char ch) {
+  unsigned typed;
+  if(filter->typed == MAX_FILTER)
+    return 1;
+  filter->text[filter->typed++] = (char)tolower((unsigned char)ch);
+  filter->text[filter->typed] = '\0';
+  typed = filter->typed;
+  if(filterStart(filter, list) != 0)
+    return -1;
+  return (filter->typed < typed);
+}
+
+/* filterBack: drop the last character typed. */
+void filterBack(FILTER * filter) {
+  if(filter->typed == 0)
+    return;
+  if(filter->typed == filter->length)
+    filter->length--;		//Complete level: O(1)
+  else if(filter->typed == filter->length + 1)
+    filterCancel(filter);	//Level being built
+  filter->typed--;
+  filter->text[filter->typed] = '\0';
+}
+
+/* filterMode: switch between substring and fuzzy matching and run */
+/* the text typed so far again. Returns -1 if out of memory. */
+int filterMode(FILTER * filter, LISTDATA * list) {
+  filter->mode = (filter->mode == FILTER_FUZZY) ? FILTER_SUBSTRING :
+      FILTER_FUZZY;
+  return filterRestart(filter, list);
+}
+
+/* filterRestart: run the text typed so far again from level 1, for */
+/* a list that has changed. Returns -1 if out of memory. */
+int filterRestart(FILTER * filter, LISTDATA * list) {
+  filterCancel(filter);
+  filter->length = 0;
+  return filterStart(filter, list);
+}
+
+/* viewLength: no. of items on view, filtered or not. */
+unsigned viewLength(SCROLLDATA * scrollData) {
+  FILTER *filter = scrollData->filter;
+  if(filter != NULL && filter->job != NULL && filter->job->hits > 0)
+    return filter->job->hits;	//Level being built, as far as merged
+  if(filter == NULL || filter->length == 0)
+    return query_length(scrollData->list);
+  return filter->count[filter->length];
+}
+
+/* viewItem: item number of the item at position aux of the view. */
+unsigned viewItem(SCROLLDATA * scrollData, unsigned aux) {
+  FILTER *filter = scrollData->filter;
+  if(filter != NULL && filter->job != NULL && filter->job->hits > 0)
+    return filter->hits[filter->job->level][aux].item;
+  if(filter == NULL || filter->length == 0)
+    return aux;
+  return filter->hits[filter->length][aux].item;
+}
+
+/* viewFind: position of item number "item" in the view; viewLength() */
+/* if it is not on view. */
+unsigned viewFind(SCROLLDATA * scrollData, unsigned item) {
+  unsigned length = viewLength(scrollData), i;
+  for(i = 0; i < length; i++)
+    if(viewItem(scrollData, i) == item)
+      break;
+  return i;
+}
+
+/* ---------------------- */
+/* Batched stat routines  */
+/* ---------------------- */
+/* Metadata of many entries (sort keys, columns) is asked for in one */
+/* go. With io_uring (-u) up to URING_ENTRIES statx() requests are    */
+/* sent with one io_uring_enter() call; the kernel runs them side by  */
+/* side on its own workers and we wait once per batch, not once per  */
+/* entry. That pays off where a stat is slow (network mounts, cold    */
+/* disks) but costs a handoff per entry where it is not, so it is     */
+/* opt-in. Otherwise, or if io_uring is missing or turned down,       */
+/* entries are stat'ed one by one; callers already spread big jobs    */
+/* over the thread pool. Names are relative to dirFd.                 */
+
+/* uringOpen: set up an io_uring instance of "entries" requests. */
+/* Returns -1 if there is none to be had; statMany() then works */
+/* without it. */
+int uringOpen(URING * ring, unsigned entries) {
+#if USE_URING
+  struct io_uring_params params;
+  char   *sq, *cq;
+#endif
+  ring->fd = -1;
+  ring->entries = 0;
+  ring->sqRing = NULL;
+  ring->cqRing = NULL;
+  ring->sqes = NULL;
+  ring->stx = NULL;
+#if USE_URING
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(SYS_io_uring_setup, entries, &params);
+  if(ring->fd < 0) {
+    ring->fd = -1;
+    return -1;
+  }
+  ring->sqRingSize = params.sq_off.array +
+      params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes +
+      params.cq_entries * sizeof(struct io_uring_cqe);
+  if(params.features & IORING_FEAT_SINGLE_MMAP) {
+    if(ring->cqRingSize > ring->sqRingSize)
+      ring->sqRingSize = ring->cqRingSize;
+    ring->cqRingSize = ring->sqRingSize;
+  }
+  sq = (char *)mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if(sq == MAP_FAILED) {
+    uringClose(ring);
+    return -1;
+  }
+  ring->sqRing = sq;
+  cq = sq;
+  if(!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = (char *)mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring->fd,
+		      IORING_OFF_CQ_RING);
+    if(cq == MAP_FAILED) {
+      uringClose(ring);
+      return -1;
+    }
+  }
+  ring->cqRing = cq;
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if(ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    uringClose(ring);
+    return -1;
+  }
+  ring->stx = malloc(params.sq_entries * sizeof(struct statx));
+  if(ring->stx == NULL) {
+    uringClose(ring);
+    return -1;
+  }
+  ring->entries = params.sq_entries;
+  ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+  ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+  ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = cq + params.cq_off.cqes;
+  return 0;
+#else
+  (void)entries;
+  return -1;
+#endif
+}
+
+// uringClose: give the io_uring instance back to the system.
+void uringClose(URING * ring) {
+#if USE_URING
+  if(ring->sqes != NULL)
+    munmap(ring->sqes, ring->sqesSize);
+  if(ring->cqRing != NULL && ring->cqRing != ring->sqRing)
+    munmap(ring->cqRing, ring->cqRingSize);
+  if(ring->sqRing != NULL)
+    munmap(ring->sqRing, ring->sqRingSize);
+  if(ring->fd >= 0)
+    close(ring->fd);
+#endif
+  free(ring->stx);
+  ring->fd = -1;
+  ring->entries = 0;
+  ring->sqRing = NULL;
+  ring->cqRing = NULL;
+  ring->sqes = NULL;
+  ring->stx = NULL;
+}
+
+#if USE_STATX
+void statxInfo(STATINFO * info, const struct statx *stx) {
+//Copies what statMany() reports out of a statx() result.
+  info->size = (long long)stx->stx_size;
+  info->mtime = (long long)stx->stx_mtime.tv_sec * 1000000000LL +
+      stx->stx_mtime.tv_nsec;
+  info->mode = stx->stx_mode;
+  info->uid = stx->stx_uid;
+  info->ok = 1;
+}
+#endif
+
+/* statOne: stat a single entry, following symlinks. */
+/* Returns -1 (info->ok == 0) if it could not be stat'ed. */
+int statOne(int dirFd, const char *name, STATINFO * info) {
+#if USE_STATX
+  struct statx stx;
+  info->ok = 0;
+  if(statx(dirFd, name, AT_STATX_SYNC_AS_STAT, STATINFO_MASK, &stx) != 0)
+    return -1;
+  statxInfo(info, &stx);
+#else
+  struct stat st;
+  info->ok = 0;
+  if(fstatat(dirFd, name, &st, 0) != 0)
+    return -1;
+  info->size = (long long)st.st_size;
+  info->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL +
+      st.st_mtim.tv_nsec;
+  info->mode = st.st_mode;
+  info->uid = st.st_uid;
+  info->ok = 1;
+#endif
+  return 0;
+}
+
+/* statMany: stat entries names[0..count-1] into info[], through */
+/* "ring" in batches if it is open (ring may be NULL). A ring the */
+/* kernel turns down is closed and the rest done one by one.     */
+/* Returns the no. of entries stat'ed. */
+unsigned statMany(URING * ring, int dirFd, const char **names,
+		  unsigned count, STATINFO * info) {
+  unsigned stated = 0, i;
+#if USE_URING
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  struct statx *stx;
+  unsigned done = 0, n, tail, head, got, submit, mask, want;
+  int     res, refused = 0, failed;
+#endif
+
+  for(i = 0; i < count; i++)
+    info[i].ok = -1;		//Not back yet
+#if USE_URING
+  while(ring != NULL && ring->fd >= 0 && done < count && !refused) {
+    n = (count - done < ring->entries) ? count - done : ring->entries;
+    stx = (struct statx *)ring->stx;
+    mask = *ring->sqMask;
+    tail = *ring->sqTail;
+    for(i = 0; i < n; i++) {
+      sqe = (struct io_uring_sqe *)ring->sqes + (tail & mask);
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dirFd;
+      sqe->addr = (unsigned long)names[done + i];
+      sqe->len = STATINFO_MASK;
+      sqe->off = (unsigned long)&stx[i];
+      sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+      sqe->user_data = i;
+      ring->sqArray[tail & mask] = tail & mask;
+      tail++;
+    }
+    __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+    //Send the batch and wait for all of it. After a failed call the
+    //requests not sent yet are given up, and only those the kernel
+    //took are waited for: they write to stx.
+    got = 0;
+    submit = n;
+    failed = 0;
+    while(got < (want = failed ? n - submit : n)) {
+      res = (int)syscall(SYS_io_uring_enter, ring->fd, failed ? 0 : submit,
+			 want - got, IORING_ENTER_GETEVENTS, NULL, 0);
+      if(res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+	if(failed)
+	  break;		//Can't even wait: see below
+	failed = 1;
+	submit = tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	continue;
+      }
+      if(res > 0 && !failed)
+	submit = submit - (((unsigned)res < submit) ? (unsigned)res : submit);
+      head = *ring->cqHead;
+      while(head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+	cqe = (struct io_uring_cqe *)ring->cqes + (head & *ring->cqMask);
+	i = (unsigned)cqe->user_data;
+	if(cqe->res == 0) {
+	  statxInfo(&info[done + i], &stx[i]);
+	  stated++;
+	} else if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+	  refused = 1;		//No statx() through io_uring: left to do
+	else
+	  info[done + i].ok = 0;
+	head++;
+	got++;
+      }
+      __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    if(got < n)
+      refused = 1;		//Requests lost in a failed call
+    if(got < n - submit)
+      ring->stx = NULL;		//Still out: left to the kernel, never freed
+    done = done + n;
+  }
+  if(refused)
+    uringClose(ring);		//Nothing is out on it any more
+#endif
+  //Entries without a result, or no ring at all.
+  for(i = 0; i < count; i++)
+    if(info[i].ok < 0 && statOne(dirFd, names[i], &info[i]) == 0)
+      stated++;
+  return stated;
+}
+
+/* ---------------------- */
+/* Sort routines          */
+/* ---------------------- */
+/* Listings come in directory order; a sort mode puts them in order   */
+/* by name (byte order, natural or locale), size, mtime or extension, */
+/* "." and ".." first and directories before files. The list itself  */
+/* is reordered, so the filter, the item numbers and the cache work   */
+/* on the sorted list as on any other.                                */
+/* Keys are worked out once per entry of a listing and kept: names in */
+/* lower case, strxfrm() keys, and size and mtime. Switching modes    */
+/* only computes what the new mode is missing. Most comparisons are   */
+/* settled by the group and the first 8 bytes of the key, packed in   */
+/* one array per sort, without reaching the strings.                  */
+/* Sorting is done in phases of one task per chunk on the thread pool. */
+/* Phase 0 keys a chunk and sorts it; every phase after merges pairs  */
+/* of sorted runs, each task producing one chunk of the output, until */
+/* one run is left. After phase 0 the top SORT_TOP entries are picked */
+/* off the runs and shown, so the first screen does not wait for the  */
+/* merges. The list is put in full order when the last phase is done. */
+
+// initSorter: set up a sorter with nothing keyed yet.
+void initSorter(SORTER * sort) {
+  unsigned i;
+  sort->mode = SORT_MODE;
+  sort->shown = SORT_NONE;
+  sort->list = NULL;
+  sort->generation = 0;
+  sort->length = 0;
+  sort->current = NULL;
+  sort->keys = NULL;
+  sort->chunkSize = 0;
+  sort->chunks = 0;
+  sort->fold = NULL;
+  sort->xfrm = NULL;
+  sort->keyed = NULL;
+  sort->job = NULL;
+  sort->pool = NULL;
+  sort->uring = 0;
+  memset(sort->rings, 0, sizeof(sort->rings));
+  for(i = 0; i <= MAX_THREADS; i++) {
+    sort->rings[i].fd = -1;
+    sort->ringBusy[i] = 0;
+  }
+  pthread_mutex_init(&sort->ringLock, NULL);
+  sort->dirFd = AT_FDCWD;
+  if(pipe(sort->notify) != 0) {
+    sort->notify[0] = -1;
+    sort->notify[1] = -1;
+    return;
+  }
+  fcntl(sort->notify[0], F_SETFL, O_NONBLOCK);
+  fcntl(sort->notify[1], F_SETFL, O_NONBLOCK);
+}
+
+// freeKeys: forget the keys of the listing sorted last.
+void freeKeys(SORTER * sort) {
+  unsigned i;
+  for(i = 0; i < sort->chunks; i++) {
+    free(sort->fold[i]);
+    free(sort->xfrm[i]);
+  }
+  free(sort->fold);
+  free(sort->xfrm);
+  free(sort->keyed);
+  free(sort->keys);
+  free(sort->current);
+  sort->fold = NULL;
+  sort->xfrm = NULL;
+  sort->keyed = NULL;
+  sort->keys = NULL;
+  sort->current = NULL;
+  sort->chunks = 0;
+  sort->length = 0;
+  sort->list = NULL;
+}
+
+// freeSorter: stop the sort and give everything back to the system.
+void freeSorter(SORTER * sort) {
+  unsigned i;
+  sortCancel(sort);
+  freeKeys(sort);
+  for(i = 0; i <= MAX_THREADS; i++)
+    uringClose(&sort->rings[i]);
+  pthread_mutex_destroy(&sort->ringLock);
+  if(sort->notify[0] >= 0) {
+    close(sort->notify[0]);
+    close(sort->notify[1]);
+  }
+}
+
+/* sortTake: take a new listing as it was first listed. Names and */
+/* kinds are noted here; the keys are left to the tasks. */
+/* Returns -1 if out of memory. */
+int sortTake(SORTER * sort, LISTDATA * list) {
+  unsigned n = list->length, i;
+  const char *name;
+
+  freeKeys(sort);
+  sort->chunkSize = CHUNK_ITEMS;
+  if(n / sort->chunkSize >= MAX_CHUNKS)
+    sort->chunkSize = n / MAX_CHUNKS + 1;
+  sort->chunks = (n + sort->chunkSize - 1) / sort->chunkSize;
+  sort->current = (unsigned *)malloc((n + 1) * sizeof(unsigned));
+  sort->keys = (SORTKEY *) malloc((n + 1) * sizeof(SORTKEY));
+  sort->fold = (char **)calloc(sort->chunks + 1, sizeof(char *));
+  sort->xfrm = (char **)calloc(sort->chunks + 1, sizeof(char *));
+  sort->keyed = (unsigned char *)calloc(sort->chunks + 1, 1);
+  if(sort->current == NULL || sort->keys == NULL || sort->fold == NULL
+     || sort->xfrm == NULL || sort->keyed == NULL) {
+    freeKeys(sort);
+    return -1;
+  }
+  for(i = 0; i < n; i++) {
+    name = listPath(list, i);
+    sort->current[i] = i;
+    sort->keys[i].name = name;
+    if(strcmp(name, CURRENTDIR) == 0 || strcmp(name, CHANGEDIR) == 0)
+      sort->keys[i].group = 0;
+    else
+      sort->keys[i].group = (listType(list, i) == DIRECTORY) ? 1 : 2;
+  }
+  sort->length = n;
+  sort->list = list;
+  sort->generation = list->generation;
+  sort->shown = SORT_NONE;
+  return 0;
+}
+
+/* sortRing: an io_uring for the stat batches of one task, opened */
+/* the first time and kept for the next tasks and sorts. NULL if  */
+/* -u is off or none can be had. */
+URING  *sortRing(SORTER * sort) {
+  URING  *ring = NULL;
+  unsigned i;
+  pthread_mutex_lock(&sort->ringLock);
+  for(i = 0; i <= MAX_THREADS && sort->uring && ring == NULL; i++)
+    if(!sort->ringBusy[i] && (sort->rings[i].fd >= 0
+			      || uringOpen(&sort->rings[i],
+					   URING_ENTRIES) == 0)) {
+      sort->ringBusy[i] = 1;
+      ring = &sort->rings[i];
+    } else if(!sort->ringBusy[i])
+      sort->uring = 0;		//No io_uring here: don't ask again
+  pthread_mutex_unlock(&sort->ringLock);
+  return ring;
+}
+
+/* sortRingDone: give back a ring from sortRing(). One the kernel */
+/* turned down (statMany() closed it) turns io_uring off. */
+void sortRingDone(SORTER * sort, URING * ring) {
+  pthread_mutex_lock(&sort->ringLock);
+  if(ring->fd < 0)
+    sort->uring = 0;
+  sort->ringBusy[ring - sort->rings] = 0;
+  pthread_mutex_unlock(&sort->ringLock);
+}
+
+/* sortKeyChunk: work out the keys chunk "chunk" is missing for mode. */
+/* Names are read through the pointers noted by sortTake(), which stay */
+/* put while the list is reordered. Returns -1 if out of memory. */
+int sortKeyChunk(SORTER * sort, unsigned chunk, int mode) {
+  unsigned a = chunk * sort->chunkSize, b = a + sort->chunkSize, i, n;
+  unsigned char need = SORTKEY_FOLD;
+  size_t  size = 0, used = 0, len, newSize;
+  size_t *offset;
+  const char **names;
+  STATINFO *info;
+  URING  *ring;
+  const char *name;
+  char   *out, *start, *slash, *base, *dot;
+  void   *ptr;
+
+  if(b > sort->length)
+    b = sort->length;
+  if(mode == SORT_LOCALE)
+    need |= SORTKEY_XFRM;
+  if(mode == SORT_SIZE || mode == SORT_MTIME)
+    need |= SORTKEY_STAT;
+  need &= (unsigned char)~sort->keyed[chunk];
+
+  if(need & SORTKEY_FOLD) {
+    for(i = a; i < b; i++)
+      size = size + strlen(sort->keys[i].name) + 1;
+    out = (char *)malloc(size + 1);
+    if(out == NULL)
+      return -1;
+    sort->fold[chunk] = out;
+    for(i = a; i < b; i++) {
+      start = out;
+      for(name = sort->keys[i].name; *name != '\0'; name++)
+	*out++ = (char)tolower((unsigned char)*name);
+      *out++ = '\0';
+      sort->keys[i].fold = start;
+      //Extension of the last part of the path, if any.
+      slash = strrchr(start, '/');
+      base = (slash == NULL) ? start : slash + 1;
+      dot = strrchr(base, '.');
+      if(dot == NULL || dot == base)
+	sort->keys[i].ext = (unsigned)(out - 1 - start);
+      else
+	sort->keys[i].ext = (unsigned)(dot + 1 - start);
+    }
+  }
+
+  if(need & SORTKEY_XFRM) {
+    //Keys are written where they fit; offsets survive the reallocs.
+    offset = (size_t *) malloc((b - a + 1) * sizeof(size_t));
+    if(offset == NULL)
+      return -1;
+    size = 0;
+    out = NULL;
+    for(i = a; i < b; i++) {
+      for(;;) {
+	len = strxfrm((out == NULL) ? NULL : out + used, sort->keys[i].name,
+		      (out == NULL) ? 0 : size - used) + 1;
+	if(out != NULL && used + len <= size)
+	  break;
+	newSize = (size == 0) ? STORE_MIN_BLOB : size;
+	while(used + len > newSize)
+	  newSize = newSize * 2;
+	ptr = realloc(out, newSize);
+	if(ptr == NULL) {
+	  free(out);
+	  free(offset);
+	  return -1;
+	}
+	out = (char *)ptr;
+	size = newSize;
+      }
+      offset[i - a] = used;
+      used = used + len;
+    }
+    sort->xfrm[chunk] = out;
+    for(i = a; i < b; i++)
+      sort->keys[i].xfrm = out + offset[i - a];
+    free(offset);
+  }
+
+  if(need & SORTKEY_STAT) {
+    //The chunk is stat'ed in batches ("." and ".." are not needed).
+    names = (const char **)malloc((b - a) * sizeof(char *));
+    info = (STATINFO *) malloc((b - a) * sizeof(STATINFO));
+    if(names == NULL || info == NULL) {
+      free(names);
+      free(info);
+      return -1;
+    }
+    n = 0;
+    for(i = a; i < b; i++)
+      if(sort->keys[i].group != 0)
+	names[n++] = sort->keys[i].name;
+    ring = sortRing(sort);
+    statMany(ring, sort->dirFd, names, n, info);
+    if(ring != NULL)
+      sortRingDone(sort, ring);
+    n = 0;
+    for(i = a; i < b; i++) {
+      //Entries gone since they were listed sort last.
+      sort->keys[i].size = -1;
+      sort->keys[i].mtime = -1;
+      if(sort->keys[i].group == 0)
+	continue;
+      if(info[n].ok) {
+	sort->keys[i].size = info[n].size;
+	sort->keys[i].mtime = info[n].mtime;
+      }
+      n++;
+    }
+    free(names);
+    free(info);
+  }
+  sort->keyed[chunk] |= need;
+  return 0;
+}
+
+/* naturalCompare: compare names with runs of digits taken as numbers, */
+/* so "f9" comes before "f10". */
+int naturalCompare(const char *a, const char *b) {
+  unsigned lenA, lenB;
+  int     r;
+  while(*a != '\0' && *b != '\0') {
+    if(isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+      while(*a == '0' && isdigit((unsigned char)a[1]))
+	a++;
+      while(*b == '0' && isdigit((unsigned char)b[1]))
+	b++;
+      for(lenA = 0; isdigit((unsigned char)a[lenA]); lenA++);
+      for(lenB = 0; isdigit((unsigned char)b[lenB]); lenB++);
+      if(lenA != lenB)
+	return (lenA < lenB) ? -1 : 1;
+      r = memcmp(a, b, lenA);
+      if(r != 0)
+	return r;
+      a = a + lenA;
+      b = b + lenB;
+      continue;
+    }
+    if(*a != *b)
+      return (unsigned char)*a - (unsigned char)*b;
+    a++;
+    b++;
+  }
+  return (unsigned char)*a - (unsigned char)*b;
+}
+
+/* sortPrefix: first 8 bytes of a key as a number, so that different */
+/* prefixes compare like the keys. "then" (if not NULL) is a second   */
+/* key, after the '\0' of text. A natural key has runs of digits as   */
+/* '0', the no. of digits and the digits, as naturalCompare() sees them. */
+unsigned long long sortPrefix(const char *text, const char *then,
+			      int natural) {
+  unsigned char bytes[8] = { 0 };
+  unsigned long long prefix = 0;
+  unsigned used = 0, digits, i;
+  while(used < 8 && *text != '\0') {
+    if(!natural || !isdigit((unsigned char)*text)) {
+      bytes[used++] = (unsigned char)*text++;
+      continue;
+    }
+    while(*text == '0' && isdigit((unsigned char)text[1]))
+      text++;
+    for(digits = 0; isdigit((unsigned char)text[digits]); digits++);
+    bytes[used++] = '0';
+    if(used < 8)
+      bytes[used++] = (digits < 255) ? digits : 255;
+    if(digits >= 255)
+      break;			//Longer than the prefix anyway
+    while(used < 8 && digits > 0) {
+      bytes[used++] = (unsigned char)*text++;
+      digits--;
+    }
+  }
+  if(then != NULL && *text == '\0' && used < 8)
+    for(used++; used < 8 && *then != '\0'; then++)
+      bytes[used++] = (unsigned char)*then;
+  for(i = 0; i < 8; i++)
+    prefix = (prefix << 8) | bytes[i];
+  return prefix;
+}
+
+/* sortRank: note the group and prefix of items from..to-1, so most */
+/* comparisons are settled without reaching the keys. */
+void sortRank(SORTJOB * job, unsigned from, unsigned to) {
+  SORTKEY *key;
+  unsigned i;
+  for(i = from; i < to; i++) {
+    key = &job->sort->keys[i];
+    job->rank[i].group = key->group;
+    switch (job->mode) {
+    case SORT_NATURAL:
+      job->rank[i].prefix = sortPrefix(key->fold, NULL, 1);
+      break;
+    case SORT_LOCALE:
+      job->rank[i].prefix = sortPrefix(key->xfrm, NULL, 0);
+      break;
+    case SORT_SIZE:		//Biggest first, unknown (-1) last
+      job->rank[i].prefix = (key->size < 0) ? ULLONG_MAX :
+	  (unsigned long long)(LLONG_MAX - key->size);
+      break;
+    case SORT_MTIME:
+      job->rank[i].prefix = (key->mtime < 0) ? ULLONG_MAX :
+	  (unsigned long long)(LLONG_MAX - key->mtime);
+      break;
+    case SORT_EXTENSION:
+      job->rank[i].prefix = sortPrefix(key->fold + key->ext, key->fold, 0);
+      break;
+    default:
+      job->rank[i].prefix = sortPrefix(key->fold, NULL, 0);
+    }
+  }
+}
+
+/* sortCompare: order of items a and b (first listed numbers) in the */
+/* job's mode. Never 0 for two items: ties go by directory order. */
+int sortCompare(SORTJOB * job, unsigned a, unsigned b) {
+  SORTKEY *x, *y;
+  int     r = 0;
+  if(job->rank[a].group != job->rank[b].group)
+    return (job->rank[a].group < job->rank[b].group) ? -1 : 1;
+  if(job->rank[a].prefix != job->rank[b].prefix)
+    return (job->rank[a].prefix < job->rank[b].prefix) ? -1 : 1;
+  x = &job->sort->keys[a];
+  y = &job->sort->keys[b];
+  if(x->group != 0)
+    switch (job->mode) {
+    case SORT_NATURAL:
+      r = naturalCompare(x->fold, y->fold);
+      break;
+    case SORT_LOCALE:
+      r = strcmp(x->xfrm, y->xfrm);
+      break;
+    case SORT_SIZE:		//Biggest first
+      if(x->size != y->size)
+	return (x->size > y->size) ? -1 : 1;
+      break;
+    case SORT_MTIME:		//Newest first
+      if(x->mtime != y->mtime)
+	return (x->mtime > y->mtime) ? -1 : 1;
+      break;
+    case SORT_EXTENSION:
+      r = strcmp(x->fold + x->ext, y->fold + y->ext);
+      break;
+    }
+  if(r == 0 && x->group != 0)
+    r = strcmp(x->fold, y->fold);
+  if(r != 0)
+    return r;
+  return (a < b) ? -1 : (a > b);
+}
+
+// mergeIds: merge sorted runs a and b into out.
+void mergeIds(SORTJOB * job, const unsigned *a, unsigned lenA,
+	      const unsigned *b, unsigned lenB, unsigned *out) {
+  unsigned i = 0, j = 0;
+  while(i < lenA && j < lenB)
+    *out++ = (sortCompare(job, a[i], b[j]) <= 0) ? a[i++] : b[j++];
+  memcpy(out, a + i, (lenA - i) * sizeof(unsigned));
+  memcpy(out + lenA - i, b + j, (lenB - j) * sizeof(unsigned));
+}
+
+/* sortRun: sort ids[0..n) with tmp as scratch. Short runs are sorted */
+/* by insertion, then merged bottom-up. */
+void sortRun(SORTJOB * job, unsigned *ids, unsigned *tmp, unsigned n) {
+  unsigned *src = ids, *dst = tmp, *swap;
+  unsigned width, low, mid, high, i, j, id;
+  for(low = 0; low < n; low = low + SORT_INSERT) {
+    high = (low + SORT_INSERT < n) ? low + SORT_INSERT : n;
+    for(i = low + 1; i < high; i++) {
+      id = ids[i];
+      for(j = i; j > low && sortCompare(job, ids[j - 1], id) > 0; j--)
+	ids[j] = ids[j - 1];
+      ids[j] = id;
+    }
+  }
+  for(width = SORT_INSERT; width < n; width = width * 2) {
+    for(low = 0; low < n; low = low + 2 * width) {
+      mid = (low + width < n) ? low + width : n;
+      high = (low + 2 * width < n) ? low + 2 * width : n;
+      mergeIds(job, src + low, mid - low, src + mid, high - mid, dst + low);
+    }
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if(src != ids)
+    memcpy(ids, src, n * sizeof(unsigned));
+}
+
+/* sortSplit: no. of items of run a among the first k of the merge */
+/* of runs a and b, found by binary search. */
+unsigned sortSplit(SORTJOB * job, const unsigned *a, unsigned lenA,
+		   const unsigned *b, unsigned lenB, unsigned k) {
+  unsigned low = (k > lenB) ? k - lenB : 0;
+  unsigned high = (k < lenA) ? k : lenA;
+  unsigned mid;
+  while(low < high) {
+    mid = low + (high - low) / 2;
+    if(sortCompare(job, a[mid], b[k - mid - 1]) > 0)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+  return low;
+}
+
+/* sortChunk: run one task of the phase (on a worker or inline). Phase */
+/* 0 keys and sorts chunk "chunk" of ids. After that, output chunk     */
+/* "chunk" of the merge of two runs of "width" items, ids into tmp.    */
+void sortChunk(SORTJOB * job, unsigned chunk) {
+  unsigned n = job->length, size = job->sort->chunkSize;
+  unsigned from = chunk * size, to, low, mid, high, i, first, last;
+  const unsigned *a, *b;
+
+  to = (from + size < n) ? from + size : n;
+  if(job->width == 0) {
+    if(sortKeyChunk(job->sort, chunk, job->mode) != 0) {
+      job->failed = 1;
+      return;
+    }
+    sortRank(job, from, to);
+    for(i = from; i < to; i++)
+      job->ids[i] = i;
+    sortRun(job, job->ids + from, job->tmp + from, to - from);
+    return;
+  }
+  //Runs a and b are merged into low..high; this task does from..to.
+  low = from / (2 * job->width) * (2 * job->width);
+  mid = (low + job->width < n) ? low + job->width : n;
+  high = (low + 2 * job->width < n) ? low + 2 * job->width : n;
+  a = job->ids + low;
+  b = job->ids + mid;
+  first = sortSplit(job, a, mid - low, b, high - mid, from - low);
+  last = sortSplit(job, a, mid - low, b, high - mid, to - low);
+  mergeIds(job, a + first, last - first, b + (from - low - first),
+	   (to - low - last) - (from - low - first), job->tmp + from);
+}
+
+// sortTask: pool task running one chunk of a phase.
+void sortTask(void *data, unsigned chunk) {
+  SORTJOB *job = (SORTJOB *) data;
+  int     fd = job->sort->notify[1];	//Job may be gone once finished
+  unsigned chunks = job->chunks;
+  char    byte = 0;
+  if(!__atomic_load_n(&job->cancelled, __ATOMIC_ACQUIRE))
+    sortChunk(job, chunk);
+  //The last task of the phase wakes the UI.
+  if(__atomic_add_fetch(&job->finished, 1, __ATOMIC_ACQ_REL) == chunks
+     && write(fd, &byte, 1) < 0) {
+    //Pipe full: the UI has a wake-up pending already.
+  }
+}
+
+// freeSortJob: give a finished job back to the system.
+void freeSortJob(SORTJOB * job) {
+  free(job->ids);
+  free(job->tmp);
+  free(job->rank);
+  free(job);
+}
+
+/* sortCancel: stop the sort running. Tasks not started are skipped; */
+/* the list stays in the order it was shown in last. */
+void sortCancel(SORTER * sort) {
+  SORTJOB *job = sort->job;
+  char    drain[64];
+  if(job == NULL)
+    return;
+  __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELEASE);
+  while(__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE) < job->chunks)
+    sched_yield();
+  freeSortJob(job);
+  sort->job = NULL;
+  while(read(sort->notify[0], drain, sizeof(drain)) > 0);
+}
+
+/* sortPhase: run the tasks of the job's phase: on the pool, or here */
+/* if there is none, only one task or the rings are full. The UI is  */
+/* woken once the phase is finished, wherever the last task ran.     */
+void sortPhase(SORTER * sort) {
+  SORTJOB *job = sort->job;
+  unsigned i;
+  char    byte = 0;
+  job->finished = 0;
+  for(i = 0; i < job->chunks; i++)
+    if(sort->pool == NULL || job->chunks <= 1
+       || poolSubmit(sort->pool, sortTask, job, i) != 0) {
+      sortChunk(job, i);
+      if(__atomic_add_fetch(&job->finished, 1, __ATOMIC_ACQ_REL) ==
+	 job->chunks && write(sort->notify[1], &byte, 1) < 0) {
+	//Pipe full: the UI has a wake-up pending already.
+      }
+    }
+}
+
+/* sortNext: the phase is finished; set up the next one. Returns 1 if */
+/* the runs are merged into one, in ids. */
+int sortNext(SORTJOB * job) {
+  unsigned *swap;
+  if(job->width > 0) {
+    swap = job->ids;		//Merged runs are in tmp
+    job->ids = job->tmp;
+    job->tmp = swap;
+    job->width = job->width * 2;
+  } else
+    job->width = job->sort->chunkSize;
+  return (job->width >= job->length);
+}
+
+/* sortPublish: put the list in the order given, as item numbers of */
+/* the listing as first listed. Returns -1 if out of memory. */
+int sortPublish(SORTER * sort, LISTDATA * list, const unsigned *order) {
+  unsigned n = sort->length, i;
+  unsigned *where, *moves;
+  where = (unsigned *)malloc((n + 1) * sizeof(unsigned));
+  moves = (unsigned *)malloc((n + 1) * sizeof(unsigned));
+  if(where == NULL || moves == NULL) {
+    free(where);
+    free(moves);
+    return -1;
+  }
+  for(i = 0; i < n; i++)
+    where[sort->current[i]] = i;	//Where each item is now
+  for(i = 0; i < n; i++)
+    moves[i] = where[order[i]];
+  if(listOrder(list, moves) == 0) {
+    memcpy(sort->current, order, n * sizeof(unsigned));
+    sort->generation = list->generation;
+  }
+  free(where);
+  free(moves);
+  return 0;
+}
+
+/* sortTop: show the first SORT_TOP items in order, picked off the */
+/* runs of phase 0. The rest follow as they are in the runs. */
+void sortTop(SORTER * sort, LISTDATA * list) {
+  SORTJOB *job = sort->job;
+  unsigned size = sort->chunkSize, n = job->length, count = 0;
+  unsigned *head, *order, c, best, end;
+
+  head = (unsigned *)calloc(job->chunks, sizeof(unsigned));
+  order = (unsigned *)malloc(n * sizeof(unsigned));
+  if(head != NULL && order != NULL) {
+    while(count < SORT_TOP && count < n) {
+      best = job->chunks;
+      for(c = 0; c < job->chunks; c++)
+	if(c * size + head[c] < n && head[c] < size
+	   && (best == job->chunks
+	       || sortCompare(job, job->ids[c * size + head[c]],
+			      job->ids[best * size + head[best]]) < 0))
+	  best = c;
+      order[count++] = job->ids[best * size + head[best]++];
+    }
+    for(c = 0; c < job->chunks; c++) {
+      end = (c * size + size < n) ? size : n - c * size;
+      memcpy(order + count, job->ids + c * size + head[c],
+	     (end - head[c]) * sizeof(unsigned));
+      count = count + end - head[c];
+    }
+    sortPublish(sort, list, order);
+  }
+  free(head);
+  free(order);
+}
+
+/* sortStale: 1 if the list is not in the order wanted and no sort is */
+/* on the way. */
+int sortStale(SORTER * sort, LISTDATA * list) {
+  if(sort->job != NULL)
+    return 0;
+  if(sort->list != list || sort->generation != list->generation)
+    return (sort->mode != SORT_NONE);
+  return (sort->shown != sort->mode);
+}
+
+/* sortAdopt: note a listing already in the order of "shown" (one */
+/* kept by the history), so it is not sorted again. It is taken,  */
+/* as listed now, only if another mode is asked for. */
+void sortAdopt(SORTER * sort, LISTDATA * list, int shown) {
+  sortCancel(sort);
+  freeKeys(sort);
+  sort->list = list;
+  sort->generation = list->generation;
+  sort->shown = shown;
+}
+
+/* sortStart: put a complete listing in the mode's order. Small lists  */
+/* (or with no pool) are sorted here. Otherwise the list stays as it  */
+/* is shown while phase 0 keys and sorts the chunks (a stat of every  */
+/* entry in size and mtime modes); sortPump() then shows the top of   */
+/* the list and goes on with the merges in the background. Returns    */
+/* VIEW_CHANGED if the list was reordered, else VIEW_SAME. */
+int sortStart(SORTER * sort, LISTDATA * list) {
+  SORTJOB *job;
+  unsigned *order, i;
+
+  sortCancel(sort);
+  if(!sortStale(sort, list))
+    return VIEW_SAME;
+  if(sort->list != list || sort->generation != list->generation
+     || sort->keys == NULL)
+    if(sortTake(sort, list) != 0)
+      return VIEW_SAME;
+  if(sort->mode == SORT_NONE) {
+    //Back to directory order
+    order = (unsigned *)malloc((sort->length + 1) * sizeof(unsigned));
+    if(order == NULL)
+      return VIEW_SAME;
+    for(i = 0; i < sort->length; i++)
+      order[i] = i;
+    sortPublish(sort, list, order);
+    free(order);
+    sort->shown = SORT_NONE;
+    return VIEW_CHANGED;
+  }
+  job = (SORTJOB *) calloc(1, sizeof(SORTJOB));
+  if(job == NULL)
+    return VIEW_SAME;
+  job->sort = sort;
+  job->mode = sort->mode;
+  job->length = sort->length;
+  job->chunks = sort->chunks;
+  job->ids = (unsigned *)malloc((job->length + 1) * sizeof(unsigned));
+  job->tmp = (unsigned *)malloc((job->length + 1) * sizeof(unsigned));
+  job->rank = (SORTRANK *) malloc((job->length + 1) * sizeof(SORTRANK));
+  if(job->ids == NULL || job->tmp == NULL || job->rank == NULL) {
+    freeSortJob(job);
+    return VIEW_SAME;
+  }
+  sort->job = job;
+  sortPhase(sort);
+  if(sort->pool != NULL && job->chunks > 1)
+    return VIEW_SAME;		//sortPump() does the rest
+  while(!job->failed && !sortNext(job))
+    sortPhase(sort);
+  if(!job->failed) {
+    sortPublish(sort, list, job->ids);
+    sort->shown = job->mode;
+  }
+  sortCancel(sort);
+  return VIEW_CHANGED;
+}
+
+/* sortPump: go on with the background sort. Once phase 0 is done */
+/* the top of the list is shown; returns VIEW_CHANGED then and once  */
+/* the list is in full order, VIEW_SAME otherwise. */
+int sortPump(SORTER * sort, LISTDATA * list) {
+  SORTJOB *job = sort->job;
+  char    drain[64];
+  int     top;
+  if(job == NULL)
+    return VIEW_SAME;
+  while(read(sort->notify[0], drain, sizeof(drain)) > 0);
+  if(__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE) < job->chunks)
+    return VIEW_SAME;
+  top = (job->width == 0);
+  if(top && !job->failed)
+    sortTop(sort, list);
+  if(!job->failed && !sortNext(job)) {
+    sortPhase(sort);
+    return top ? VIEW_CHANGED : VIEW_SAME;
+  }
+  if(!job->failed) {
+    sortPublish(sort, list, job->ids);
+    sort->shown = job->mode;
+  }
+  sortCancel(sort);
+  return VIEW_CHANGED;
+}
+
+/* sortModeOf: SORT_* mode called name, or -1. */
+int sortModeOf(const char *name) {
+  int     mode;
+  for(mode = 0; mode < SORT_MODES; mode++)
+    if(strcmp(sortNames[mode], name) == 0)
+      return mode;
+  return -1;
+}
+
+/* ---------------------- */
+/* Metadata columns       */
+/* ---------------------- */
+/* With -l each row shows size, permissions, mtime and owner. Nothing */
+/* is stat'ed up front: loadlist() asks for the rows it draws and      */
+/* META_PREFETCH more each way, and a helper thread stats them with    */
+/* statx(), asking only for the fields shown. Results are kept on the  */
+/* entry, so rows scrolled back to cost nothing. The helper thread     */
+/* takes whatever is queued as one batch; results come back the same  */
+/* way and wake readKey(). An item number may change before its result */
+/* arrives (a new order): results are checked against the path and    */
+/* the stale ones dropped; the epoch then moves on, so the rows still  */
+/* waiting are asked for again when drawn.                             */
+
+// initBatch: set up an empty batch of requests.
+void initBatch(METABATCH * batch) {
+  batch->req = NULL;
+  batch->count = 0;
+  batch->size = 0;
+  batch->names = NULL;
+  batch->used = 0;
+  batch->namesSize = 0;
+}
+
+// freeBatch: give a batch's memory back to the system.
+void freeBatch(METABATCH * batch) {
+  free(batch->req);
+  free(batch->names);
+  initBatch(batch);
+}
+
+/* metaAdd: add a request for item "item" at path "name". */
+/* Returns NULL if out of memory. */
+METAREQ *metaAdd(METABATCH * batch, unsigned item, const char *name,
+		 unsigned epoch) {
+  size_t  len = strlen(name) + 1, newSize;
+  METAREQ *req;
+  void   *ptr;
+  if(batch->count == batch->size) {
+    newSize = (batch->size == 0) ? META_PREFETCH : batch->size * 2;
+    ptr = realloc(batch->req, newSize * sizeof(METAREQ));
+    if(ptr == NULL)
+      return NULL;
+    batch->req = (METAREQ *) ptr;
+    batch->size = (unsigned)newSize;
+  }
+  if(batch->used + len > batch->namesSize) {
+    newSize = (batch->namesSize == 0) ? STORE_MIN_BLOB : batch->namesSize;
+    while(batch->used + len > newSize)
+      newSize = newSize * 2;
+    ptr = realloc(batch->names, newSize);
+    if(ptr == NULL)
+      return NULL;
+    batch->names = (char *)ptr;
+    batch->namesSize = newSize;
+  }
+  req = &batch->req[batch->count++];
+  req->item = item;
+  req->epoch = epoch;
+  req->name = batch->used;
+  req->ok = 0;
+  memcpy(batch->names + batch->used, name, len);
+  batch->used = batch->used + len;
+  return req;
+}
+
+/* metaStat: fill in the results of a request from what statMany() */
+/* reported. The owner's name is looked up once per uid in a row. */
+void metaStat(METAREQ * req, STATINFO * info, unsigned *lastUid,
+	      char lastOwner[OWNER_LENGTH + 1]) {
+  struct passwd pw, *found = NULL;
+  char    buffer[1024];
+  req->ok = (info->ok > 0);
+  if(!req->ok)
+    return;
+  req->size = info->size;
+  req->mtime = info->mtime / 1000000000LL;
+  req->mode = info->mode;
+  if(info->uid != *lastUid) {
+    if(getpwuid_r(info->uid, &pw, buffer, sizeof(buffer), &found) == 0
+       && found != NULL)
+      snprintf(lastOwner, OWNER_LENGTH + 1, "%s", pw.pw_name);
+    else
+      snprintf(lastOwner, OWNER_LENGTH + 1, "%u", info->uid);
+    *lastUid = info->uid;
+  }
+  memcpy(req->owner, lastOwner, OWNER_LENGTH + 1);
+}
+
+void   *metaThread(void *arg) {
+//Helper thread: stat each batch queued and hand the results back.
+  METAQUEUE *queue = (METAQUEUE *) arg;
+  METABATCH swap;
+  METAREQ *req;
+  STATINFO one;
+  unsigned i, lastUid = (unsigned)-1;
+  char    lastOwner[OWNER_LENGTH + 1] = "";
+  char    byte = 0;
+  int     wake, dirFd;
+  void   *ptr;
+
+  pthread_mutex_lock(&queue->lock);
+  for(;;) {
+    while(queue->todo.count == 0 && !queue->stop)
+      pthread_cond_wait(&queue->wake, &queue->lock);
+    if(queue->stop)
+      break;
+    swap = queue->work;		//Take the batch; the UI goes on
+    queue->work = queue->todo;	//queuing in an empty one.
+    queue->todo = swap;
+    //A copy of our own: the UI may move to another directory meanwhile.
+    dirFd = (queue->dirFd >= 0) ?
+	fcntl(queue->dirFd, F_DUPFD_CLOEXEC, 0) : AT_FDCWD;
+    pthread_mutex_unlock(&queue->lock);
+    //The whole batch goes to statMany(); one by one if out of memory.
+    if(queue->work.count > queue->infoSize) {
+      ptr = realloc(queue->names, queue->work.size * sizeof(char *));
+      if(ptr != NULL)
+	queue->names = (const char **)ptr;
+      ptr = (ptr == NULL) ? NULL :
+	  realloc(queue->info, queue->work.size * sizeof(STATINFO));
+      if(ptr != NULL) {
+	queue->info = (STATINFO *) ptr;
+	queue->infoSize = queue->work.size;
+      }
+    }
+    if(queue->work.count <= queue->infoSize) {
+      for(i = 0; i < queue->work.count; i++)
+	queue->names[i] = queue->work.names + queue->work.req[i].name;
+      statMany(&queue->ring, dirFd, queue->names, queue->work.count,
+	       queue->info);
+      for(i = 0; i < queue->work.count; i++)
+	metaStat(&queue->work.req[i], &queue->info[i], &lastUid,
+		 lastOwner);
+    } else
+      for(i = 0; i < queue->work.count; i++) {
+	statOne(dirFd, queue->work.names + queue->work.req[i].name, &one);
+	metaStat(&queue->work.req[i], &one, &lastUid, lastOwner);
+      }
+    if(dirFd >= 0)
+      close(dirFd);
+    pthread_mutex_lock(&queue->lock);
+    wake = (queue->done.count == 0);	//Else a wake-up is pending
+    if(wake) {
+      swap = queue->done;
+      queue->done = queue->work;
+      queue->work = swap;
+    } else
+      for(i = 0; i < queue->work.count; i++) {
+	req = metaAdd(&queue->done, queue->work.req[i].item,
+		      queue->work.names + queue->work.req[i].name,
+		      queue->work.req[i].epoch);
+	if(req != NULL) {
+	  req->ok = queue->work.req[i].ok;
+	  req->size = queue->work.req[i].size;
+	  req->mtime = queue->work.req[i].mtime;
+	  req->mode = queue->work.req[i].mode;
+	  memcpy(req->owner, queue->work.req[i].owner, OWNER_LENGTH + 1);
+	}
+      }
+    queue->work.count = 0;
+    queue->work.used = 0;
+    if(wake && write(queue->notify[1], &byte, 1) < 0) {
+      //Pipe full: the UI has wake-ups pending already.
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return NULL;
+}
+
+/* initMeta: set up the queue and start its helper thread, which  */
+/* stats through io_uring if "uring" is set. Without one (threads */
+/* off or failed) rows are stat'ed as drawn. */
+void initMeta(METAQUEUE * queue, int threaded, int uring) {
+  initBatch(&queue->todo);
+  initBatch(&queue->work);
+  initBatch(&queue->done);
+  initBatch(&queue->taken);
+  queue->stop = 0;
+  queue->running = 0;
+  queue->epoch = 1;		//0 marks entries never asked for
+  queue->notify[0] = -1;
+  queue->notify[1] = -1;
+  queue->names = NULL;
+  queue->info = NULL;
+  queue->infoSize = 0;
+  queue->dirFd = -1;		//Working directory
+  memset(&queue->ring, 0, sizeof(URING));
+  queue->ring.fd = -1;		//Entries one by one
+  if(uring)
+    uringOpen(&queue->ring, URING_ENTRIES);
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->wake, NULL);
+  if(!threaded || pipe(queue->notify) != 0)
+    return;
+  fcntl(queue->notify[0], F_SETFL, O_NONBLOCK);
+  fcntl(queue->notify[1], F_SETFL, O_NONBLOCK);
+  if(pthread_create(&queue->thread, NULL, metaThread, queue) == 0)
+    queue->running = 1;
+}
+
+// freeMeta: stop the helper thread and give everything back.
+void freeMeta(METAQUEUE * queue) {
+  if(queue->running) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+    queue->running = 0;
+  }
+  if(queue->notify[0] >= 0) {
+    close(queue->notify[0]);
+    close(queue->notify[1]);
+  }
+  freeBatch(&queue->todo);
+  freeBatch(&queue->work);
+  freeBatch(&queue->done);
+  freeBatch(&queue->taken);
+  uringClose(&queue->ring);
+  if(queue->dirFd >= 0)
+    close(queue->dirFd);
+  free(queue->names);
+  free(queue->info);
+  pthread_cond_destroy(&queue->wake);
+  pthread_mutex_destroy(&queue->lock);
+}
+
+/* metaClear: the list is going; results still to come are dropped. */
+void metaClear(METAQUEUE * queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->todo.count = 0;
+  queue->todo.used = 0;
+  queue->done.count = 0;
+  queue->done.used = 0;
+  queue->epoch++;		//Also drops the batch being stat'ed
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/* metaDir: names asked for from now on are relative to dirFd. */
+/* The queue keeps a copy; the caller may close its own. */
+void metaDir(METAQUEUE * queue, int dirFd) {
+  pthread_mutex_lock(&queue->lock);
+  if(queue->dirFd >= 0)
+    close(queue->dirFd);
+  queue->dirFd = fcntl(dirFd, F_DUPFD_CLOEXEC, 0);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/* metaSet: copy the results of a request into an entry. */
+void metaSet(ENTRYMETA * meta, METAREQ * req) {
+  meta->state = req->ok ? META_READY : META_FAILED;
+  meta->size = req->size;
+  meta->mtime = req->mtime;
+  meta->mode = req->mode;
+  memcpy(meta->owner, req->owner, OWNER_LENGTH + 1);
+}
+
+/* metaFetch: ask for the metadata of the rows from position "first" */
+/* on, and META_PREFETCH each way, that are not loaded or asked for. */
+void metaFetch(METAQUEUE * queue, SCROLLDATA * scrollData, unsigned first) {
+  METAREQ req;
+  STATINFO info;
+  ENTRYMETA *meta;
+  unsigned length = viewLength(scrollData), from, to, i, item;
+  unsigned margin = queue->running ? META_PREFETCH : 0;
+  unsigned lastUid = (unsigned)-1;
+  char    lastOwner[OWNER_LENGTH + 1] = "";
+  int     wake = 0;
+
+  from = (first > margin) ? first - margin : 0;
+  to = first + scrollData->displayLimit + margin;
+  if(to > length)
+    to = length;
+  if(queue->running)
+    pthread_mutex_lock(&queue->lock);
+  for(i = from; i < to; i++) {
+    item = viewItem(scrollData, i);
+    meta = listMeta(scrollData->list, item, 1);
+    if(meta == NULL || meta->state == META_READY
+       || meta->state == META_FAILED
+       || (meta->state == META_PENDING && meta->epoch == queue->epoch))
+      continue;
+    if(!queue->running) {
+      //No helper: only the rows drawn, here and now.
+      statOne((queue->dirFd >= 0) ? queue->dirFd : AT_FDCWD,
+	      listPath(scrollData->list, item), &info);
+      metaStat(&req, &info, &lastUid, lastOwner);
+      metaSet(meta, &req);
+      continue;
+    }
+    if(metaAdd(&queue->todo, item, listPath(scrollData->list, item),
+	       queue->epoch) == NULL)
+      break;
+    meta->state = META_PENDING;
+    meta->epoch = queue->epoch;
+    wake = 1;
+  }
+  if(queue->running) {
+    if(wake)
+      pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+  }
+}
+
+/* metaPump: copy the results that are back into their entries. */
+/* Returns the no. of entries filled in. */
+unsigned metaPump(METAQUEUE * queue, LISTDATA * list) {
+  METABATCH swap;
+  METAREQ *req;
+  ENTRYMETA *meta;
+  unsigned i, filled = 0, epoch;
+  int     moved = 0;
+  char    drain[64];
+
+  if(!queue->running)
+    return 0;
+  while(read(queue->notify[0], drain, sizeof(drain)) > 0);
+  pthread_mutex_lock(&queue->lock);
+  swap = queue->taken;
+  queue->taken = queue->done;
+  queue->done = swap;
+  epoch = queue->epoch;
+  pthread_mutex_unlock(&queue->lock);
+  for(i = 0; i < queue->taken.count; i++) {
+    req = &queue->taken.req[i];
+    if(req->epoch != epoch)
+      continue;			//Asked for a list that is gone
+    if(req->item >= list->length
+       || strcmp(listPath(list, req->item),
+		 queue->taken.names + req->name) != 0) {
+      moved = 1;		//Moved: ask again for what is drawn
+      continue;
+    }
+    meta = listMeta(list, req->item, 1);
+    if(meta != NULL) {
+      metaSet(meta, req);
+      filled++;
+    }
+  }
+  queue->taken.count = 0;
+  queue->taken.used = 0;
+  if(moved) {
+    pthread_mutex_lock(&queue->lock);
+    queue->epoch++;
+    pthread_mutex_unlock(&queue->lock);
+  }
+  return filled;
+}
+
+/* formatMeta: the columns of an entry as displayed, COLUMNS_WIDTH */
+/* characters. Blank until the entry is loaded. */
+void formatMeta(char out[COLUMNS_WIDTH + 1], ENTRYMETA * meta) {
+  const char *units = "KMGTPE";
+  char    size[8], perms[11], date[16];
+  double  value;
+  struct tm tm;
+  time_t  when, now;
+  int     unit = -1;
+
+  if(meta == NULL || meta->state == META_NONE
+     || meta->state == META_PENDING) {
+    snprintf(out, COLUMNS_WIDTH + 1, "%*s", COLUMNS_WIDTH, "");
+    return;
+  }
+  if(meta->state == META_FAILED) {
+    snprintf(out, COLUMNS_WIDTH + 1, " %6s %-10s %-12s %-8s", "?", "?",
+	     "?", "?");
+    return;
+  }
+  //Size: bytes up to 1023, then 1.0K..999K, 1.0M..
+  value = (double)meta->size;
+  while(value >= 1024 && unit < 5) {
+    value = value / 1024;
+    unit++;
+  }
+  if(unit < 0)
+    snprintf(size, sizeof(size), "%lld", meta->size);
+  else
+    snprintf(size, sizeof(size), (value < 10) ? "%.1f%c" : "%.0f%c",
+	     value, units[unit]);
+  perms[0] = S_ISDIR(meta->mode) ? 'd' : S_ISLNK(meta->mode) ? 'l' : '-';
+  perms[1] = (meta->mode & S_IRUSR) ? 'r' : '-';
+  perms[2] = (meta->mode & S_IWUSR) ? 'w' : '-';
+  perms[3] = (meta->mode & S_IXUSR) ? 'x' : '-';
+  perms[4] = (meta->mode & S_IRGRP) ? 'r' : '-';
+  perms[5] = (meta->mode & S_IWGRP) ? 'w' : '-';
+  perms[6] = (meta->mode & S_IXGRP) ? 'x' : '-';
+  perms[7] = (meta->mode & S_IROTH) ? 'r' : '-';
+  perms[8] = (meta->mode & S_IWOTH) ? 'w' : '-';
+  perms[9] = (meta->mode & S_IXOTH) ? 'x' : '-';
+  perms[10] = '\0';
+  //Dates over six months away show the year instead of the time, as ls.
+  when = (time_t) meta->mtime;
+  now = time(NULL);
+  if(localtime_r(&when, &tm) == NULL
+     || strftime(date, sizeof(date), (when > now - 15778476
+				      && when < now + 15778476) ?
+		 "%b %d %H:%M" : "%b %d  %Y", &tm) == 0)
+    strcpy(date, "?");
+  snprintf(out, COLUMNS_WIDTH + 1, " %6s %s %-12.12s %-8.8s", size, perms,
+	   date, meta->owner);
+}
+
+/* ---------------- */
+/* Listbox routines */
+/* ---------------- */
+
+void gotoIndex(unsigned *aux, SCROLLDATA * scrollData,
+	       unsigned indexAt)
+//Go to a specific location on the list.
+{
+  //Items are reached by number through the accessors.
+  //Highlight current item
+
+  displayItem(indexAt, scrollData, SELECT_ITEM);
+
+  //Update item number
+  *aux = indexAt;
+}
+
+void loadlist(LISTDATA * list, SCROLLDATA * scrollData, unsigned indexAt) {
+/*
+Displays the items contained in the list with the properties specified
+in scrollData.
+*/
+
+  unsigned aux;
+  unsigned wherey, counter = 0;
+
+  scrollData->list = list;
+  //Columns are asked for the rows about to be shown, and a few more.
+  if(scrollData->meta != NULL)
+    metaFetch(scrollData->meta, scrollData, indexAt);
+  gotoIndex(&aux, scrollData, indexAt);
+  /* Save values */
+  //wherex = scrollData->wherex;
+  wherey = scrollData->wherey;
+  do {
+    displayItem(aux, scrollData, UNSELECT_ITEM);
+    aux++;
+    counter++;
+    scrollData->selector++;	// wherey++
+  } while(counter != scrollData->displayLimit);
+  scrollData->selector = wherey;	//restore value
+}
+
+unsigned query_length(LISTDATA * list) {
+//Return no. items in a list. Kept up to date by the list routines.
+  return list->length;
+}
+
+void displayItem(unsigned aux, SCROLLDATA * scrollData, int select)
+//Select or unselect item animation
+{
+  unsigned item = viewItem(scrollData, aux);
+  char    columns[COLUMNS_WIDTH + 1] = "";
+
+  //Columns still to come are left blank.
+  if(scrollData->meta != NULL)
+    formatMeta(columns, listMeta(scrollData->list, item, 0));
+  switch (select) {
+
+    case SELECT_ITEM:
+      gotoxy(scrollData->wherex, scrollData->selector);
+      outputcolor(scrollData->foreColor1, scrollData->backColor1);
+      outputf("%s%s\n", listItem(scrollData->list, item), columns);
+      break;
+
+    case UNSELECT_ITEM:
+      gotoxy(scrollData->wherex, scrollData->selector);
+      outputcolor(scrollData->foreColor0, scrollData->backColor0);
+      outputf("%s%s\n", listItem(scrollData->list, item), columns);
+      break;
+  }
+}
+
+void redrawRows(unsigned aux, SCROLLDATA * scrollData) {
+//Draws the items on view again (their columns came in), aux selected.
+  unsigned first = (scrollData->scrollActive == SCROLL_ACTIVE) ?
+      scrollData->currentListIndex : 0;
+  scrollData->selector = scrollData->wherey;
+  loadlist(scrollData->list, scrollData, first);
+  scrollData->selector = scrollData->wherey + (aux - first);
+  displayItem(aux, scrollData, SELECT_ITEM);
+}
+void displayMetrics(unsigned aux, SCROLLDATA * scrollData,
+		    unsigned scrollControl) {
+//Debug information about the item selected.
+  cleanLine(4, B_BLUE, F_BLUE);
+  outputcolor(F_WHITE, B_BLUE);
+  gotoxy(6, 3);
+  outputf("Index:%d/%d|Memory addr:%p", aux,
+	  scrollData->listLength - 1,
+	  listItem(scrollData->list, viewItem(scrollData, aux)));
+  gotoxy(6, 4);
+  outputf("Scroll Limit: %d|IsScActive?:%d|Path: %s",
+	  scrollControl, scrollData->scrollActive,
+	  listPath(scrollData->list, viewItem(scrollData, aux)));
+}
+
+int move_selector(unsigned *selector, SCROLLDATA * scrollData, int rows) {
+/* 
+Creates animation by moving a selector "rows" items down (or up if
+negative). The list wraps around when it is not scrolling.
+Returns what jump_selector() returns.
+*/
+
+  long    where;
+
+  where = (long)*selector + rows;
+
+  if(scrollData->scrollActive == SCROLL_INACTIVE) {
+    //Circular list animation when not scrolling.
+    where = where % (long)scrollData->listLength;
+    if(where < 0)
+      where = where + scrollData->listLength;
+  } else {
+    //Stop at the ends of the list when scrolling.
+    if(where < 0)
+      where = 0;
+    if(where > (long)scrollData->listLength - 1)
+      where = scrollData->listLength - 1;
+  }
+  return jump_selector(selector, scrollData, (unsigned)where);
+}
+
+int jump_selector(unsigned *selector, SCROLLDATA * scrollData,
+		  unsigned target) {
+/*
+Moves the selector straight to item number target, highlighting it and
+unselecting the previous one. Any distance costs the same: items are
+reached by number and the view is placed directly. Returns 1 if the
+item is outside the items on display; currentListIndex and itemIndex
+then hold the new view and the caller has to reload the list.
+*/
+
+  unsigned aux, scrollControl = 0;
+  int     down;
+
+  //Auxiliary item number is the selector.
+  aux = *selector;
+  if(target == aux)
+    return 0;
+  down = (target > aux);
+  scrollData->scrollDirection = down ? DOWN_SCROLL : UP_SCROLL;
+
+  if(scrollData->scrollActive == SCROLL_ACTIVE
+     && (target < scrollData->currentListIndex
+	 || target > scrollData->currentListIndex +
+	 scrollData->displayLimit - 1)) {
+    //Outside the view: move it so the item is at the top (going up)
+    //or at the bottom (going down).
+    if(target < scrollData->currentListIndex)
+      scrollData->currentListIndex = target;
+    else
+      scrollData->currentListIndex = target - (scrollData->displayLimit - 1);
+    scrollData->itemIndex = target;
+    scrollData->selector = scrollData->wherey;	//loadlist() starts at the top
+    scrollControl = down ?
+	scrollData->currentListIndex + scrollData->displayLimit - 1 :
+	scrollData->currentListIndex;
+    displayMetrics(target, scrollData, scrollControl);
+    *selector = target;
+    return 1;
+  }
+
+  //Unselect previous item
+  displayItem(aux, scrollData, UNSELECT_ITEM);
+  scrollData->selector = scrollData->wherey +
+      (target - scrollData->currentListIndex);
+
+  if(scrollData->scrollActive == SCROLL_ACTIVE)
+    scrollControl = down ?
+	scrollData->currentListIndex + scrollData->displayLimit - 1 :
+	scrollData->currentListIndex;
+  else
+    scrollControl = down ? scrollData->listLength - 1 : 0;
+
+  //Metrics
+  displayMetrics(target, scrollData, scrollControl);
+
+  //Highlight new item
+  displayItem(target, scrollData, SELECT_ITEM);
+
+  //Update selector item number
+  *selector = target;
+  return 0;
+}
+
+char selectorMenu(unsigned aux, SCROLLDATA * scrollData) {
+  char    ch=0;
+  int     key = 0;
+  unsigned control = 0;
+  unsigned continueScroll=0;
+  unsigned rows = 0;
+  unsigned target = 0;
+  int     view = VIEW_SAME;
+  int     sorted = VIEW_SAME;
+
+  //Go to and select expected item at the beginning
+  scrollData->selector = scrollData->wherey +
+      (aux - scrollData->currentListIndex);
+  gotoIndex(&aux, scrollData, aux);
+
+  //It break the loop everytime the boundaries are reached.
+  //to reload a new list to show the scroll animation.
+  while(control != CONTINUE_SCROLL) {
+    key = readKey();
+
+    //if enter key pressed - break loop
+    if(key == K_ENTER) {
+      ch = K_ENTER;
+      control = CONTINUE_SCROLL;	//Break the loop
+      //Accept the complete result, not the part shown so far: the item
+      //highlighted if it is in it, else the result is shown first.
+      if(scrollData->filter != NULL && scrollData->filter->job != NULL) {
+	target = (aux < viewLength(scrollData)) ?
+	    viewItem(scrollData, aux) : (unsigned)-1;
+	if(filterWait(scrollData->filter) == VIEW_CHANGED) {
+	  aux = viewFind(scrollData, target);
+	  if(aux >= viewLength(scrollData))
+	    ch = FILTER_CHANGED;
+	}
+      }
+    }
+
+    //Check arrow keys. Repeats already queued (auto-repeat) are
+    //merged into one move so they are drawn once.
+    if(key == KEY_UP || key == KEY_DOWN) {
+      rows = 1 + repeatKey(key);
+      continueScroll = move_selector(&aux, scrollData,
+				     (key == KEY_DOWN) ? (int)rows :
+				     -(int)rows);
+    }
+
+    //Page and Home/End keys jump straight to the item.
+    if(key == KEY_PGUP || key == KEY_PGDN || key == KEY_HOME
+       || key == KEY_END) {
+      rows = (1 + repeatKey(key)) * scrollData->displayLimit;
+      if(key == KEY_HOME)
+	target = 0;
+      else if(key == KEY_END)
+	target = scrollData->listLength - 1;
+      else if(key == KEY_PGUP)
+	target = (aux > rows) ? aux - rows : 0;
+      else
+	target = (aux + rows < scrollData->listLength) ? aux + rows :
+	    scrollData->listLength - 1;
+      continueScroll = jump_selector(&aux, scrollData, target);
+    }
+
+    //F2: next sort mode. A listing still coming in is sorted once
+    //it is complete.
+    if(key == K_SORT && scrollData->sort != NULL) {
+      scrollData->sort->mode = (scrollData->sort->mode + 1) % SORT_MODES;
+      if((scrollData->scan == NULL || !scrollData->scan->running)
+	 && sortStart(scrollData->sort, scrollData->list) == VIEW_CHANGED) {
+	refilter(scrollData);
+	ch = FILTER_CHANGED;
+	control = CONTINUE_SCROLL;
+      }
+    }
+
+    //Background results: merge the entries and chunks that are ready.
+    if(key == KEY_WAKE) {
+      view = VIEW_SAME;
+      if(scrollData->scan != NULL
+	 && scanPump(scrollData->scan, scrollData->list) == VIEW_GROWN) {
+	view = VIEW_GROWN;
+	//New entries have to be searched too.
+	if(refilter(scrollData))
+	  view = VIEW_CHANGED;
+      }
+      //A complete listing is sorted; so far it was shown as read.
+      if(scrollData->sort != NULL) {
+	if((scrollData->scan == NULL || !scrollData->scan->running)
+	   && sortStale(scrollData->sort, scrollData->list))
+	  sorted = sortStart(scrollData->sort, scrollData->list);
+	else
+	  sorted = sortPump(scrollData->sort, scrollData->list);
+	if(sorted == VIEW_CHANGED) {
+	  refilter(scrollData);
+	  view = VIEW_CHANGED;
+	}
+      }
+      if(scrollData->filter != NULL && view == VIEW_SAME)
+	view = filterPump(scrollData->filter);
+      //Columns that came in are drawn, unless the view is redone anyway.
+      if(scrollData->meta != NULL
+	 && metaPump(scrollData->meta, scrollData->list) > 0
+	 && view == VIEW_SAME)
+	redrawRows(aux, scrollData);
+      if(view == VIEW_CHANGED) {
+	ch = FILTER_CHANGED;
+	control = CONTINUE_SCROLL;
+      } else if(view == VIEW_GROWN) {
+	scrollData->itemIndex = aux;	//Selection stays where it is
+	ch = FILTER_GROWN;
+	control = CONTINUE_SCROLL;
+      }
+    }
+
+    //Left and Right: back and forward through the directories visited.
+    if(key == KEY_LEFT || key == KEY_RIGHT) {
+      ch = (key == KEY_LEFT) ? HISTORY_BACK : HISTORY_FORWARD;
+      control = CONTINUE_SCROLL;
+    }
+
+    //Typed characters narrow the list; Backspace and Esc widen it.
+    if(filterKey(scrollData, key) == 1) {
+      ch = FILTER_CHANGED;
+      control = CONTINUE_SCROLL;	//The view has to be set up again
+    }
+
+    //Break the loop if we are scrolling
+    if(scrollData->scrollActive == SCROLL_ACTIVE && continueScroll == 1) {
+      continueScroll = 0;
+      control = CONTINUE_SCROLL;
+      ch = control;
+    }
+  }
+  if(ch == K_ENTER || ch == HISTORY_BACK || ch == HISTORY_FORWARD)
+  {
+    //Pass data of last item selected (kept as the place we left).
+    //itemIndex is the item number in the list, filtered or not.
+    if(ch != K_ENTER && aux >= viewLength(scrollData))
+      aux = 0;			//Nothing on view
+    else
+      aux = viewItem(scrollData, aux);
+    scrollData->item = listItem(scrollData->list, aux);
+    scrollData->itemIndex = aux;
+    scrollData->path = listPath(scrollData->list, aux);
+    scrollData->isDirectory = listType(scrollData->list, aux);
+  }
+  return ch;
+}
+
+char listBox(LISTDATA * list,
+	     unsigned whereX, unsigned whereY,
+	     SCROLLDATA * scrollData, unsigned bColor0,
+	     unsigned fColor0, unsigned bColor1, unsigned fColor1,
+	     unsigned displayLimit) {
+
+  unsigned list_length = 0;
+  //unsigned currentIndex = 0;
+  int     scrollLimit = 0;
+  unsigned currentListIndex = 0;
+  unsigned shownRows = 0;
+  int     filterShown = 0;
+  char    ch=0;
+  int     delta = 0;
+  int     first = 1;
+
+  //Save calculations for SCROLL and store DATA
+  scrollData->list = list;
+  scrollData->wherex = whereX;
+  scrollData->wherey = whereY;
+  scrollData->backColor0 = bColor0;
+  scrollData->backColor1 = bColor1;
+  scrollData->foreColor0 = fColor0;
+  scrollData->foreColor1 = fColor1;
+  if(scrollData->filter != NULL)
+    clearFilter(scrollData->filter);	//Every list starts unfiltered
+
+  //The view is set up again every time the filter changes.
+  do {
+    // Query size of the view
+    list_length = viewLength(scrollData);
+
+    scrollData->displayLimit = displayLimit;
+    scrollLimit = list_length - scrollData->displayLimit;	//Careful with negative integers
+
+    if(scrollLimit < 0)
+      scrollData->displayLimit = list_length;	//Failsafe for overboard values
+
+    scrollData->scrollLimit = scrollLimit;
+    scrollData->listLength = list_length;
+    scrollData->selector = whereY;
+    if(first) {
+      //Start where the caller put us (0: the top), if that is on view.
+      if(scrollData->itemIndex >= list_length)
+	scrollData->itemIndex = 0;
+      if(scrollLimit <= 0 || displayLimit == 0)
+	scrollData->currentListIndex = 0;
+      else {
+	if(scrollData->currentListIndex > scrollData->itemIndex)
+	  scrollData->currentListIndex = scrollData->itemIndex;
+	if(scrollData->itemIndex - scrollData->currentListIndex >=
+	   scrollData->displayLimit)
+	  scrollData->currentListIndex =
+	      scrollData->itemIndex - scrollData->displayLimit + 1;
+	if(scrollData->currentListIndex > (unsigned)scrollLimit)
+	  scrollData->currentListIndex = scrollLimit;
+      }
+      first = 0;
+    } else if(ch != FILTER_GROWN) {
+      //New items: start at the top. More items: stay where we are.
+      scrollData->itemIndex = 0;
+      scrollData->currentListIndex = 0;
+    }
+
+    //Blank the rows a longer view left behind and show the filter.
+    if(shownRows > scrollData->displayLimit)
+      cleanArea(scrollData, scrollData->displayLimit, shownRows);
+    shownRows = scrollData->displayLimit;
+    if(scrollData->filter != NULL
+       && (scrollData->filter->typed > 0 || filterShown))
+      displayFilter(scrollData, whereY + displayLimit);
+    filterShown = (scrollData->filter != NULL
+		   && scrollData->filter->typed > 0);
+
+    //Check whether we have to activate scroll or not 
+    //and if we are within bounds. [1,list_length)
+
+    if(list_length > scrollData->displayLimit && scrollLimit > 0
+       && displayLimit > 0) {
+      //Scroll is possible  
+
+      scrollData->scrollActive = SCROLL_ACTIVE;
+
+      //We listBox1 the scroll at the top index (or where it was).
+      currentListIndex = scrollData->currentListIndex;
+
+      //Scroll loop animation. Finish with ENTER.
+      do {
+	//Small steps are scrolled by the terminal; loadlist() then
+	//only changes the rows that came in and the highlight.
+	delta = (int)scrollData->currentListIndex - (int)currentListIndex;
+	if(delta != 0 && delta < (int)scrollData->displayLimit
+	   && -delta < (int)scrollData->displayLimit)
+	  scrollScreen(scrollData->wherey,
+		       scrollData->wherey + scrollData->displayLimit - 1,
+		       delta);
+	currentListIndex = scrollData->currentListIndex;
+	loadlist(list, scrollData, currentListIndex);
+	ch = selectorMenu(scrollData->itemIndex, scrollData);
+      } while(ch != K_ENTER && ch != FILTER_CHANGED && ch != FILTER_GROWN
+	      && ch != HISTORY_BACK && ch != HISTORY_FORWARD);
+
+    } else {
+      //Scroll is not possible.
+      //Display all the elements and create selector.
+      scrollData->scrollActive = SCROLL_INACTIVE;
+      scrollData->displayLimit = list_length;	//Default to list_length
+      loadlist(list, scrollData, 0);
+      ch = selectorMenu(scrollData->itemIndex, scrollData);
+    }
+  } while(ch == FILTER_CHANGED || ch == FILTER_GROWN);
+  if(scrollData->filter != NULL)
+    filterCancel(scrollData->filter);	//Results still to come are not needed
+  if(scrollData->scan != NULL)
+    scanCancel(scrollData->scan);	//Same for entries still to come
+  if(scrollData->sort != NULL)
+    sortCancel(scrollData->sort);	//And merges: the list stays as shown
+  if(scrollData->meta != NULL)
+    metaClear(scrollData->meta);	//And columns
+  return ch;
+}
+
+int refilter(SCROLLDATA * scrollData) {
+/*
+The items of the list changed under the filter (more entries, a new
+order). Text typed is run again and waited for, so the view never mixes
+old and new results. Returns 1 if there was text to run.
+*/
+  if(scrollData->filter == NULL || scrollData->filter->typed == 0)
+    return 0;
+  filterRestart(scrollData->filter, scrollData->list);
+  filterWait(scrollData->filter);
+  return 1;
+}
+
+int filterKey(SCROLLDATA * scrollData, int key) {
+/*
+Passes a key to the type-ahead filter. Returns 1 if the items on view
+have changed and the view has to be set up again.
+*/
+  FILTER *filter = scrollData->filter;
+  if(filter == NULL)
+    return 0;
+  if(key >= ' ' && key <= '~')
+    return (filterAdd(filter, scrollData->list, (char)key) == 0);
+  if(key == K_TAB) {
+    filterMode(filter, scrollData->list);
+    return 1;
+  }
+  if(filter->typed == 0)
+    return 0;
+  if(key == K_BACKSPACE || key == K_CTRL_H) {
+    filterBack(filter);
+    return 1;
+  }
+  if(key == KEY_ESCAPE) {
+    clearFilter(filter);
+    return 1;
+  }
+  return 0;
+}
+
+void displayFilter(SCROLLDATA * scrollData, unsigned row) {
+//Shows the text typed so far on the given row, below the items.
+  gotoxy(scrollData->wherex, row);
+  outputcolor(scrollData->foreColor0, scrollData->backColor0);
+  //Fuzzy text is shown after a '~'.
+  if(scrollData->filter->mode == FILTER_FUZZY)
+    outputf("~%-*.*s", MAX_ITEM_LENGTH - 1, MAX_ITEM_LENGTH - 1,
+	    scrollData->filter->text);
+  else
+    outputf("%-*.*s", MAX_ITEM_LENGTH, MAX_ITEM_LENGTH,
+	    scrollData->filter->text);
+}
+
+void cleanArea(SCROLLDATA * scrollData, unsigned from, unsigned to) {
+//Blanks item rows from..to-1 of the listbox.
+  unsigned i;
+  int     width = MAX_ITEM_LENGTH +
+      ((scrollData->meta != NULL) ? COLUMNS_WIDTH : 0);
+  outputcolor(scrollData->foreColor0, scrollData->backColor0);
+  for(i = from; i < to; i++) {
+    gotoxy(scrollData->wherex, scrollData->wherey + i);
+    outputf("%*s", width, "");
+  }
+}
+
+/* ---------------- */
+/* List files       */
+/* ---------------- */
+
+int addSpaces(char temp[MAX_ITEM_LENGTH + 1]) {
   int     i;
-  char    temp[MAX_ITEM_LENGTH];
-  int     lenDir;		//length of directory
+  for(i = strlen(temp); i < MAX_ITEM_LENGTH; i++)
+    temp[i] = ' ';
+  temp[MAX_ITEM_LENGTH] = '\0';
+  return 0;
+}
 
-  //Add elements to switch directory at the beginning for convenience.
-  strcpy(temp, CURRENTDIR);
-  //Add spaces
-  addSpaces(temp);
-  *listBox1 = addend(*listBox1, newelement(temp, CURRENTDIR, DIRECTORY));	// "."
-  strcpy(temp, CHANGEDIR);
-  //Add spaces
+void formatItem(char temp[MAX_ITEM_LENGTH + 1], const char *name,
+		unsigned itemType) {
+/*
+Item text as displayed: MAX_ITEM_LENGTH characters, padded with spaces.
+Directories are displayed between brackets [directory]; long names are
+cropped.
+*/
+  size_t  len = strlen(name);
+  if(itemType == DIRECTORY) {
+    if(len > MAX_ITEM_LENGTH - 2)
+      len = MAX_ITEM_LENGTH - 2;	//Directory name is long. CROP
+    temp[0] = '[';
+    memcpy(temp + 1, name, len);
+    temp[len + 1] = ']';
+    temp[len + 2] = '\0';
+  } else {
+    if(len > MAX_ITEM_LENGTH)
+      len = MAX_ITEM_LENGTH;
+    memcpy(temp, name, len);
+    temp[len] = '\0';
+  }
   addSpaces(temp);
-  *listBox1 = addend(*listBox1, newelement(temp, CHANGEDIR, DIRECTORY));	// ".."
-
-  //Start at current directory
-  d = opendir(directory);
-  //Find directories and add them to list first
-  if(d) {
-    while((dir = readdir(d)) != NULL) {
-      if(dir->d_type == DT_DIR) {
-
-	lenDir = strlen(dir->d_name);
-
-	//Check length of directory
-	//Directories are displayed between brackets [directory]
-	if(lenDir > MAX_ITEM_LENGTH - 2) {
-	  //Directory name is long. CROP
-	  cleanString(temp, MAX_ITEM_LENGTH);
-	  strcpy(temp, "[");
-	  for(i = 1; i < MAX_ITEM_LENGTH - 1; i++) {
-	    temp[i] = dir->d_name[i - 1];
-	  }
-	  temp[MAX_ITEM_LENGTH - 1] = ']';
-	} else {
-	  //Directory's name is shorter than display
-	  //Add spaces to item string.
-	  cleanString(temp, MAX_ITEM_LENGTH);
-	  strcpy(temp, "[");
-	  for(i = 1; i < lenDir + 1; i++) {
-	    temp[i] = dir->d_name[i - 1];
-	  }
-	  temp[lenDir + 1] = ']';
-	  addSpaces(temp);
-	}
-	//Add all directories except CURRENTDIR and CHANGEDIR
-	if(strcmp(dir->d_name, CURRENTDIR) != 0
-	   && strcmp(dir->d_name, CHANGEDIR) != 0)
-	  *listBox1 =
-	      addend(*listBox1, newelement(temp, dir->d_name, DIRECTORY));
+}
+
+int addEntry(LISTDATA * listBox1, LISTDATA * files, const char *name,
+	     unsigned itemType) {
+/*
+Directories go straight to the list. Files wait in "files" and are
+added after the scan, so the list comes out directories first.
+*/
+  char    temp[MAX_ITEM_LENGTH + 1];
+  formatItem(temp, name, itemType);
+  if(itemType == DIRECTORY) {
+    //Add all directories except CURRENTDIR and CHANGEDIR
+    if(strcmp(name, CURRENTDIR) == 0 || strcmp(name, CHANGEDIR) == 0)
+      return 0;
+    return additem(listBox1, temp, (char *)name, DIRECTORY);
+  }
+  return additem(files, temp, (char *)name, FILEITEM);
+}
+
+int statBatch(LISTDATA * listBox1, LISTDATA * files, int fd,
+	      STATBATCH * batch) {
+/*
+Entries the file system gave no type for (DT_UNKNOWN) are collected and
+stat'ed together, relative to the directory, once the batch is full or
+the scan is over. Symbolic links are not followed, as with d_type.
+*/
+  struct stat st;
+  unsigned i;
+  for(i = 0; i < batch->count; i++) {
+    if(fstatat(fd, batch->name[i], &st, AT_SYMLINK_NOFOLLOW) != 0)
+      continue;
+    if(S_ISDIR(st.st_mode))
+      addEntry(listBox1, files, batch->name[i], DIRECTORY);
+    else if(S_ISREG(st.st_mode))
+      addEntry(listBox1, files, batch->name[i], FILEITEM);
+  }
+  batch->count = 0;
+  return 0;
+}
+
+void addParents(LISTDATA * listBox1) {
+//Add elements to switch directory at the beginning for convenience.
+  char    temp[MAX_ITEM_LENGTH + 1];
+  formatItem(temp, CURRENTDIR, FILEITEM);
+  additem(listBox1, temp, CURRENTDIR, DIRECTORY);	// "."
+  formatItem(temp, CHANGEDIR, FILEITEM);
+  additem(listBox1, temp, CHANGEDIR, DIRECTORY);	// ".."
+}
+
+unsigned readEntries(DIRREADER * reader, LISTDATA * dirs, LISTDATA * files,
+		     STATBATCH * batch, unsigned max) {
+/*
+Reads up to max entries: directories go to dirs, files to files.
+Entries of unknown type wait in batch; the last ones are stat'ed when
+the end is reached. Returns the no. of entries read, 0 at the end.
+*/
+  const char *name;
+  unsigned char type;
+  unsigned count = 0;
+  while(count < max && nextEntry(reader, &name, &type)) {
+    count++;
+    if(type == DT_DIR)
+      addEntry(dirs, files, name, DIRECTORY);
+    else if(type == DT_REG)
+      addEntry(dirs, files, name, FILEITEM);
+    else if(type == DT_UNKNOWN) {
+      strcpy(batch->name[batch->count++], name);
+      if(batch->count == STAT_BATCH)
+	statBatch(dirs, files, reader->fd, batch);
+    }
+  }
+  if(count < max)
+    statBatch(dirs, files, reader->fd, batch);
+  return count;
+}
+
+int listFiles(LISTDATA * listBox1, int dirFd) {
+  DIRREADER reader;
+  LISTDATA files;		//Files found, added after the directories
+  ITEMSTORE scratch;		//Backs "files" when the list is a store
+  STATBATCH batch;		//Entries of unknown type
+  unsigned i;
+
+  addParents(listBox1);
+  if(openReaderAt(&reader, dirFd, CURRENTDIR) != 0)
+    return 0;
+  //Linked files share the list's arena and are spliced on at the end,
+  //so each name is copied once. A store gets them from a scratch store.
+  initList(&files);
+  initStore(&scratch);
+  if(listBox1->store != NULL)
+    files.store = &scratch;
+  else
+    files.arena = listBox1->arena;
+
+  //One pass: directories are added as they come, files afterwards.
+  batch.count = 0;
+  readEntries(&reader, listBox1, &files, &batch, UINT_MAX);
+  closeReader(&reader);
+
+  //Files after directories
+  if(files.store == NULL)
+    addlist(listBox1, &files);
+  else
+    for(i = 0; i < files.length; i++)
+      additem(listBox1, scratch.blob + scratch.itemOffset[i],
+	      scratch.blob + scratch.pathOffset[i], FILEITEM);
+  freeStore(&scratch);
+  return 0;
+}
+
+/* ---------------------- */
+/* Directory reader       */
+/* ---------------------- */
+/* Entries are pulled with getdents64() into a large buffer, so a big */
+/* directory costs a few system calls instead of one per few dozen    */
+/* entries through readdir(). Names are handed out in place. Where    */
+/* getdents64() is not available, readdir() does the same job.        */
+
+/* openReaderAt: open directory "name", relative to dirFd, for */
+/* reading. Returns -1 on failure. */
+int openReaderAt(DIRREADER * reader, int dirFd, const char *name) {
+  reader->used = 0;
+  reader->pos = 0;
+  reader->dir = NULL;
+  reader->buffer = NULL;
+  reader->fd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(reader->fd < 0)
+    return -1;
+#if USE_GETDENTS
+  reader->buffer = (char *)malloc(DIRENT_BUFFER);
+  if(reader->buffer != NULL)
+    return 0;
+#endif
+  reader->dir = fdopendir(reader->fd);
+  if(reader->dir == NULL) {
+    close(reader->fd);
+    reader->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/* nextEntry: name and d_type of the next entry. Returns 1, or 0 at */
+/* the end of the directory (or on a read error). */
+int nextEntry(DIRREADER * reader, const char **name, unsigned char *type) {
+  struct dirent *dir;
+#if USE_GETDENTS
+  LINUXDIRENT *entry;
+  long    count;
+  if(reader->buffer != NULL) {
+    if(reader->pos >= reader->used) {
+      count = syscall(SYS_getdents64, reader->fd, reader->buffer,
+		      DIRENT_BUFFER);
+      if(count <= 0)
+	return 0;
+      reader->used = (int)count;
+      reader->pos = 0;
+    }
+    entry = (LINUXDIRENT *) (reader->buffer + reader->pos);
+    reader->pos = reader->pos + entry->d_reclen;
+    *name = entry->d_name;
+    *type = entry->d_type;
+    return 1;
+  }
+#endif
+  dir = readdir(reader->dir);
+  if(dir == NULL)
+    return 0;
+  *name = dir->d_name;
+  *type = dir->d_type;
+  return 1;
+}
+
+// closeReader: close the directory and free the buffer.
+void closeReader(DIRREADER * reader) {
+  if(reader->dir != NULL)
+    closedir(reader->dir);	//Closes fd too
+  else if(reader->fd >= 0)
+    close(reader->fd);
+  free(reader->buffer);
+  reader->dir = NULL;
+  reader->fd = -1;
+  reader->buffer = NULL;
+}
+
+/* ---------------------- */
+/* Background scan        */
+/* ---------------------- */
+/* A directory is read on a thread of its own. Entries are published */
+/* in batches: the first after SCAN_FIRST entries (or SCAN_INTERVAL  */
+/* ms on a slow disk), then batches twice as big, up to SCAN_BATCH.  */
+/* The UI thread merges them into the list when readKey() returns    */
+/* KEY_WAKE, so the list itself is only ever touched by the UI.      */
+/* Within a batch directories come first; a directory read in one    */
+/* batch comes out exactly as listFiles() would list it.             */
+
+/* initScan: set up the scanner. Without its pipe, directories are */
+/* read in the foreground by listFiles(). */
+void initScan(SCAN * scan) {
+  scan->running = 0;
+  scan->done = 0;
+  scan->cancelled = 0;
+  scan->readyCount = 0;
+  scan->entries = 0;
+  scan->maxEntries = WALK_ENTRIES;
+  scan->pool = NULL;
+  scan->top = -1;
+  scan->maxDepth = WALK_DEPTH;
+  scan->pending = 0;
+  scan->seen = NULL;
+  scan->seenSize = 0;
+  scan->seenCount = 0;
+  initStore(&scan->ready);
+  initStore(&scan->taken);
+  pthread_mutex_init(&scan->lock, NULL);
+  if(pipe(scan->notify) != 0) {
+    scan->notify[0] = -1;
+    scan->notify[1] = -1;
+    return;
+  }
+  fcntl(scan->notify[0], F_SETFL, O_NONBLOCK);
+  fcntl(scan->notify[1], F_SETFL, O_NONBLOCK);
+}
+
+// freeScan: stop the scan and give everything back to the system.
+void freeScan(SCAN * scan) {
+  scanCancel(scan);
+  if(scan->notify[0] >= 0) {
+    close(scan->notify[0]);
+    close(scan->notify[1]);
+  }
+  freeStore(&scan->ready);
+  freeStore(&scan->taken);
+  free(scan->seen);
+  pthread_mutex_destroy(&scan->lock);
+}
+
+/* scanAppend: add an entry to the batch published (lock held). A  */
+/* recursive scan puts the path of the directory ("prefix") in front. */
+/* Once maxEntries are out the scan stops reading. */
+void scanAppend(SCAN * scan, const char *prefix, const char *name,
+		char *item, unsigned itemType) {
+  char    temp[MAX_ITEM_LENGTH + 1];
+  char    path[PATH_MAX];
+  if(scan->entries >= scan->maxEntries) {
+    __atomic_store_n(&scan->cancelled, 1, __ATOMIC_RELEASE);
+    return;
+  }
+  if(prefix != NULL && prefix[0] != '\0') {
+    if(snprintf(path, sizeof(path), "%s/%s", prefix, name) >=
+       (int)sizeof(path))
+      return;
+    formatItem(temp, path, itemType);
+    name = path;
+    item = temp;
+  }
+  if(storeAppend(&scan->ready, scan->readyCount, item, (char *)name,
+		 itemType) != 0)
+    return;
+  scan->readyCount++;
+  scan->entries++;
+}
+
+/* scanPublish: hand the entries read so far to the UI thread, */
+/* directories first, and start the next batch empty. */
+void scanPublish(SCAN * scan, LISTDATA * dirs, LISTDATA * files,
+		 const char *prefix) {
+  unsigned i;
+  int     wake;
+  char    byte = 0;
+  pthread_mutex_lock(&scan->lock);
+  wake = (scan->readyCount == 0);	//Else the UI has a wake-up pending
+  for(i = 0; i < dirs->length; i++)
+    scanAppend(scan, prefix, listPath(dirs, i), listItem(dirs, i),
+	       DIRECTORY);
+  for(i = 0; i < files->length; i++)
+    scanAppend(scan, prefix, listPath(files, i), listItem(files, i),
+	       FILEITEM);
+  pthread_mutex_unlock(&scan->lock);
+  if(wake && write(scan->notify[1], &byte, 1) < 0) {
+    //Pipe full: the UI has wake-ups pending already.
+  }
+  deleteList(dirs);
+  deleteList(files);
+}
+
+void   *scanThread(void *arg) {
+//Scanner thread: read the directory and publish it in batches.
+  SCAN   *scan = (SCAN *) arg;
+  LISTDATA dirs, files;
+  ITEMSTORE dirStore, fileStore;
+  STATBATCH batch;
+  struct timespec last, now;
+  unsigned limit = SCAN_FIRST;
+  long    ms;
+  char    byte = 0;
+
+  initList(&dirs);
+  initList(&files);
+  initStore(&dirStore);
+  initStore(&fileStore);
+  dirs.store = &dirStore;
+  files.store = &fileStore;
+  batch.count = 0;
+  clock_gettime(CLOCK_MONOTONIC, &last);
+  while(!__atomic_load_n(&scan->cancelled, __ATOMIC_ACQUIRE)
+	&& readEntries(&scan->reader, &dirs, &files, &batch, SCAN_STEP) > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (now.tv_sec - last.tv_sec) * 1000 +
+	(now.tv_nsec - last.tv_nsec) / 1000000;
+    if(dirs.length + files.length >= limit
+       || (ms >= SCAN_INTERVAL && dirs.length + files.length > 0)) {
+      scanPublish(scan, &dirs, &files, NULL);
+      if(limit < SCAN_BATCH)
+	limit = limit * 2;
+      last = now;
+    }
+  }
+  scanPublish(scan, &dirs, &files, NULL);
+  pthread_mutex_lock(&scan->lock);
+  scan->done = 1;
+  pthread_mutex_unlock(&scan->lock);
+  if(write(scan->notify[1], &byte, 1) < 0) {
+    //Pipe full: the UI has wake-ups pending already.
+  }
+  freeStore(&dirStore);
+  freeStore(&fileStore);
+  return NULL;
+}
+
+/* scanStart: list a directory, reading it in the background. The */
+/* list gets "." and ".." and then whatever the first batch brings. */
+/* Falls back to listFiles() if the thread can't be started. */
+int scanStart(SCAN * scan, LISTDATA * list, int dirFd) {
+  scanCancel(scan);
+  scan->cancelled = 0;		//Also when listFiles() does the job
+  if(scan->notify[0] >= 0 && scan->pool != NULL)
+    return walkStart(scan, list, dirFd);
+  if(scan->notify[0] < 0
+     || openReaderAt(&scan->reader, dirFd, CURRENTDIR) != 0)
+    return listFiles(list, dirFd);
+  scan->done = 0;
+  scan->readyCount = 0;
+  scan->entries = 0;
+  if(pthread_create(&scan->thread, NULL, scanThread, scan) != 0) {
+    closeReader(&scan->reader);
+    return listFiles(list, dirFd);
+  }
+  scan->running = 1;
+  addParents(list);
+  return scanWait(scan, list);
+}
+
+/* scanPump: merge the entries published into the list. Once the */
+/* directory has been read the scan is stopped. Returns VIEW_GROWN */
+/* if entries were added and VIEW_SAME otherwise. */
+int scanPump(SCAN * scan, LISTDATA * list) {
+  ITEMSTORE swap;
+  unsigned count, i;
+  int     done;
+  char    drain[64];
+
+  if(!scan->running)
+    return VIEW_SAME;
+  while(read(scan->notify[0], drain, sizeof(drain)) > 0);
+  pthread_mutex_lock(&scan->lock);
+  swap = scan->ready;		//Take the batch; the scanner goes on
+  scan->ready = scan->taken;	//filling an empty store.
+  scan->taken = swap;
+  count = scan->readyCount;
+  scan->readyCount = 0;
+  done = scan->done;
+  pthread_mutex_unlock(&scan->lock);
+  for(i = 0; i < count; i++)
+    additem(list, scan->taken.blob + scan->taken.itemOffset[i],
+	    scan->taken.blob + scan->taken.pathOffset[i],
+	    scan->taken.type[i]);
+  scan->taken.blobUsed = 0;
+  if(done)
+    scanStop(scan);
+  return (count > 0) ? VIEW_GROWN : VIEW_SAME;
+}
+
+/* scanWait: wait for the first batch (or the end of a small */
+/* directory) so the first screen shows entries. */
+int scanWait(SCAN * scan, LISTDATA * list) {
+  struct pollfd pfd;
+  while(scanPump(scan, list) == VIEW_SAME && scan->running) {
+    pfd.fd = scan->notify[0];
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);		//Until something is published
+  }
+  return 0;
+}
+
+/* scanCancel: stop reading. Readers notice between two reads, so */
+/* this waits for one getdents64() at most. Entries not merged yet */
+/* are dropped. */
+void scanCancel(SCAN * scan) {
+  char    drain[64];
+  int     done = 0;
+  if(!scan->running)
+    return;
+  __atomic_store_n(&scan->cancelled, 1, __ATOMIC_RELEASE);
+  //Tasks still queued finish at once; the last one sets done.
+  while(scan->pool != NULL && !done) {
+    pthread_mutex_lock(&scan->lock);
+    done = scan->done;
+    pthread_mutex_unlock(&scan->lock);
+    if(!done)
+      sched_yield();
+  }
+  scanStop(scan);
+  scan->readyCount = 0;
+  scan->ready.blobUsed = 0;
+  while(read(scan->notify[0], drain, sizeof(drain)) > 0);
+}
+
+// scanStop: the scan is over; let go of its thread or top directory.
+void scanStop(SCAN * scan) {
+  if(scan->pool == NULL) {
+    pthread_join(scan->thread, NULL);
+    closeReader(&scan->reader);
+  } else
+    close(scan->top);
+  scan->running = 0;
+}
+
+/* ---------------------- */
+/* Recursive scan         */
+/* ---------------------- */
+/* With a pool, a scan lists the whole tree under the directory. Each */
+/* directory is a pool task: it is read, its subdirectories become    */
+/* tasks of their own and its entries are published with their path  */
+/* relative to the top, as the one-level scan does. When the rings    */
+/* are full, a task reads the subdirectories it found itself. A set  */
+/* of device/inode pairs makes sure no directory is read twice, so a */
+/* loop in the tree (bind mounts, links followed by the file system) */
+/* ends there. Symbolic links are not followed, as in listFiles().   */
+
+/* scanSeen: record a directory about to be read. Returns 1 if it */
+/* has been read already. */
+int scanSeen(SCAN * scan, dev_t dev, ino_t ino) {
+  DIRID  *table;
+  unsigned size, i, h;
+  int     found = 0;
+  pthread_mutex_lock(&scan->lock);
+  if(2 * (scan->seenCount + 1) > scan->seenSize) {
+    //Grow: rehash into a table twice as big.
+    size = (scan->seenSize == 0) ? SEEN_MIN : scan->seenSize * 2;
+    table = (DIRID *) calloc(size, sizeof(DIRID));
+    if(table == NULL) {
+      pthread_mutex_unlock(&scan->lock);
+      return 0;			//Read it; a loop still ends at maxDepth
+    }
+    for(i = 0; i < scan->seenSize; i++)
+      if(scan->seen[i].ino != 0) {
+	h = DIRID_HASH(scan->seen[i].dev, scan->seen[i].ino) & (size - 1);
+	while(table[h].ino != 0)
+	  h = (h + 1) & (size - 1);
+	table[h] = scan->seen[i];
+      }
+    free(scan->seen);
+    scan->seen = table;
+    scan->seenSize = size;
+  }
+  h = DIRID_HASH(dev, ino) & (scan->seenSize - 1);
+  while(scan->seen[h].ino != 0 && !found) {
+    found = (scan->seen[h].dev == dev && scan->seen[h].ino == ino);
+    h = (h + 1) & (scan->seenSize - 1);
+  }
+  if(!found) {
+    scan->seen[h].dev = dev;
+    scan->seen[h].ino = ino;
+    scan->seenCount++;
+  }
+  pthread_mutex_unlock(&scan->lock);
+  return found;
+}
+
+/* walkNew: directory "name" below "parent" (NULL: the top), to be */
+/* read by a task. Returns NULL if out of memory or the path is too  */
+/* long. */
+WALKDIR *walkNew(SCAN * scan, WALKDIR * parent, const char *name) {
+  WALKDIR *dir;
+  size_t  len = strlen(name) + 1;
+  if(parent != NULL && parent->path[0] != '\0')
+    len = len + strlen(parent->path) + 1;
+  if(len > PATH_MAX)
+    return NULL;
+  dir = (WALKDIR *) malloc(sizeof(WALKDIR) + len);
+  if(dir == NULL)
+    return NULL;
+  dir->scan = scan;
+  dir->depth = (parent == NULL) ? 0 : parent->depth + 1;
+  dir->next = NULL;
+  if(parent != NULL && parent->path[0] != '\0')
+    sprintf(dir->path, "%s/%s", parent->path, name);
+  else
+    strcpy(dir->path, name);
+  return dir;
+}
+
+/* walkDir: read one directory of a recursive scan. Subdirectories   */
+/* are submitted to the pool; the ones that don't fit are put on     */
+/* "stack" for the caller. dirs and files are scratch lists. */
+void walkDir(WALKDIR * dir, LISTDATA * dirs, LISTDATA * files,
+	     WALKDIR ** stack) {
+  SCAN   *scan = dir->scan;
+  DIRREADER reader;
+  STATBATCH batch;
+  struct stat st;
+  WALKDIR *sub;
+  unsigned count, i;
+
+  if(__atomic_load_n(&scan->cancelled, __ATOMIC_ACQUIRE))
+    return;
+  if(openReaderAt(&reader, scan->top,
+		  (dir->path[0] != '\0') ? dir->path : CURRENTDIR) != 0)
+    return;
+  if(fstat(reader.fd, &st) != 0 || scanSeen(scan, st.st_dev, st.st_ino)) {
+    closeReader(&reader);
+    return;
+  }
+  batch.count = 0;
+  do {
+    count = readEntries(&reader, dirs, files, &batch, SCAN_BATCH);
+    //Subdirectories are queued before the entries go out.
+    for(i = 0; dir->depth < scan->maxDepth && i < dirs->length; i++) {
+      sub = walkNew(scan, dir, listPath(dirs, i));
+      if(sub == NULL)
+	continue;
+      __atomic_add_fetch(&scan->pending, 1, __ATOMIC_ACQ_REL);
+      if(poolSubmit(scan->pool, walkTask, sub, 0) != 0) {
+	sub->next = *stack;
+	*stack = sub;
       }
     }
+    scanPublish(scan, dirs, files, dir->path);
+  } while(count > 0 && !__atomic_load_n(&scan->cancelled, __ATOMIC_ACQUIRE));
+  closeReader(&reader);
+}
+
+void walkTask(void *data, unsigned n) {
+/*
+Pool task: read a directory of a recursive scan, and the ones on the
+stack after it. The task that finishes the last directory marks the
+scan done.
+*/
+  WALKDIR *dir = (WALKDIR *) data;
+  WALKDIR *stack = NULL;
+  SCAN   *scan = dir->scan;
+  LISTDATA dirs, files;
+  ITEMSTORE dirStore, fileStore;
+  unsigned left;
+  char    byte = 0;
+
+  (void)n;
+  initList(&dirs);
+  initList(&files);
+  initStore(&dirStore);
+  initStore(&fileStore);
+  dirs.store = &dirStore;
+  files.store = &fileStore;
+  for(;;) {
+    walkDir(dir, &dirs, &files, &stack);
+    free(dir);
+    left = __atomic_sub_fetch(&scan->pending, 1, __ATOMIC_ACQ_REL);
+    if(stack == NULL)
+      break;
+    dir = stack;
+    stack = stack->next;
+  }
+  freeStore(&dirStore);
+  freeStore(&fileStore);
+  if(left == 0) {
+    pthread_mutex_lock(&scan->lock);
+    scan->done = 1;
+    pthread_mutex_unlock(&scan->lock);
+    if(write(scan->notify[1], &byte, 1) < 0) {
+      //Pipe full: the UI has wake-ups pending already.
+    }
+  }
+}
+
+/* walkStart: list a whole tree through the scan's pool. Falls back */
+/* to listFiles() if the directory can't be opened. */
+int walkStart(SCAN * scan, LISTDATA * list, int dirFd) {
+  WALKDIR *top;
+  scan->top = openat(dirFd, CURRENTDIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(scan->top < 0)
+    return listFiles(list, dirFd);
+  top = walkNew(scan, NULL, "");
+  if(top == NULL) {
+    close(scan->top);
+    return listFiles(list, dirFd);
+  }
+  scan->done = 0;
+  scan->cancelled = 0;
+  scan->readyCount = 0;
+  scan->entries = 0;
+  scan->pending = 1;
+  scan->seenCount = 0;
+  if(scan->seen != NULL)
+    memset(scan->seen, 0, scan->seenSize * sizeof(DIRID));
+  if(poolSubmit(scan->pool, walkTask, top, 0) != 0) {
+    free(top);
+    close(scan->top);
+    return listFiles(list, dirFd);
+  }
+  scan->running = 1;
+  addParents(list);
+  return scanWait(scan, list);
+}
+
+/* ---------------------- */
+/* Directory navigation   */
+/* ---------------------- */
+/* The directory listed is held open and everything else is opened   */
+/* relative to it: entering a directory is one openat(), the process  */
+/* never changes its working directory, and paths have no length      */
+/* limit. Symbolic links are never listed, so ".." is the directory   */
+/* we came from and the path shown is worked out from the names, with */
+/* no system calls.                                                   */
+
+/* initNav: start at the current working directory. */
+/* Returns -1 if it can't be opened. */
+int initNav(DIRNAV * nav) {
+  nav->fd = open(CURRENTDIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(nav->fd < 0)
+    return -1;
+  nav->path = getcwd(NULL, 0);	//Any length
+  if(nav->path == NULL)
+    nav->path = strdup(CURRENTDIR);
+  nav->pathLen = (nav->path == NULL) ? 0 : strlen(nav->path);
+  nav->pathSize = nav->pathLen + 1;
+  return 0;
+}
+
+// freeNav: close the directory and forget its path.
+void freeNav(DIRNAV * nav) {
+  if(nav->fd >= 0)
+    close(nav->fd);
+  free(nav->path);
+  nav->fd = -1;
+  nav->path = NULL;
+}
+
+/* navEnter: go into directory "name" of the one listed (".." for  */
+/* its parent). Returns -1 if it can't be opened: we stay where we */
+/* are. */
+int navEnter(DIRNAV * nav, const char *name) {
+  size_t  len = strlen(name), newSize;
+  char   *slash;
+  void   *ptr;
+  int     fd;
+
+  fd = openat(nav->fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd < 0)
+    return -1;
+  close(nav->fd);
+  nav->fd = fd;
+  if(nav->path == NULL)
+    return 0;
+  if(strcmp(name, CHANGEDIR) == 0) {
+    //Drop the last name; "/" stays "/".
+    slash = strrchr(nav->path, '/');
+    if(slash != NULL) {
+      nav->pathLen = (slash == nav->path) ? 1 : (size_t)(slash - nav->path);
+      nav->path[nav->pathLen] = '\0';
+    }
+    return 0;
   }
-  closedir(d);
-
-  //Find files and add them to list after directories
-  d = opendir(directory);
-  if(d) {
-    while((dir = readdir(d)) != NULL) {
-      if(dir->d_type == DT_REG) {
-	//only list valid fiels
-	if(strlen(dir->d_name) > MAX_ITEM_LENGTH) {
-	  for(i = 0; i < MAX_ITEM_LENGTH; i++) {
-	    temp[i] = dir->d_name[i];
-	  }
-	} else {
-	  strcpy(temp, dir->d_name);
-	  //Add spaces
-	  addSpaces(temp);
+  if(nav->pathLen + len + 2 > nav->pathSize) {
+    newSize = nav->pathSize * 2;
+    while(nav->pathLen + len + 2 > newSize)
+      newSize = newSize * 2;
+    ptr = realloc(nav->path, newSize);
+    if(ptr == NULL)
+      return 0;			//Only the path shown is out of date
+    nav->path = (char *)ptr;
+    nav->pathSize = newSize;
+  }
+  if(nav->pathLen == 0 || nav->path[nav->pathLen - 1] != '/')
+    nav->path[nav->pathLen++] = '/';
+  memcpy(nav->path + nav->pathLen, name, len + 1);
+  nav->pathLen = nav->pathLen + len;
+  return 0;
+}
+
+int changeDir(SCROLLDATA * scrollData, DIRNAV * nav) {
+//Change dir to the directory selected. Returns -1 if we stay: a file
+//was picked or the directory can't be opened.
+  if(scrollData->isDirectory != DIRECTORY)
+    return -1;
+  return navEnter(nav, (scrollData->itemIndex == 1) ? CHANGEDIR :
+		  scrollData->path);
+}
+
+/* ---------------------- */
+/* Directory cache        */
+/* ---------------------- */
+/* Listings are kept after use, most recently used first, keyed by   */
+/* the device and inode of the directory. An inotify watch is put on */
+/* a directory before it is read; any entry created, deleted or      */
+/* moved in it (or the directory itself going) drops its listing, so */
+/* a listing found in the cache is still right and costs no I/O.     */
+/* The least recently used listings go once maxBytes are in use.     */
+
+/* initCache: set up an empty cache of up to maxBytes (0: off). */
+/* Without inotify nothing is cached. */
+void initCache(DIRCACHE * cache, size_t maxBytes) {
+  cache->head = NULL;
+  cache->tail = NULL;
+  cache->count = 0;
+  cache->bytes = 0;
+  cache->maxBytes = maxBytes;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->keyValid = 0;
+  cache->watchFd = -1;
+  if(maxBytes > 0)
+    cache->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+// freeCache: drop every listing and the watches.
+void freeCache(DIRCACHE * cache) {
+  while(cache->head != NULL)
+    cacheDrop(cache, cache->head);
+  if(cache->watchFd >= 0)
+    close(cache->watchFd);
+  cache->watchFd = -1;
+}
+
+// cacheDrop: forget one listing.
+void cacheDrop(DIRCACHE * cache, CACHEDIR * dir) {
+  if(dir->prev == NULL)
+    cache->head = dir->next;
+  else
+    dir->prev->next = dir->next;
+  if(dir->next == NULL)
+    cache->tail = dir->prev;
+  else
+    dir->next->prev = dir->prev;
+  inotify_rm_watch(cache->watchFd, dir->wd);
+  cache->bytes = cache->bytes - dir->bytes;
+  cache->count--;
+  freeStore(&dir->items);
+  free(dir);
+}
+
+/* cachePoll: read the inotify events waiting and drop the listings */
+/* they are about. A directory being read is marked changed. */
+void cachePoll(DIRCACHE * cache) {
+  char    buffer[CACHE_EVENTS]
+      __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *event;
+  CACHEDIR *dir, *next;
+  ssize_t count;
+  char   *at;
+
+  if(cache->watchFd < 0)
+    return;
+  while((count = read(cache->watchFd, buffer, sizeof(buffer))) > 0)
+    for(at = buffer; at < buffer + count;
+	at = at + sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event *)at;
+      if(event->mask & IN_Q_OVERFLOW) {
+	//Events were lost: nothing can be trusted.
+	for(dir = cache->head; dir != NULL; dir = next) {
+	  next = dir->next;
+	  cacheDrop(cache, dir);
 	}
-	*listBox1 =
-	    addend(*listBox1, newelement(temp, dir->d_name, FILEITEM));
+	cache->keyValid = 0;
+	continue;
       }
+      if(cache->keyValid && event->wd == cache->keyWd)
+	cache->keyValid = 0;
+      for(dir = cache->head; dir != NULL; dir = dir->next)
+	if(dir->wd == event->wd) {
+	  cacheDrop(cache, dir);
+	  break;
+	}
     }
-    closedir(d);
+}
+
+/* cacheLoad: fill an empty list with the cached listing of directory. */
+/* Returns 1 on a hit. On a miss a watch is put on the directory, to */
+/* be kept by cacheSave() once it has been read, and 0 is returned.   */
+int cacheLoad(DIRCACHE * cache, LISTDATA * list, int dirFd) {
+  struct stat st;
+  CACHEDIR *dir;
+  unsigned i;
+  char    proc[32];
+
+  cache->keyValid = 0;
+  if(cache->watchFd < 0 || fstat(dirFd, &st) != 0)
+    return 0;
+  cachePoll(cache);
+  for(dir = cache->head; dir != NULL; dir = dir->next)
+    if(dir->dev == st.st_dev && dir->ino == st.st_ino)
+      break;
+  if(dir == NULL) {
+    cache->misses++;
+    cache->keyDev = st.st_dev;
+    cache->keyIno = st.st_ino;
+    //inotify wants a path: the directory's own, through /proc.
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", dirFd);
+    cache->keyWd = inotify_add_watch(cache->watchFd, proc, CACHE_MASK);
+    cache->keyValid = (cache->keyWd >= 0);
+    return 0;
   }
-  return 0;
+  cache->hits++;
+  //Most recently used first
+  if(dir != cache->head) {
+    dir->prev->next = dir->next;
+    if(dir->next == NULL)
+      cache->tail = dir->prev;
+    else
+      dir->next->prev = dir->prev;
+    dir->prev = NULL;
+    dir->next = cache->head;
+    cache->head->prev = dir;
+    cache->head = dir;
+  }
+  for(i = 0; i < dir->length; i++)
+    additem(list, dir->items.blob + dir->items.itemOffset[i],
+	    dir->items.blob + dir->items.pathOffset[i], dir->items.type[i]);
+  return 1;
 }
 
-void changeDir(SCROLLDATA * scrollData, char fullPath[MAX],
-	       char newDir[MAX]) {
-//Change dir
-  char    oldPath[MAX];
-  if(scrollData->isDirectory == DIRECTORY) {
-    if(scrollData->itemIndex == 1) {
-      //cd ..
-      cleanString(fullPath, MAX);
-      cleanString(oldPath, MAX);
-      cleanString(newDir, MAX);
-      chdir("..");
-      getcwd(oldPath, sizeof(oldPath));
-      strcpy(newDir, oldPath);
-      strcpy(fullPath, oldPath);
-    } else {
-      //cd newDir
-      cleanString(fullPath, MAX);
-      cleanString(newDir, MAX);
-      cleanString(oldPath, MAX);
-      getcwd(oldPath, sizeof(oldPath));
-      strcat(oldPath, "/");
-      strcat(oldPath, scrollData->path);
-      chdir(oldPath);
-      strcpy(newDir, oldPath);
-      strcpy(fullPath, oldPath);
+/* cacheSave: keep the listing of the directory cacheLoad() missed, */
+/* unless it changed while being read or complete is 0. */
+void cacheSave(DIRCACHE * cache, LISTDATA * list, int complete) {
+  CACHEDIR *dir;
+  unsigned i;
+
+  cachePoll(cache);
+  if(!cache->keyValid || !complete) {
+    if(cache->keyValid)
+      inotify_rm_watch(cache->watchFd, cache->keyWd);
+    cache->keyValid = 0;
+    return;
+  }
+  cache->keyValid = 0;
+  dir = (CACHEDIR *) malloc(sizeof(CACHEDIR));
+  if(dir == NULL) {
+    inotify_rm_watch(cache->watchFd, cache->keyWd);
+    return;
+  }
+  dir->dev = cache->keyDev;
+  dir->ino = cache->keyIno;
+  dir->wd = cache->keyWd;
+  dir->length = list->length;
+  initStore(&dir->items);
+  for(i = 0; i < list->length; i++)
+    if(storeAppend(&dir->items, i, listItem(list, i), listPath(list, i),
+		   listType(list, i)) != 0)
+      break;
+  dir->bytes = sizeof(CACHEDIR) + dir->items.blobSize +
+      dir->items.capacity * (2 * sizeof(size_t) + 1);
+  if(i < list->length || dir->bytes > cache->maxBytes) {
+    //Out of memory or too big to keep: the others stay.
+    inotify_rm_watch(cache->watchFd, dir->wd);
+    freeStore(&dir->items);
+    free(dir);
+    return;
+  }
+  dir->prev = NULL;
+  dir->next = cache->head;
+  if(cache->head == NULL)
+    cache->tail = dir;
+  else
+    cache->head->prev = dir;
+  cache->head = dir;
+  cache->count++;
+  cache->bytes = cache->bytes + dir->bytes;
+  //Least recently used go first
+  while(cache->bytes > cache->maxBytes && cache->tail != NULL)
+    cacheDrop(cache, cache->tail);
+}
+
+/* ---------------------- */
+/* Directory history      */
+/* ---------------------- */
+/* Directories visited are kept in order, with the item selected in   */
+/* each when we left, so Left and Right go back and forward and ".."  */
+/* lands on the directory we came out of. Each one holds its own fd:  */
+/* going back needs no path. The listing left is moved out of listBox1 */
+/* (not copied) and moved back on return, in the order it was shown,  */
+/* unless the directory changed since (its mtime or ctime moved).     */
+/* Listings farthest from the current directory go first once        */
+/* maxBytes are in use; their places are kept.                        */
+
+// initHistory: set up an empty history keeping up to maxBytes of listings.
+void initHistory(HISTORY * history, size_t maxBytes) {
+  history->count = 0;
+  history->current = 0;
+  history->bytes = 0;
+  history->maxBytes = maxBytes;
+}
+
+// freeHistory: forget every directory.
+void freeHistory(HISTORY * history) {
+  while(history->count > 0)
+    histDrop(history, history->count - 1);
+  history->current = 0;
+}
+
+// histForget: drop the listing a directory holds; its place stays.
+void histForget(HISTORY * history, HISTDIR * dir) {
+  if(!dir->kept)
+    return;
+  freeArena(&dir->arena);
+  freeStore(&dir->store);
+  free(dir->list.table);
+  history->bytes = history->bytes - dir->bytes;
+  dir->kept = 0;
+}
+
+/* histDrop: forget directory n; those after it move down one. */
+void histDrop(HISTORY * history, unsigned n) {
+  HISTDIR *dir = &history->dirs[n];
+  histForget(history, dir);
+  freeNav(&dir->nav);
+  free(dir->selected);
+  history->count--;
+  memmove(dir, dir + 1, (history->count - n) * sizeof(HISTDIR));
+  if(history->current > n)
+    history->current--;
+}
+
+/* histTrim: drop the listings farthest from the current directory */
+/* until maxBytes are in use. With keepCurrent its own stays.      */
+void histTrim(HISTORY * history, int keepCurrent) {
+  unsigned i, far, distance, best;
+  while(history->bytes > history->maxBytes) {
+    far = history->count;
+    best = 0;
+    for(i = 0; i < history->count; i++) {
+      distance = (i > history->current) ? i - history->current :
+	  history->current - i;
+      if(history->dirs[i].kept && distance >= best
+	 && (distance > 0 || !keepCurrent)) {
+	far = i;
+	best = distance;
+      }
     }
+    if(far == history->count)
+      break;
+    histForget(history, &history->dirs[far]);
+  }
+}
+
+/* histVisit: note that nav is the directory listed now. One next to */
+/* the current directory in the history (we went back up with "..", */
+/* or down again) becomes the current one; any other is added after */
+/* it, in place of those we had gone back from. Returns -1 if the   */
+/* directory can't be kept (it is listed as a new one).              */
+int histVisit(HISTORY * history, DIRNAV * nav) {
+  HISTDIR *dir;
+  struct stat st;
+  unsigned n = history->current;
+
+  if(fstat(nav->fd, &st) != 0)
+    return -1;
+  if(history->count > 0) {
+    dir = &history->dirs[n];
+    if(dir->dev == st.st_dev && dir->ino == st.st_ino) {
+      //Entered again (a link to itself): it starts at the top.
+      free(dir->selected);
+      dir->selected = NULL;
+      dir->itemIndex = 0;
+      dir->currentListIndex = 0;
+      return 0;
+    }
+    if(n > 0 && dir[-1].dev == st.st_dev && dir[-1].ino == st.st_ino) {
+      history->current--;
+      histTrim(history, 0);
+      return 0;
+    }
+    if(n + 1 < history->count && dir[1].dev == st.st_dev
+       && dir[1].ino == st.st_ino) {
+      history->current++;
+      histTrim(history, 0);
+      return 0;
+    }
+    while(history->count > n + 1)
+      histDrop(history, history->count - 1);
+    if(history->count == HISTORY_DEPTH)
+      histDrop(history, 0);	//Oldest first
+  }
+  dir = &history->dirs[history->count];
+  dir->nav.fd = fcntl(nav->fd, F_DUPFD_CLOEXEC, 0);
+  if(dir->nav.fd < 0)
+    return -1;
+  dir->nav.path = (nav->path == NULL) ? NULL : strdup(nav->path);
+  dir->nav.pathLen = (dir->nav.path == NULL) ? 0 : nav->pathLen;
+  dir->nav.pathSize = dir->nav.pathLen + 1;
+  dir->dev = st.st_dev;
+  dir->ino = st.st_ino;
+  dir->kept = 0;
+  dir->itemIndex = 0;
+  dir->currentListIndex = 0;
+  dir->selected = NULL;
+  history->current = history->count++;
+  histTrim(history, 0);
+  return 0;
+}
+
+/* histGo: go "step" directories back (-1) or forward (1) in the    */
+/* history. Returns -1 if there is none there: we stay where we are. */
+int histGo(HISTORY * history, DIRNAV * nav, int step) {
+  HISTDIR *dir;
+  char   *path = NULL;
+  int     fd;
+
+  if((step < 0 && history->current < (unsigned)-step)
+     || history->current + step >= history->count)
+    return -1;
+  dir = &history->dirs[history->current + step];
+  fd = fcntl(dir->nav.fd, F_DUPFD_CLOEXEC, 0);
+  if(fd < 0)
+    return -1;
+  if(dir->nav.path != NULL && (path = strdup(dir->nav.path)) == NULL) {
+    close(fd);
+    return -1;
+  }
+  close(nav->fd);
+  free(nav->path);
+  nav->fd = fd;
+  nav->path = path;
+  nav->pathLen = (path == NULL) ? 0 : dir->nav.pathLen;
+  nav->pathSize = nav->pathLen + 1;
+  history->current = history->current + step;
+  histTrim(history, 0);
+  return 0;
+}
+
+/* histLeave: keep the place of the current directory, the item */
+/* passed by listBox(), and its listing if complete. listBox1 is */
+/* left empty then. The listing stays until we have gone on, so  */
+/* the item's strings can still be used.                          */
+void histLeave(HISTORY * history, SCROLLDATA * scrollData,
+	       LISTDATA * list, SORTER * sort, int complete) {
+  HISTDIR *dir;
+  unsigned generation = list->generation;
+
+  if(history->count == 0)
+    return;
+  dir = &history->dirs[history->current];
+  free(dir->selected);
+  dir->selected = NULL;
+  dir->itemIndex = scrollData->itemIndex;
+  dir->currentListIndex = scrollData->currentListIndex;
+  if(scrollData->itemIndex < list->length)
+    dir->selected = strdup(listPath(list, scrollData->itemIndex));
+  histForget(history, dir);
+  if(!complete || history->maxBytes == 0 || list->length == 0)
+    return;
+  dir->shown = (sort->list == list && sort->generation == generation) ?
+      sort->shown : SORT_NONE;
+  freeKeys(sort);		//They point into the listing
+  dir->list = *list;
+  dir->bytes = listBytes(list);
+  if(list->arena != NULL) {
+    dir->arena = *list->arena;
+    initArena(list->arena, list->arena->slabSize);
+  } else
+    initArena(&dir->arena, ARENA_SLAB_SIZE);
+  if(list->store != NULL) {
+    dir->store = *list->store;
+    initStore(list->store);
+  } else
+    initStore(&dir->store);
+  dir->kept = 1;
+  history->bytes = history->bytes + dir->bytes;
+  histTrim(history, 1);
+  //An empty list, with a generation the listing kept never had
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->table = NULL;
+  list->tableSize = 0;
+  list->generation = generation + 1;
+}
+
+/* histLoad: fill an empty list with the listing the current directory */
+/* kept, if it has not changed since. Returns 1 if it did. Else the   */
+/* directory is noted as it is before being read, and 0 is returned.  */
+int histLoad(HISTORY * history, LISTDATA * list, SORTER * sort, int dirFd) {
+  HISTDIR *dir;
+  struct stat st;
+  unsigned generation = list->generation + 1;
+
+  if(history->count == 0)
+    return 0;
+  dir = &history->dirs[history->current];
+  if(fstat(dirFd, &st) != 0) {
+    histForget(history, dir);
+    return 0;
+  }
+  if(dir->kept && dir->mtime.tv_sec == st.st_mtim.tv_sec
+     && dir->mtime.tv_nsec == st.st_mtim.tv_nsec
+     && dir->ctime.tv_sec == st.st_ctim.tv_sec
+     && dir->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+    //Storage goes back where listBox1 keeps it.
+    if(list->arena != NULL) {
+      freeArena(list->arena);
+      *list->arena = dir->arena;
+    } else
+      freeArena(&dir->arena);
+    if(list->store != NULL) {
+      freeStore(list->store);
+      *list->store = dir->store;
+    } else
+      freeStore(&dir->store);
+    free(list->table);
+    dir->list.arena = list->arena;
+    dir->list.store = list->store;
+    //Numbered after anything listBox1 held, so nothing takes it
+    //for a listing filtered or sorted before.
+    if(dir->list.tableGeneration == dir->list.generation)
+      dir->list.tableGeneration = generation;
+    dir->list.generation = generation;
+    *list = dir->list;
+    history->bytes = history->bytes - dir->bytes;
+    dir->kept = 0;
+    sortAdopt(sort, list, dir->shown);
+    return 1;
   }
+  histForget(history, dir);
+  dir->mtime = st.st_mtim;
+  dir->ctime = st.st_ctim;
+  return 0;
+}
+
+/* histPlace: select the item we left the current directory on, */
+/* found by name if the listing changed, on the same row if it   */
+/* can be. Else the listing starts at the top.                   */
+void histPlace(HISTORY * history, SCROLLDATA * scrollData,
+	       LISTDATA * list) {
+  HISTDIR *dir;
+  unsigned i, row;
+
+  scrollData->itemIndex = 0;
+  scrollData->currentListIndex = 0;
+  if(history->count == 0)
+    return;
+  dir = &history->dirs[history->current];
+  if(dir->selected == NULL)
+    return;
+  i = dir->itemIndex;
+  if(i >= list->length || strcmp(listPath(list, i), dir->selected) != 0)
+    for(i = 0; i < list->length; i++)
+      if(strcmp(listPath(list, i), dir->selected) == 0)
+	break;
+  if(i == list->length)
+    return;
+  row = (dir->itemIndex >= dir->currentListIndex) ?
+      dir->itemIndex - dir->currentListIndex : 0;
+  scrollData->itemIndex = i;
+  scrollData->currentListIndex = (i >= row) ? i - row : 0;	//listBox() fits it
 }
 
 /* ---------------- */
@@ -747,22 +6075,73 @@ void changeDir(SCROLLDATA * scrollData, char fullPath[MAX],
   
   Usage:
    
-  listBox(headpointer, whereX, whereY, scrollData, backColor0, foreColor0,
-backcolor1, forecolor1, displayLimit); */
+  listBox(list, whereX, whereY, scrollData, backColor0, foreColor0,
+backcolor1, forecolor1, displayLimit);
+
+  Command line:
+
+  listfiles [-r] [-d depth] [-n entries] [-c MB] [-H MB] [-s mode]
+    -r  list the whole tree under each directory, paths relative to it
+    -d  levels -r goes down at most (default WALK_DEPTH)
+    -n  entries listed at most (default WALK_ENTRIES)
+    -c  memory kept for listings of directories visited (default
+        CACHE_BYTES, 0: none; -r listings are not kept)
+    -H  memory kept for listings in the history (default HISTORY_BYTES,
+        0: only the places; -r listings are not kept). Left and Right
+        go back and forward through the directories visited.
+    -s  sort mode: none, name, natural, locale, size, mtime or ext
+        (default SORT_MODE; F2 goes to the next one) */
 
 /*========================================================================*/
 
-int main() {
+int main(int argc, char *argv[]) {
   SCROLLDATA scrollData;
   char    ch;
-  char    fullPath[MAX];
-  char    newDir[MAX];
+  int     recursive = 0, columns = 0, uring = 0, scanned, i;
+  unsigned maxDepth = WALK_DEPTH, maxEntries = WALK_ENTRIES;
+  size_t  cacheBytes = CACHE_BYTES, historyBytes = HISTORY_BYTES;
+  int     sortMode = SORT_MODE;
+  DIRNAV  nav;			//Directory listed
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-r") == 0)
+      recursive = 1;
+    else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+      maxDepth = (unsigned)strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      maxEntries = (unsigned)strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      cacheBytes = (size_t)strtoul(argv[++i], NULL, 10) << 20;
+    else if(strcmp(argv[i], "-H") == 0 && i + 1 < argc)
+      historyBytes = (size_t)strtoul(argv[++i], NULL, 10) << 20;
+    else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc
+	    && sortModeOf(argv[i + 1]) >= 0)
+      sortMode = sortModeOf(argv[++i]);
+    else if(strcmp(argv[i], "-l") == 0)
+      columns = COLUMNS_WIDTH;	//Size, permissions, mtime and owner
+    else if(strcmp(argv[i], "-u") == 0)
+      uring = 1;		//Metadata in batches through io_uring
+    else {
+      fprintf(stderr, "Usage: %s [-r] [-d depth] [-n entries] [-c MB] "
+	      "[-H MB] [-s mode] [-l] [-u]\n", argv[0]);
+      return 1;
+    }
+  }
+  //We start at current dir
+  if(initNav(&nav) != 0) {
+    perror(CURRENTDIR);
+    return 1;
+  }
+  //Names sort by the user's locale in -s locale
+  setlocale(LC_COLLATE, "");
+  //All drawing goes through the frame buffer
+  if(initScreen(&screen1) != 0)
+    freeScreen(&screen1);
+  //Keyboard stays in no-echo mode until we leave
+  openTerm();
   //Change background color
   outputcolor(F_WHITE, B_BLUE);
   clear();
 
-  strcpy(newDir, ".");		//We start at current dir
-  getcwd(fullPath, sizeof(fullPath));	//Get path
   scrollData.scrollActive=0;	//To know whether scroll is active or not.
   scrollData.scrollLimit=0;		//Last index for scroll.
   scrollData.listLength=0;		//Total no. of items in the list
@@ -780,44 +6159,143 @@ int main() {
   scrollData.item =NULL;
   scrollData.path =NULL;
   scrollData.itemIndex=0;
+  scrollData.list=NULL;
+  initFilter(&filter1);
+  scrollData.filter=&filter1;	//Typing narrows the list
+  scrollData.scan=NULL;
+  if(USE_THREADS && initPool(&pool1, sysconf(_SC_NPROCESSORS_ONLN)) == 0) {
+    filter1.pool = &pool1;	//Searches run in the background
+    term1.wakeFd[0] = pool1.notify[0];
+  }
+  initSorter(&sort1);
+  sort1.mode = sortMode;
+  sort1.uring = uring;
+  scrollData.sort = &sort1;	//Listings are shown in order
+  if(filter1.pool != NULL) {
+    sort1.pool = &pool1;	//Big ones are sorted in the background
+    term1.wakeFd[2] = sort1.notify[0];
+  }
+  if(USE_THREADS) {
+    initScan(&scan1);
+    scrollData.scan = &scan1;	//Directories are read in the background
+    term1.wakeFd[1] = scan1.notify[0];
+    scan1.maxDepth = maxDepth;
+    scan1.maxEntries = maxEntries;
+    if(recursive
+       && initPool(&walkPool1, sysconf(_SC_NPROCESSORS_ONLN)) == 0)
+      scan1.pool = &walkPool1;	//Whole trees, read in parallel
+  }
+  if(columns) {
+    initMeta(&meta1, USE_THREADS, uring);
+    scrollData.meta = &meta1;	//Rows on view are stat'ed in the background
+    term1.wakeFd[3] = meta1.notify[0];
+  } else
+    scrollData.meta = NULL;
+  //Tree listings change under every subdirectory: they are not kept.
+  initCache(&cache1, recursive ? 0 : cacheBytes);
+  initHistory(&history1, recursive ? 0 : historyBytes);
+  histVisit(&history1, &nav);
+  initArena(&listArena, ARENA_SLAB_SIZE);
+  listBox1.arena = &listArena;	//Items are bump-allocated
+  initStore(&listStore);
+  if(USE_ITEMSTORE)
+    listBox1.store = &listStore;	//Opt-in packed backend
   //LISTCHOICE *head;		//store head of the list
 
   //Directories loop
   do {
-    draw_window(9, 7, 31, 19, B_BLACK);	//shadow
-    draw_window(8, 6, 30, 18, B_WHITE);	//window
+    draw_window(9, 7, 31 + columns, 19, B_BLACK);	//shadow
+    draw_window(8, 6, 30 + columns, 18, B_WHITE);	//window
 
-    //Add items to list
-    if(listBox1 == NULL) 
-      listFiles(&listBox1, newDir);
-    ch = listBox(listBox1, 10, 7, &scrollData, B_WHITE, F_BLACK, B_BLUE,
+    //Names in the list are relative to the directory listed
+    sort1.dirFd = nav.fd;
+    if(scrollData.meta != NULL)
+      metaDir(&meta1, nav.fd);
+
+    //Add items to list: the one kept by the history, a cached one,
+    //or the directory is read.
+    scanned = 0;
+    if(query_length(&listBox1) == 0
+       && histLoad(&history1, &listBox1, &sort1, nav.fd) == 0
+       && cacheLoad(&cache1, &listBox1, nav.fd) == 0) {
+      scanned = (scrollData.scan != NULL);
+      if(scrollData.scan != NULL)
+	scanStart(&scan1, &listBox1, nav.fd);
+      else
+	listFiles(&listBox1, nav.fd);
+    }
+    //A complete listing is put in order before it is shown.
+    if(scrollData.scan == NULL || !scan1.running)
+      sortStart(&sort1, &listBox1);
+    //Back on the item we left, if we have been here before.
+    histPlace(&history1, &scrollData, &listBox1);
+    ch = listBox(&listBox1, 10, 7, &scrollData, B_WHITE, F_BLACK, B_BLUE,
 		 FH_WHITE, 10);
+    //Keep the listing, unless leaving cut the scan short
+    cacheSave(&cache1, &listBox1, !scanned || !scan1.cancelled);
+
+    //Info Item selected. Its strings are in the listing.
+    cleanLine(21, B_BLUE, F_BLUE);
+    gotoxy(1, 21);
+    outputcolor(FH_WHITE, B_BLUE);
+    outputf("Item selected: %s | Index: %d | Key : %d\n",
+	   scrollData.path, scrollData.itemIndex, ch);
+
+    //The history keeps the place we leave, and the listing.
+    histLeave(&history1, &scrollData, &listBox1, &sort1,
+	      !scanned || !scan1.cancelled);
 
-    //Change Dir. New directory is copied in newDir
-    if (scrollData.itemIndex!=0) changeDir(&scrollData, fullPath, newDir);
+    //Change Dir. The new directory is opened from the one listed
+    if(ch == HISTORY_BACK || ch == HISTORY_FORWARD)
+      histGo(&history1, &nav, (ch == HISTORY_BACK) ? -1 : 1);
+    else if (scrollData.itemIndex!=0) {
+      //A file picked: we stay, on the same item.
+      if(changeDir(&scrollData, &nav) == 0)
+	histVisit(&history1, &nav);
+    }
 
     //Display current path
     cleanLine(22, B_BLUE, F_BLUE);
     outputcolor(F_WHITE, B_BLUE);
     gotoxy(1, 22);
-    printf("Current Path: %s", fullPath);
+    outputf("Current Path: %s", (nav.path != NULL) ? nav.path : "");
 
-    //Info Item selected.
-    cleanLine(21, B_BLUE, F_BLUE);
-    gotoxy(1, 21);
-    outputcolor(FH_WHITE, B_BLUE);
-    printf("Item selected: %s | Index: %d | Key : %d\n",
-	   scrollData.path, scrollData.itemIndex, ch);
+    //Cache counters
+    cleanLine(23, B_BLUE, F_BLUE);
+    gotoxy(1, 23);
+    outputcolor(F_WHITE, B_BLUE);
+    outputf("Cache: %u hits | %u misses | %u listings | %lu KB",
+	    cache1.hits, cache1.misses, cache1.count,
+	    (unsigned long)(cache1.bytes >> 10));
 
-    if(listBox1 != NULL) {
+    if(query_length(&listBox1) != 0) {
 		deleteList(&listBox1);
-		listBox1 = NULL;
     }
-  } while(scrollData.itemIndex != 0);
+  } while(scrollData.itemIndex != 0 || ch != K_ENTER);
+ freeHistory(&history1);
+ freeArena(&listArena);
+ freeStore(&listStore);
+ freeCache(&cache1);
+ freeSorter(&sort1);		//Before the pool its tasks run on
+ if(scrollData.meta != NULL)
+   freeMeta(&meta1);
+ if(filter1.pool != NULL) {
+   filterCancel(&filter1);	//Workers finish the tasks still queued
+   freePool(&pool1);
+ }
+ freeFilter(&filter1);
+ if(scan1.pool != NULL)
+   freePool(&walkPool1);	//Tasks are finished: the scan was cancelled
+ if(scrollData.scan != NULL)
+   freeScan(&scan1);
+ freeNav(&nav);
  //Restore colors.
   outputcolor(F_WHITE, B_BLACK);
   clear();
+  flushScreen();
+  freeScreen(&screen1);
   printf("\n");
+  closeTerm();
   return 0;
 
 }
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
@@ -36,6 +37,17 @@
 #define K_UP_ARROW 'A'		// K_ESCAPE + 'A' -> UP_ARROW
 #define K_DOWN_ARROW 'B'	// K_ESCAPE + 'B' -> DOWN_ARROW
 
+#define TERM_BUFFER 64		//Bytes read from the keyboard at once
+
+typedef struct _termsession {
+  struct termios saved;		// Settings restored on exit
+  int     active;		// Terminal settings changed
+  int     open;			// getch() reads through the buffer
+  char    buffer[TERM_BUFFER];	// Keys read ahead
+  int     bufferUsed;
+  int     bufferPos;
+} TERMSESSION;
+
 typedef struct _listchoice {
   unsigned index;		// Item number
   char   *item;			// Item string
@@ -43,6 +55,13 @@ typedef struct _listchoice {
   struct _listchoice *back;	// Pointer to previous item
 } LISTCHOICE;
 
+typedef struct _listdata {
+  LISTCHOICE *head;		// First item of the list
+  LISTCHOICE *tail;		// Last item of the list
+  unsigned length;		// No. of items in the list
+  unsigned generation;		// Bumped on every add/remove
+} LISTDATA;
+
 typedef struct _scrolldata {
   unsigned scrollActive;	//To know whether scroll is active or not.
   unsigned scrollLimit;		//Last index for scroll.
@@ -62,8 +81,9 @@ typedef struct _scrolldata {
 } SCROLLDATA;
 
 static struct termios old, new;
+TERMSESSION term1;		//Keyboard session.
 
-LISTCHOICE *listBox1 = NULL;	//Head pointer.
+LISTDATA listBox1 = { NULL, NULL, 0, 0 };	//Head/tail pointers.
 
 /* PROTOTYPES */
 
@@ -74,17 +94,23 @@ void    outputcolor(int foreground, int background);
 void    initTermios(int echo);
 void    resetTermios(void);
 char    getch();
+int     openTerm(void);
+void    closeTerm(void);
+void    restoreTerm(void);
+void    termSignal(int sig);
 
 //LIST FUNCTIONS
 
-void 	   deleteL(LISTCHOICE **head); 
+void    initList(LISTDATA * list);
+void    deleteL(LISTDATA * list);
 LISTCHOICE *deleteList(LISTCHOICE * head);
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp);
 LISTCHOICE *newelement(char *text);
-LISTCHOICE *addfront(LISTCHOICE * head, LISTCHOICE * newp);
+void    addend(LISTDATA * list, LISTCHOICE * newp);
+void    addfront(LISTDATA * list, LISTCHOICE * newp);
+void    addlist(LISTDATA * list, LISTDATA * items);
 LISTCHOICE *delelement(LISTCHOICE *head, char *text);
-void    addItems(LISTCHOICE ** listBox1);
-void    listBox(LISTCHOICE * head, unsigned whereX, unsigned whereY,
+void    addItems(LISTDATA * listBox1);
+void    listBox(LISTDATA * list, unsigned whereX, unsigned whereY,
 		SCROLLDATA * scrollData, unsigned bColor0,
 		unsigned fColor0, unsigned bColor1, unsigned fColor1,
 		unsigned displayLimit);
@@ -94,7 +120,7 @@ void    loadlist(LISTCHOICE * head, SCROLLDATA * scrollData,
 void    gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
 		  unsigned indexAt);
 
-int     query_length(LISTCHOICE ** head);
+unsigned query_length(LISTDATA * list);
 int     move_up(LISTCHOICE ** head, SCROLLDATA * scrollData);
 int     move_down(LISTCHOICE ** head, SCROLLDATA * scrollData);
 
@@ -131,10 +157,74 @@ void resetTermios(void) {
 /* Read 1 character - no echo */
 char getch() {
   char    ch;
-  initTermios(0);
-  ch = getchar();
-  resetTermios();
-  return ch;
+  fflush(stdout);		//Show what was drawn before waiting
+  if(!term1.open) {
+    initTermios(0);
+    ch = getchar();
+    resetTermios();
+    return ch;
+  }
+  if(term1.bufferPos == term1.bufferUsed) {
+    //Buffer empty: one read() for whatever keys are waiting.
+    term1.bufferPos = 0;
+    term1.bufferUsed = read(STDIN_FILENO, term1.buffer, TERM_BUFFER);
+    if(term1.bufferUsed <= 0) {
+      term1.bufferUsed = 0;
+      return EOF;
+    }
+  }
+  return term1.buffer[term1.bufferPos++];
+}
+
+/* ------------------------------ */
+/* Terminal session routines      */
+/* ------------------------------ */
+/* The terminal is switched to non-canonical, no-echo mode once by     */
+/* openTerm() and restored by closeTerm(), at exit or on a fatal signal. */
+/* getch() then only costs a read() when its buffer is empty.          */
+
+void restoreTerm(void) {
+//Put the terminal settings back if the session changed them.
+  if(term1.active) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &term1.saved);
+    term1.active = 0;
+  }
+}
+
+void termSignal(int sig) {
+//Fatal signal: restore the terminal, then die the default way.
+  restoreTerm();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+int openTerm(void) {
+  struct termios raw;
+  term1.bufferUsed = 0;
+  term1.bufferPos = 0;
+  term1.open = 1;
+  if(tcgetattr(STDIN_FILENO, &term1.saved) != 0)
+    return -1;			//Not a terminal: reads still go through the buffer.
+  raw = term1.saved;
+  raw.c_lflag &= ~(ICANON | ECHO);	/* disable buffered i/o and echo */
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if(tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+    return -1;
+  term1.active = 1;
+  atexit(restoreTerm);
+  signal(SIGINT, termSignal);
+  signal(SIGTERM, termSignal);
+  signal(SIGHUP, termSignal);
+  signal(SIGQUIT, termSignal);
+  signal(SIGSEGV, termSignal);
+  signal(SIGABRT, termSignal);
+  return 0;
+}
+
+void closeTerm(void) {
+  restoreTerm();
+  term1.open = 0;
 }
 
 /* Dynamic List routines */
@@ -150,7 +240,7 @@ LISTCHOICE *newelement(char *text) {
   return newp;
 }
 
-// deleleteList: remove list from memory
+// deleteList: remove list from memory
 LISTCHOICE *deleteList(LISTCHOICE * head) {
   LISTCHOICE *p, *prev;
   prev = NULL;
@@ -163,21 +253,72 @@ LISTCHOICE *deleteList(LISTCHOICE * head) {
   return NULL;
 }
 
+// initList: set up an empty list
+void initList(LISTDATA * list) {
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation = 0;
+}
+
 /* addend: add new LISTCHOICE to the end of a list  */
-/* usage example: listBox1 = (addend(listBox1, newelement("Item")); */
-LISTCHOICE *addend(LISTCHOICE * head, LISTCHOICE * newp) {
-  LISTCHOICE *p2;
-  if(head == NULL) {
+/* usage example: addend(&listBox1, newelement("Item")); */
+/* The tail is kept in LISTDATA so no walk is needed. O(1) */
+void addend(LISTDATA * list, LISTCHOICE * newp) {
+  newp->next = NULL;
+  newp->back = list->tail;
+  if(list->tail == NULL) {
     newp->index = 0;
-    newp->back = NULL;
-    return newp;
+    list->head = newp;
+  } else {
+    list->tail->next = newp;
+    newp->index = list->tail->index + 1;
   }
-// now find the end of list
-  for(p2 = head; p2->next != NULL; p2 = p2->next) ;
-  p2->next = newp;
-  newp->back = p2;
-  newp->index = newp->back->index + 1;
-  return head;
+  list->tail = newp;
+  list->length++;
+  list->generation++;
+}
+
+/* addfront: add new LISTCHOICE to the beginning of a list */
+/* Item numbers of the items behind it are shifted by one. O(n) */
+void addfront(LISTDATA * list, LISTCHOICE * newp) {
+  LISTCHOICE *aux;
+  newp->back = NULL;
+  newp->next = list->head;
+  newp->index = 0;
+  if(list->head == NULL)
+    list->tail = newp;
+  else
+    list->head->back = newp;
+  list->head = newp;
+  list->length++;
+  list->generation++;
+  for(aux = newp->next; aux != NULL; aux = aux->next)
+    aux->index = aux->back->index + 1;
+}
+
+/* addlist: move all the items of a second list to the end of a list */
+/* Only the moved items are renumbered. "items" is left empty. O(k) */
+void addlist(LISTDATA * list, LISTDATA * items) {
+  LISTCHOICE *aux;
+  unsigned index;
+  if(items->head == NULL)
+    return;
+  index = (list->tail == NULL) ? 0 : list->tail->index + 1;
+  for(aux = items->head; aux != NULL; aux = aux->next)
+    aux->index = index++;
+  items->head->back = list->tail;
+  if(list->tail == NULL)
+    list->head = items->head;
+  else
+    list->tail->next = items->head;
+  list->tail = items->tail;
+  list->length = list->length + items->length;
+  list->generation++;
+  items->generation++;
+  items->head = NULL;
+  items->tail = NULL;
+  items->length = 0;
 }
 
 void gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
@@ -186,7 +327,7 @@ void gotoIndex(LISTCHOICE ** aux, SCROLLDATA * scrollData,
 {
   LISTCHOICE *aux2;
   unsigned counter = 0;
-  *aux = listBox1;
+  *aux = listBox1.head;
   aux2 = *aux;
   while(counter != indexAt) {
     aux2 = aux2->next;
@@ -222,20 +363,9 @@ in scrollData.
   } while(counter != scrollData->displayLimit);
 }
 
-int query_length(LISTCHOICE ** head) {
-//Measure no. items in a list.
-  {
-    LISTCHOICE *aux;
-
-    unsigned itemCount = 0;
-    aux = *head;
-    while(aux->next != NULL) {
-      aux = aux->next;
-      itemCount++;
-    }
-    return itemCount;
-  }
-
+unsigned query_length(LISTDATA * list) {
+//Return no. items in a list. Kept up to date by the list routines.
+  return list->length;
 }
 
 int move_down(LISTCHOICE ** head, SCROLLDATA * scrollData) {
@@ -399,7 +529,7 @@ char selectorMenu(LISTCHOICE * aux, SCROLLDATA * scrollData) {
   return ch;
 }
 
-void listBox(LISTCHOICE * head,
+void listBox(LISTDATA * list,
 	     unsigned whereX, unsigned whereY, SCROLLDATA * scrollData,
 	     unsigned bColor0, unsigned fColor0, unsigned bColor1,
 	     unsigned fColor1, unsigned displayLimit) {
@@ -412,7 +542,7 @@ void listBox(LISTCHOICE * head,
   LISTCHOICE *aux;
 
   // Query size of the list
-  list_length = query_length(&head) + 1;
+  list_length = query_length(list);
 
   //Save calculations for SCROLL and store DATA
   scrollData->displayLimit = displayLimit;
@@ -433,7 +563,7 @@ void listBox(LISTCHOICE * head,
     //Scroll is possible  
 
     scrollData->scrollActive = SCROLL_ACTIVE;
-    aux = head;
+    aux = list->head;
 
     currentListIndex = 0;	//We listBox1 the scroll at the top index.
     scrollData->currentListIndex = currentListIndex;
@@ -453,23 +583,23 @@ void listBox(LISTCHOICE * head,
   } else {
     //Scroll is not possible
     scrollData->scrollActive = SCROLL_INACTIVE;
-    loadlist(head, scrollData, 0);
-    ch = selectorMenu(head, scrollData);
+    loadlist(list->head, scrollData, 0);
+    ch = selectorMenu(list->head, scrollData);
   }
 
 }
 
-void addItems(LISTCHOICE ** listBox1) {
-  if(*listBox1 != NULL)
-    deleteList(*listBox1);
-  *listBox1 = addend(*listBox1, newelement("Option 1"));
-  *listBox1 = addend(*listBox1, newelement("Option 2"));
-  *listBox1 = addend(*listBox1, newelement("Option 3"));
-  *listBox1 = addend(*listBox1, newelement("Option 4"));
-  *listBox1 = addend(*listBox1, newelement("Option 5"));
-  *listBox1 = addend(*listBox1, newelement("Option 6"));
-  *listBox1 = addend(*listBox1, newelement("Option 7"));
-  *listBox1 = addend(*listBox1, newelement("Option 8"));
+void addItems(LISTDATA * listBox1) {
+  if(listBox1->head != NULL)
+    deleteL(listBox1);
+  addend(listBox1, newelement("Option 1"));
+  addend(listBox1, newelement("Option 2"));
+  addend(listBox1, newelement("Option 3"));
+  addend(listBox1, newelement("Option 4"));
+  addend(listBox1, newelement("Option 5"));
+  addend(listBox1, newelement("Option 6"));
+  addend(listBox1, newelement("Option 7"));
+  addend(listBox1, newelement("Option 8"));
 }
 // delelement: remove from list the first instance of an element 
 // containing a given text string
@@ -491,37 +621,33 @@ LISTCHOICE *deleteElement(LISTCHOICE *head, char *text)
 }
 
 /* Function to delete the entire linked list */
-void deleteL(LISTCHOICE **head) 
-{ 
-   /* deref head_ref to get the real head */
-   LISTCHOICE *current = *head; 
-   LISTCHOICE *next; 
-  
-   while (current != NULL)  
-   { 
-       next = current->next; 
-       //if (current != NULL){
-         free(current->item);
-         free(current);
-       //}
-       current = next; 
-   } 
-    
-   /* deref head_ref to affect the real head back 
-      in the caller. */
-   *head = NULL; 
-} 
+void deleteL(LISTDATA * list) {
+  LISTCHOICE *aux = list->head;
+  LISTCHOICE *next = NULL;
+  while(aux != NULL) {
+    next = aux->next;
+    free(aux->item);
+    free(aux);			//remove item
+    aux = next;
+  }
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->generation++;
+}
 
 int main() {
   SCROLLDATA scrollData;
 
   system("clear");
+  openTerm();
 
   addItems(&listBox1);
-  listBox(listBox1, 10, 8, &scrollData, B_BLACK, F_WHITE, B_BLUE,
+  listBox(&listBox1, 10, 8, &scrollData, B_BLACK, F_WHITE, B_BLUE,
 	  FH_WHITE, 3);
 
   deleteL(&listBox1);
+  closeTerm();
 //  deleteElement(listBox1,"Option 2");
 //  deleteElement(listBox1,"Option 3");
 //  deleteElement(listBox1,"Option 4");